@@ -0,0 +1,189 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  account.c: Process accounting
+
+  exec_wrapper() only sees the start of a child. If CREW_PRELOAD_ACCOUNT is set to a file path, every process using
+  crew-preload.so also appends a fixed-size record (see account.h) to that file:
+
+    - for every posix_spawn*() that succeeded: child pid, resolved executable, start time
+    - before every exec*(): own pid, resolved executable, start time (and another record if the exec*() failed)
+    - for every child reaped by wait()/wait3()/waitpid()/wait4()/waitid(): exit status, end time, user/system CPU time
+      and max RSS (from the rusage of wait4(), the other wait*() calls are performed with it as well)
+
+  The executable recorded for scripts is the script itself, not its interpreter. Children that are reaped by
+  processes without crew-preload.so (or by glibc internally) are not accounted. Use tools/crew-preload-account to
+  fold the log into totals per command and per package.
+*/
+
+#include "./main.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// process account_fd belongs to, vfork() children (dash...) run in the memory of their parent and leave their
+// descriptor behind once they exec*(), -pid while that process is opening the log
+static pid_t account_pid = 0;
+static int   account_fd  = -1;
+
+// state of the current exec_wrapper() call of this thread
+static THREAD_LOCAL bool     exec_recorded = false;
+static THREAD_LOCAL bool     exec_resolved = false;
+static THREAD_LOCAL bool     exec_is_spawn = false;
+static THREAD_LOCAL uint64_t exec_start    = 0;
+static THREAD_LOCAL char     exec_command[sizeof(((struct AccountRecord *) 0)->command)];
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static int open_account(void) {
+  // open_account(): descriptor of the accounting log, -1 unless CREW_PRELOAD_ACCOUNT is set (or while another thread
+  //                 is opening it)
+  const char *account_path = getenv("CREW_PRELOAD_ACCOUNT");
+  pid_t      self         = getpid(),
+             owner        = __atomic_load_n(&account_pid, __ATOMIC_ACQUIRE);
+  int        fd           = -1;
+
+  if (owner == self) return __atomic_load_n(&account_fd, __ATOMIC_RELAXED);
+  if (owner == -self || !__atomic_compare_exchange_n(&account_pid, &owner, -self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return -1;
+
+  if (account_path && account_path[0] != '\0' && !disabled &&
+      (fd = open(account_path, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+    fprintf(stderr, "[PID %-7i] %s: Failed to open accounting log %s (%s)\n", self, PROMPT_NAME, account_path, strerror(errno));
+  }
+
+  __atomic_store_n(&account_fd, fd, __ATOMIC_RELAXED);
+  __atomic_store_n(&account_pid, self, __ATOMIC_RELEASE);
+
+  return fd;
+}
+
+static void append_record(enum AccountRecordType type, pid_t record_pid, pid_t record_ppid, uint64_t time_ns,
+                          const char *command, int status, const struct rusage *usage) {
+  struct AccountRecord record;
+  int                  saved_errno = errno;
+
+  memset(&record, 0, sizeof(record));
+
+  record.magic   = PRELOAD_ACCOUNT_MAGIC;
+  record.version = PRELOAD_ACCOUNT_VERSION;
+  record.type    = type;
+  record.pid     = record_pid;
+  record.ppid    = record_ppid;
+  record.time_ns = time_ns;
+  record.status  = status;
+
+  if (command) snprintf(record.command, sizeof(record.command), "%s", command);
+
+  if (usage) {
+    record.maxrss_kb = usage->ru_maxrss;
+    record.utime_us  = usage->ru_utime.tv_sec * 1000000ull + usage->ru_utime.tv_usec;
+    record.stime_us  = usage->ru_stime.tv_sec * 1000000ull + usage->ru_stime.tv_usec;
+  }
+
+  if (write(account_fd, &record, sizeof(record)) != sizeof(record) && verbose) {
+    fprintf(stderr, "[PID %-7i] %s: Failed to write accounting record (%s)\n", getpid(), PROMPT_NAME, strerror(errno));
+  }
+
+  errno = saved_errno;
+}
+
+void account_exec_begin(const char *path, bool is_spawn) {
+  // account_exec_begin(): called when exec_wrapper() is entered, exec_start stays 0 if nothing is accounted
+  exec_start    = 0;
+  exec_recorded = false;
+  exec_resolved = false;
+
+  if (open_account() == -1) return;
+
+  exec_is_spawn = is_spawn;
+  exec_start    = monotonic_ns();
+
+  snprintf(exec_command, sizeof(exec_command), "%s", path);
+}
+
+void account_exec_target(const char *path) {
+  // account_exec_target(): replaces the path passed to exec_wrapper() by the executable it resolved to (scripts
+  //                        are resolved again for their interpreter, only the first one counts)
+  if (exec_start == 0 || exec_resolved) return;
+
+  exec_resolved = true;
+  snprintf(exec_command, sizeof(exec_command), "%s", path);
+}
+
+void account_exec_ready(void) {
+  // account_exec_ready(): called right before the real exec*()/posix_spawn*(), records exec*() (only once for
+  //                       scripts re-executed with their interpreter), as nothing can be written after it succeeded
+  if (exec_start == 0 || exec_recorded || exec_is_spawn) return;
+
+  exec_recorded = true;
+  append_record(ACCOUNT_EXEC, getpid(), getppid(), exec_start, exec_command, 0, NULL);
+}
+
+void account_exec_end(const void *pid_p, bool failed) {
+  // account_exec_end(): called when exec_wrapper() returns (exec*() failed or posix_spawn*() finished)
+  if (exec_start == 0) return;
+
+  if (exec_is_spawn && !failed) {
+    append_record(ACCOUNT_SPAWN, *(const pid_t *) pid_p, getpid(), exec_start, exec_command, 0, NULL);
+  } else if (!exec_is_spawn && exec_recorded) {
+    append_record(ACCOUNT_EXEC_FAILED, getpid(), getppid(), monotonic_ns(), NULL, 0, NULL);
+  }
+}
+
+pid_t account_wait4(pid_t child, int *status, int options, struct rusage *usage) {
+  // account_wait4(): wait4() that records children that have terminated
+  struct rusage own_usage;
+  pid_t         ret;
+  int           own_status;
+
+  if (open_account() == -1) return orig_wait4(child, status, options, usage);
+
+  ret = orig_wait4(child, &own_status, options, usage ?: &own_usage);
+
+  if (ret > 0) {
+    if (WIFEXITED(own_status) || WIFSIGNALED(own_status)) {
+      append_record(ACCOUNT_EXIT, ret, getpid(), monotonic_ns(), NULL, own_status, usage ?: &own_usage);
+    }
+
+    if (status) *status = own_status;
+  }
+
+  return ret;
+}
+
+int account_waitid(idtype_t idtype, id_t id, siginfo_t *info, int options) {
+  // account_waitid(): waitid() that records children that have terminated, through the raw syscall as only
+  //                   that one returns the rusage of the child (WNOWAIT leaves the child to a later call)
+  struct rusage usage;
+  siginfo_t     own_info, *child = info ?: &own_info;
+  int           ret, status;
+
+  if (open_account() == -1 || (options & WNOWAIT) || !(options & WEXITED)) return orig_waitid(idtype, id, info, options);
+
+  // the kernel only fills info if a child was found (info may be NULL, we still need to know which child it was)
+  child->si_pid = 0;
+
+  if ((ret = syscall(SYS_waitid, idtype, id, child, options, &usage)) == 0 && child->si_pid > 0 &&
+      (child->si_code == CLD_EXITED || child->si_code == CLD_KILLED || child->si_code == CLD_DUMPED)) {
+    if (child->si_code == CLD_EXITED) {
+      status = (child->si_status & 0xff) << 8;
+    } else {
+      status = child->si_status | (child->si_code == CLD_DUMPED ? 0x80 : 0);
+    }
+
+    append_record(ACCOUNT_EXIT, child->si_pid, getpid(), monotonic_ns(), NULL, status, &usage);
+  }
+
+  return ret;
+}
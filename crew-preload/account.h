@@ -0,0 +1,45 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  account.h: Layout of the process accounting log written by crew-preload.so (see account.c), also used by
+             tools/crew-preload-account.c to read it
+*/
+
+#ifndef ACCOUNT_H_INCLUDED
+#define ACCOUNT_H_INCLUDED
+
+#include <stdint.h>
+
+#define PRELOAD_ACCOUNT_MAGIC   0x43525041 // "CRPA"
+#define PRELOAD_ACCOUNT_VERSION 1
+
+enum AccountRecordType {
+  ACCOUNT_SPAWN = 1,   // posix_spawn*() returned a new child: pid is the child, ppid the caller
+  ACCOUNT_EXEC,        // exec*() is about to replace the image of pid, ppid is its parent
+  ACCOUNT_EXEC_FAILED, // the exec*() of the previous ACCOUNT_EXEC record of pid returned
+  ACCOUNT_EXIT         // pid was waited for by ppid (wait*() hooks), with its status and resource usage
+};
+
+// records are appended with a single write() on an O_APPEND descriptor, so they never interleave
+struct AccountRecord {
+  uint32_t magic;
+  uint16_t version,
+           type;          // enum AccountRecordType
+  uint32_t pid,
+           ppid;
+  uint64_t time_ns;       // CLOCK_MONOTONIC: start of the posix_spawn*()/exec*() call, or when the child was waited for
+  int32_t  status;        // ACCOUNT_EXIT: wait status
+  uint32_t maxrss_kb;     // ACCOUNT_EXIT: ru_maxrss of the child
+  uint64_t utime_us,      // ACCOUNT_EXIT: CPU time of the child and everything it waited for itself
+           stime_us;
+  char     command[208];  // ACCOUNT_SPAWN/ACCOUNT_EXEC: resolved path of the executable (or script), truncated
+};
+
+#endif
@@ -0,0 +1,149 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  exec-cache-rss: Measure memory used by concurrent instances of an executable rewritten by crew-preload.so,
+                  with the executable served from memfd and from the exec cache
+
+  The test executable is a copy of sleep(1) padded to the given size, started through /bin/sh so that
+  crew-preload.so sees the exec. crew-preload.so must be built with CREW_GLIBC_INTERPRETER pointing to
+  an existing dynamic linker (a copy of the system one is fine), otherwise nothing will be rewritten.
+
+  Usage:
+
+    cc -O2 exec-cache-rss.c -o exec-cache-rss
+    ./exec-cache-rss <path to crew-preload.so> [instances (default: 8)] [size in MiB (default: 64)]
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+static long read_kb(const char *file, const char *field) {
+  // read_kb(): read a "Field:   1234 kB" line from a /proc file
+  char line[256];
+  long value     = -1;
+  FILE *fp       = fopen(file, "r");
+  int  field_len = strlen(field);
+
+  if (fp == NULL) return -1;
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (strncmp(line, field, field_len) == 0 && line[field_len] == ':') {
+      value = strtol(line + field_len + 1, NULL, 10);
+      break;
+    }
+  }
+
+  fclose(fp);
+  return value;
+}
+
+static void make_padded_executable(const char *src, const char *dest, long size) {
+  char buf[65536];
+  int  in_fd  = open(src, O_RDONLY),
+       out_fd = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+  long written = 0;
+  ssize_t len;
+
+  if (in_fd == -1 || out_fd == -1) {
+    perror(src);
+    exit(1);
+  }
+
+  while ((len = read(in_fd, buf, sizeof(buf))) > 0) written += write(out_fd, buf, len);
+
+  // pad with non-zero bytes, data appended after the section headers is ignored by the kernel and the dynamic linker
+  memset(buf, 0xcc, sizeof(buf));
+  while (written < size) written += write(out_fd, buf, (size - written) < (long) sizeof(buf) ? (size - written) : (long) sizeof(buf));
+
+  close(in_fd);
+  close(out_fd);
+}
+
+static void run(const char *mode, const char *preload, const char *exec_path, const char *cache_dir, int instances) {
+  char  preload_env[4096], cache_env[4096], path[64];
+  char  *argv[] = { "sh", "-c", "exec \"$0\" 60", (char *) exec_path, NULL };
+  char  *envp[] = { preload_env, cache_env, "PATH=/usr/bin:/bin", NULL };
+  pid_t *pids   = calloc(instances, sizeof(pid_t));
+  long  shmem_before, shmem_after, rss = 0, pss = 0;
+
+  snprintf(preload_env, sizeof(preload_env), "LD_PRELOAD=%s", preload);
+
+  if (cache_dir) {
+    snprintf(cache_env, sizeof(cache_env), "CREW_PRELOAD_EXEC_CACHE_DIR=%s", cache_dir);
+  } else {
+    snprintf(cache_env, sizeof(cache_env), "CREW_PRELOAD_NO_EXEC_CACHE=1");
+  }
+
+  shmem_before = read_kb("/proc/meminfo", "Shmem");
+
+  for (int i = 0; i < instances; i++) {
+    if (posix_spawn(&pids[i], "/bin/sh", NULL, NULL, argv, envp) != 0) {
+      perror("posix_spawn");
+      exit(1);
+    }
+
+    // let the first instance populate the exec cache before starting the others
+    if (i == 0) sleep(1);
+  }
+
+  sleep(2);
+  shmem_after = read_kb("/proc/meminfo", "Shmem");
+
+  for (int i = 0; i < instances; i++) {
+    snprintf(path, sizeof(path), "/proc/%i/smaps_rollup", pids[i]);
+    rss += read_kb(path, "Rss");
+    pss += read_kb(path, "Pss");
+  }
+
+  printf("%-8s %9i %12li %12li %12li\n", mode, instances, shmem_after - shmem_before, rss, pss);
+
+  for (int i = 0; i < instances; i++) {
+    kill(pids[i], SIGKILL);
+    waitpid(pids[i], NULL, 0);
+  }
+
+  free(pids);
+}
+
+int main(int argc, char **argv) {
+  char tmp_dir[] = "/tmp/exec-cache-rss.XXXXXX", exec_path[4096], cache_dir[4096], preload[4096];
+  int  instances = (argc > 2) ? atoi(argv[2]) : 8;
+  long size      = ((argc > 3) ? atol(argv[3]) : 64) * 1024 * 1024;
+
+  if (argc < 2 || realpath(argv[1], preload) == NULL) {
+    fprintf(stderr, "Usage: %s <path to crew-preload.so> [instances] [size in MiB]\n", argv[0]);
+    return 1;
+  }
+
+  if (mkdtemp(tmp_dir) == NULL) {
+    perror("mkdtemp");
+    return 1;
+  }
+
+  snprintf(exec_path, sizeof(exec_path), "%s/sleep", tmp_dir);
+  snprintf(cache_dir, sizeof(cache_dir), "%s/cache", tmp_dir);
+  make_padded_executable("/bin/sleep", exec_path, size);
+
+  printf("%-8s %9s %12s %12s %12s\n", "mode", "instances", "shmem (kB)", "rss (kB)", "pss (kB)");
+  run("memfd", preload, exec_path, NULL, instances);
+  run("cache", preload, exec_path, cache_dir, instances);
+
+  fflush(stdout);
+  execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  return 0;
+}
@@ -0,0 +1,119 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  exec-latency: Measure latency of posix_spawn() + waitpid() for executables of different sizes that
+                need their interpreter rewritten by crew-preload.so
+
+  The test executables are copies of true(1) padded to 1 MiB, 20 MiB and 150 MiB. crew-preload.so must be
+  built with CREW_GLIBC_INTERPRETER pointing to an existing dynamic linker (a copy of the system one is fine).
+
+  Usage:
+
+    cc -O2 exec-latency.c -o exec-latency
+
+    # memfd path
+    LD_PRELOAD=crew-preload.so CREW_PRELOAD_NO_EXEC_CACHE=1 ./exec-latency [iterations (default: 20)]
+
+    # exec cache path
+    LD_PRELOAD=crew-preload.so CREW_PRELOAD_EXEC_CACHE_DIR=/tmp/exec-cache ./exec-latency [iterations (default: 20)]
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static const int sizes[] = { 1, 20, 150 };
+
+static int compare_double(const void *a, const void *b) {
+  return (*(double *) a > *(double *) b) - (*(double *) a < *(double *) b);
+}
+
+static void make_padded_executable(const char *src, const char *dest, long size) {
+  char    buf[65536];
+  int     in_fd   = open(src, O_RDONLY),
+          out_fd  = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+  long    written = 0;
+  ssize_t len;
+
+  if (in_fd == -1 || out_fd == -1) {
+    perror(src);
+    exit(1);
+  }
+
+  while ((len = read(in_fd, buf, sizeof(buf))) > 0) written += write(out_fd, buf, len);
+
+  // pad with non-zero bytes, data appended after the section headers is ignored by the kernel and the dynamic linker
+  memset(buf, 0xcc, sizeof(buf));
+  while (written < size) written += write(out_fd, buf, (size - written) < (long) sizeof(buf) ? (size - written) : (long) sizeof(buf));
+
+  close(in_fd);
+  close(out_fd);
+}
+
+int main(int argc, char **argv) {
+  char tmp_dir[] = "/tmp/exec-latency.XXXXXX", exec_path[4096];
+  int  iterations = (argc > 1) ? atoi(argv[1]) : 20;
+
+  if (getenv("LD_PRELOAD") == NULL) fprintf(stderr, "warning: LD_PRELOAD is not set, measuring without crew-preload.so\n");
+
+  if (iterations < 1 || mkdtemp(tmp_dir) == NULL) {
+    fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  printf("%-10s %12s %12s %12s\n", "size (MiB)", "mean (ms)", "median (ms)", "min (ms)");
+
+  for (int s = 0; s < (int) (sizeof(sizes) / sizeof(int)); s++) {
+    char   *spawn_argv[] = { "true", NULL };
+    double *results      = calloc(iterations, sizeof(double)), total = 0;
+
+    snprintf(exec_path, sizeof(exec_path), "%s/true-%iM", tmp_dir, sizes[s]);
+    make_padded_executable("/bin/true", exec_path, (long) sizes[s] * 1024 * 1024);
+
+    // warm up page cache (and exec cache, if enabled)
+    for (int i = -1; i < iterations; i++) {
+      struct timespec start, end;
+      pid_t           pid;
+
+      clock_gettime(CLOCK_MONOTONIC, &start);
+
+      if (posix_spawn(&pid, exec_path, NULL, NULL, spawn_argv, environ) != 0) {
+        perror("posix_spawn");
+        return 1;
+      }
+
+      waitpid(pid, NULL, 0);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+
+      if (i >= 0) {
+        results[i] = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        total     += results[i];
+      }
+    }
+
+    qsort(results, iterations, sizeof(double), compare_double);
+    printf("%-10i %12.3f %12.3f %12.3f\n", sizes[s], total / iterations, results[iterations / 2], results[0]);
+
+    unlink(exec_path);
+    free(results);
+  }
+
+  rmdir(tmp_dir);
+  return 0;
+}
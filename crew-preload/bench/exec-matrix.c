@@ -0,0 +1,253 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  exec-matrix: Measure per-exec latency and peak RSS of a matrix of executables and exec methods,
+               with and without crew-preload.so
+
+  Cases:
+    static          static ELF
+    dynamic-*       dynamic ELF with the host (foreign) interpreter, unpadded and padded to 1/10/100 MiB
+    crew-interp     dynamic ELF that already uses CREW_GLIBC_INTERPRETER
+    script          #! script (interpreter is the dynamic ELF)
+    script-args     #! script with interpreter arguments
+    script-env      #!/usr/bin/env script (interpreter found through PATH)
+    system          /usr/bin/true (system command, LD_LIBRARY_PATH is stashed)
+    linker          dynamic ELF named `ld`, with CREW_PRELOAD_ENABLE_COMPILE_HACKS=1 (and CREW_PRELOAD_NO_MOLD=1)
+
+  Methods: fork() + execve(), fork() + execvp() (by name, through PATH) and posix_spawn()
+
+  Each combination runs in a separate worker process (this program re-executed with or without LD_PRELOAD),
+  so the worker itself pays for crew-preload.so only when measuring it. Peak RSS is reported for the
+  worker (parent side of the exec) and for its children (ru_maxrss of RUSAGE_SELF/RUSAGE_CHILDREN).
+
+  The helper executables (true-static, true-dynamic, true-crew) and crew-preload-standin.so (built against
+  a copy of the host dynamic linker, see Makefile) are expected next to this program, `make bench-run` builds
+  everything and runs it.
+
+  Usage:
+
+    ./exec-matrix <path to crew-preload.so> [iterations (default: 200)] [case filter]
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+struct ExecCase {
+  const char *name,
+             *file;        // file name in the temporary directory, or absolute path
+  long       pad_to;       // pad the copy to this size (bytes), 0 for an unpadded copy
+  const char *source,      // helper executable to copy from (next to this program)
+             *script_args; // create a #! script instead (interpreter is true-dynamic), NULL for ELF
+  bool       via_env,      // script runs its interpreter through "#!/usr/bin/env true-dynamic"
+             compile_hacks;
+};
+
+static const struct ExecCase cases[] = {
+  { "static",       "true-static",  0,                   "true-static",  NULL, false, false },
+  { "dynamic-16k",  "true-dynamic", 0,                   "true-dynamic", NULL, false, false },
+  { "dynamic-1m",   "true-1m",      1L * 1024 * 1024,    "true-dynamic", NULL, false, false },
+  { "dynamic-10m",  "true-10m",     10L * 1024 * 1024,   "true-dynamic", NULL, false, false },
+  { "dynamic-100m", "true-100m",    100L * 1024 * 1024,  "true-dynamic", NULL, false, false },
+  { "crew-interp",  "true-crew",    0,                   "true-crew",    NULL, false, false },
+  { "script",       "script",       0,                   NULL,           "",   false, false },
+  { "script-args",  "script-args",  0,                   NULL,           "-x", false, false },
+  { "script-env",   "script-env",   0,                   NULL,           "",   true,  false },
+  { "system",       "/usr/bin/true", 0,                  NULL,           NULL, false, false },
+  { "linker",       "ld",           0,                   "true-dynamic", NULL, false, true  },
+};
+
+static const char *methods[] = { "execve", "execvp", "posix_spawn" };
+
+static int compare_double(const void *a, const void *b) {
+  return (*(double *) a > *(double *) b) - (*(double *) a < *(double *) b);
+}
+
+static void copy_executable(const char *src, const char *dest, long size) {
+  char    buf[65536];
+  int     in_fd   = open(src, O_RDONLY),
+          out_fd  = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+  long    written = 0;
+  ssize_t len;
+
+  if (in_fd == -1 || out_fd == -1) {
+    perror(src);
+    exit(1);
+  }
+
+  while ((len = read(in_fd, buf, sizeof(buf))) > 0) written += write(out_fd, buf, len);
+
+  // pad with non-zero bytes, data appended after the section headers is ignored by the kernel and the dynamic linker
+  memset(buf, 0xcc, sizeof(buf));
+  while (written < size) written += write(out_fd, buf, (size - written) < (long) sizeof(buf) ? (size - written) : (long) sizeof(buf));
+
+  close(in_fd);
+  close(out_fd);
+}
+
+static int run_worker(const char *exec_path, const char *method, int iterations, const char *label) {
+  // run_worker(): exec exec_path repeatedly with the given method, print latency distribution and peak RSS
+  char          *exec_argv[] = { (char *) exec_path, NULL }, *name = strrchr(exec_path, '/') + 1;
+  double        *results     = calloc(iterations, sizeof(double)), total = 0;
+  struct rusage self_usage, children_usage;
+
+  for (int i = -1; i < iterations; i++) {
+    struct timespec start, end;
+    pid_t           child;
+    int             status;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (strcmp(method, "posix_spawn") == 0) {
+      if (posix_spawn(&child, exec_path, NULL, NULL, exec_argv, environ) != 0) {
+        fprintf(stderr, "%s: posix_spawn() failed\n", label);
+        return 1;
+      }
+    } else if ((child = fork()) == 0) {
+      if (strcmp(method, "execvp") == 0) {
+        exec_argv[0] = name;
+        execvp(name, exec_argv);
+      } else {
+        execve(exec_path, exec_argv, environ);
+      }
+
+      _exit(127);
+    }
+
+    waitpid(child, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s: exec failed (status %i)\n", label, status);
+      return 1;
+    }
+
+    // first iteration warms up page cache and the caches of crew-preload.so
+    if (i >= 0) {
+      results[i] = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+      total     += results[i];
+    }
+  }
+
+  getrusage(RUSAGE_SELF, &self_usage);
+  getrusage(RUSAGE_CHILDREN, &children_usage);
+  qsort(results, iterations, sizeof(double), compare_double);
+
+  printf("%-36s %9.1f %9.1f %9.1f %9.1f %9.1f %10li %10li\n", label, total / iterations,
+         results[iterations / 2], results[iterations * 9 / 10], results[iterations * 99 / 100], results[iterations - 1],
+         self_usage.ru_maxrss, children_usage.ru_maxrss);
+
+  free(results);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  char       tmp_dir[] = "/tmp/exec-matrix.XXXXXX", self_dir[PATH_MAX], preload[PATH_MAX], self_path[PATH_MAX],
+             path_env[PATH_MAX * 2], exec_path[PATH_MAX], src_path[PATH_MAX * 2], preload_env[PATH_MAX + 16],
+             exec_cache_env[PATH_MAX + 32], decision_cache_env[PATH_MAX + 32];
+  int        iterations = (argc > 2) ? atoi(argv[2]) : 200;
+  const char *filter    = (argc > 3) ? argv[3] : NULL;
+  ssize_t    len;
+
+  // worker mode: exec-matrix --worker <exec path> <method> <iterations> <label>
+  if (argc == 6 && strcmp(argv[1], "--worker") == 0) return run_worker(argv[2], argv[3], atoi(argv[4]), argv[5]);
+
+  if (argc < 2 || realpath(argv[1], preload) == NULL || iterations < 1) {
+    fprintf(stderr, "Usage: %s <path to crew-preload.so> [iterations] [case filter]\n", argv[0]);
+    return 1;
+  }
+
+  if ((len = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1)) == -1 || mkdtemp(tmp_dir) == NULL) {
+    perror(argv[0]);
+    return 1;
+  }
+
+  self_path[len] = '\0';
+  strcpy(self_dir, self_path);
+  *strrchr(self_dir, '/') = '\0';
+
+  // set up test cases
+  for (int c = 0; c < (int) (sizeof(cases) / sizeof(cases[0])); c++) {
+    if (cases[c].file[0] == '/') continue;
+
+    snprintf(exec_path, sizeof(exec_path), "%s/%s", tmp_dir, cases[c].file);
+
+    if (cases[c].script_args) {
+      FILE *fp = fopen(exec_path, "w");
+
+      if (cases[c].via_env) {
+        fprintf(fp, "#!/usr/bin/env true-dynamic\n");
+      } else {
+        fprintf(fp, "#!%s/true-dynamic%s%s\n", self_dir, cases[c].script_args[0] ? " " : "", cases[c].script_args);
+      }
+      fclose(fp);
+      chmod(exec_path, 0755);
+    } else {
+      snprintf(src_path, sizeof(src_path), "%s/%s", self_dir, cases[c].source);
+      copy_executable(src_path, exec_path, cases[c].pad_to);
+    }
+  }
+
+  snprintf(path_env, sizeof(path_env), "PATH=%s:/usr/bin:/bin", tmp_dir);
+  snprintf(preload_env, sizeof(preload_env), "LD_PRELOAD=%s", preload);
+  snprintf(exec_cache_env, sizeof(exec_cache_env), "CREW_PRELOAD_EXEC_CACHE_DIR=%s/exec-cache", tmp_dir);
+  snprintf(decision_cache_env, sizeof(decision_cache_env), "CREW_PRELOAD_DECISION_CACHE=%s/decisions", tmp_dir);
+
+  printf("%i iterations per case, latency in us, peak RSS in kB\n\n", iterations);
+  printf("%-36s %9s %9s %9s %9s %9s %10s %10s\n", "case/method/preload", "mean", "p50", "p90", "p99", "max", "rss", "child rss");
+
+  for (int c = 0; c < (int) (sizeof(cases) / sizeof(cases[0])); c++) {
+    if (filter && strstr(cases[c].name, filter) == NULL) continue;
+
+    if (cases[c].file[0] == '/') {
+      snprintf(exec_path, sizeof(exec_path), "%s", cases[c].file);
+    } else {
+      snprintf(exec_path, sizeof(exec_path), "%s/%s", tmp_dir, cases[c].file);
+    }
+
+    for (int m = 0; m < (int) (sizeof(methods) / sizeof(methods[0])); m++) {
+      for (int with_preload = 0; with_preload <= 1; with_preload++) {
+        char  iterations_str[16], label[64];
+        char  *worker_argv[] = { self_path, "--worker", exec_path, (char *) methods[m], iterations_str, label, NULL };
+        char  *worker_envp[] = { path_env, exec_cache_env, decision_cache_env,
+                                 cases[c].compile_hacks ? "CREW_PRELOAD_ENABLE_COMPILE_HACKS=1" : "CREW_PRELOAD_VERBOSE=0",
+                                 "CREW_PRELOAD_NO_MOLD=1", with_preload ? preload_env : NULL, NULL };
+        pid_t worker;
+
+        snprintf(iterations_str, sizeof(iterations_str), "%i", iterations);
+        snprintf(label, sizeof(label), "%s/%s/%s", cases[c].name, methods[m], with_preload ? "preload" : "none");
+        fflush(stdout);
+
+        if (posix_spawn(&worker, self_path, NULL, NULL, worker_argv, worker_envp) != 0) {
+          perror("posix_spawn");
+          return 1;
+        }
+
+        waitpid(worker, NULL, 0);
+      }
+    }
+  }
+
+  fflush(stdout);
+  execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  return 0;
+}
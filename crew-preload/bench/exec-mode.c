@@ -0,0 +1,242 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  exec-mode: Compare the ways crew-preload.so can run an executable with a foreign interpreter, over a range of
+             executable sizes
+
+  Modes:
+    memfd       private copy in a memfd per exec (CREW_PRELOAD_NO_EXEC_CACHE=1, see change_elf_interpreter())
+    exec-cache  shared copy in the exec cache (default)
+    loader      CREW_GLIBC_INTERPRETER --argv0 <argv[0]> <executable> (CREW_PRELOAD_EXEC_MODE=loader)
+
+  The executed program is a copy of this program (which uses the host dynamic linker), padded to 16 KiB - 100 MiB.
+  In each child it reports its VmRSS, the memory held by a private copy of itself (st_blocks of /proc/self/exe if
+  it is a memfd, this stays allocated until the child exits), what /proc/self/exe points to and whether argv[0]
+  was preserved.
+
+  Each mode runs in a separate worker process (this program re-executed with LD_PRELOAD), the first exec of each
+  case is not measured (it writes the exec cache/decision cache entries). crew-preload-standin.so (see Makefile)
+  can be used on any Linux box.
+
+  Usage:
+
+    ./exec-mode <path to crew-preload.so> [iterations (default: 100)]
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define CHILD_ARGV0 "exec-mode-child"
+
+extern char **environ;
+
+struct ExecMode {
+  const char *name,
+             *env;
+};
+
+static const struct ExecMode modes[] = {
+  { "memfd",      "CREW_PRELOAD_NO_EXEC_CACHE=1" },
+  { "exec-cache", "CREW_PRELOAD_VERBOSE=0" },
+  { "loader",     "CREW_PRELOAD_EXEC_MODE=loader" },
+};
+
+struct ExecSize {
+  const char *name;
+  long       pad_to; // pad the copy to this size (bytes), 0 for an unpadded copy
+};
+
+static const struct ExecSize sizes[] = {
+  { "unpadded", 0 },
+  { "1m",       1L * 1024 * 1024 },
+  { "10m",      10L * 1024 * 1024 },
+  { "100m",     100L * 1024 * 1024 },
+};
+
+static int compare_double(const void *a, const void *b) {
+  return (*(double *) a > *(double *) b) - (*(double *) a < *(double *) b);
+}
+
+static void copy_executable(const char *src, const char *dest, long size) {
+  char    buf[65536];
+  int     in_fd   = open(src, O_RDONLY),
+          out_fd  = open(dest, O_WRONLY | O_CREAT | O_TRUNC, 0755);
+  long    written = 0;
+  ssize_t len;
+
+  if (in_fd == -1 || out_fd == -1) {
+    perror(src);
+    exit(1);
+  }
+
+  while ((len = read(in_fd, buf, sizeof(buf))) > 0) written += write(out_fd, buf, len);
+
+  // pad with non-zero bytes, data appended after the section headers is ignored by the kernel and the dynamic linker
+  memset(buf, 0xcc, sizeof(buf));
+  while (written < size) written += write(out_fd, buf, (size - written) < (long) sizeof(buf) ? (size - written) : (long) sizeof(buf));
+
+  close(in_fd);
+  close(out_fd);
+}
+
+static int run_child(char **argv) {
+  // run_child(): report VmRSS, private copy size, /proc/self/exe and argv[0] of this process on stdout
+  char        exe[PATH_MAX], line[256];
+  const char  *exe_kind;
+  long        rss = 0, copy = 0;
+  struct stat exe_info;
+  ssize_t     len  = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+  FILE        *fp  = fopen("/proc/self/status", "r");
+
+  exe[len > 0 ? len : 0] = '\0';
+
+  while (fp && fgets(line, sizeof(line), fp)) sscanf(line, "VmRSS: %li", &rss);
+  if (fp) fclose(fp);
+
+  if (strncmp(exe, "/memfd:", 7) == 0) {
+    exe_kind = "memfd";
+    if (stat("/proc/self/exe", &exe_info) == 0) copy = exe_info.st_blocks / 2;
+  } else if (strstr(exe, "/exec-cache/")) {
+    exe_kind = "exec cache";
+  } else if (strstr(exe, "exec-mode-") == NULL) {
+    exe_kind = "interpreter";
+  } else {
+    exe_kind = "executable";
+  }
+
+  printf("%li %li %s %s\n", rss, copy, strcmp(argv[0], CHILD_ARGV0) == 0 ? "kept" : "lost", exe_kind);
+  return 0;
+}
+
+static int run_worker(const char *exec_path, int iterations, const char *label) {
+  // run_worker(): posix_spawn() exec_path repeatedly, print latency distribution and the first child's report
+  char                       *exec_argv[] = { CHILD_ARGV0, "--child", NULL }, report[256] = "",
+                             argv0[16]    = "?", exe_kind[32] = "?";
+  double                     *results     = calloc(iterations, sizeof(double)), total = 0;
+  long                       rss          = 0, copy = 0;
+  posix_spawn_file_actions_t file_actions;
+
+  for (int i = -1; i < iterations; i++) {
+    struct timespec start, end;
+    pid_t           child;
+    int             status, pipe_fds[2];
+    ssize_t         len;
+
+    if (pipe(pipe_fds) == -1) return 1;
+
+    posix_spawn_file_actions_init(&file_actions);
+    posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_addclose(&file_actions, pipe_fds[0]);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if (posix_spawn(&child, exec_path, &file_actions, NULL, exec_argv, environ) != 0) {
+      fprintf(stderr, "%s: posix_spawn() failed\n", label);
+      return 1;
+    }
+
+    waitpid(child, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    posix_spawn_file_actions_destroy(&file_actions);
+    close(pipe_fds[1]);
+
+    if ((len = read(pipe_fds[0], report, sizeof(report) - 1)) > 0) report[len] = '\0';
+    close(pipe_fds[0]);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s: exec failed (status %i)\n", label, status);
+      return 1;
+    }
+
+    if (i >= 0) {
+      results[i] = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+      total     += results[i];
+    }
+  }
+
+  sscanf(report, "%li %li %15s %31[^\n]", &rss, &copy, argv0, exe_kind);
+  qsort(results, iterations, sizeof(double), compare_double);
+
+  printf("%-24s %9.1f %9.1f %9.1f %10li %10li %-6s %s\n", label, total / iterations, results[iterations / 2],
+         results[iterations * 9 / 10], rss, copy, argv0, exe_kind);
+
+  free(results);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  char    tmp_dir[] = "/tmp/exec-mode.XXXXXX", preload[PATH_MAX], self_path[PATH_MAX], exec_path[PATH_MAX],
+          preload_env[PATH_MAX + 16], exec_cache_env[PATH_MAX + 32], decision_cache_env[PATH_MAX + 32];
+  int     iterations = (argc > 2) ? atoi(argv[2]) : 100;
+  ssize_t len;
+
+  if (argc == 2 && strcmp(argv[1], "--child") == 0) return run_child(argv);
+
+  // worker mode: exec-mode --worker <exec path> <iterations> <label>
+  if (argc == 5 && strcmp(argv[1], "--worker") == 0) return run_worker(argv[2], atoi(argv[3]), argv[4]);
+
+  if (argc < 2 || realpath(argv[1], preload) == NULL || iterations < 1) {
+    fprintf(stderr, "Usage: %s <path to crew-preload.so> [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  if ((len = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1)) == -1 || mkdtemp(tmp_dir) == NULL) {
+    perror(argv[0]);
+    return 1;
+  }
+
+  self_path[len] = '\0';
+
+  snprintf(preload_env, sizeof(preload_env), "LD_PRELOAD=%s", preload);
+  snprintf(exec_cache_env, sizeof(exec_cache_env), "CREW_PRELOAD_EXEC_CACHE_DIR=%s/exec-cache", tmp_dir);
+  snprintf(decision_cache_env, sizeof(decision_cache_env), "CREW_PRELOAD_DECISION_CACHE=%s/decisions", tmp_dir);
+
+  printf("%i iterations per case, latency in us, child RSS and private copy in kB\n\n", iterations);
+  printf("%-24s %9s %9s %9s %10s %10s %-6s %s\n", "size/mode", "mean", "p50", "p90", "child rss", "copy", "argv0", "/proc/self/exe");
+
+  for (int s = 0; s < (int) (sizeof(sizes) / sizeof(sizes[0])); s++) {
+    snprintf(exec_path, sizeof(exec_path), "%s/exec-mode-%s", tmp_dir, sizes[s].name);
+    copy_executable(self_path, exec_path, sizes[s].pad_to);
+
+    for (int m = 0; m < (int) (sizeof(modes) / sizeof(modes[0])); m++) {
+      char  iterations_str[16], label[64];
+      char  *worker_argv[] = { self_path, "--worker", exec_path, iterations_str, label, NULL };
+      char  *worker_envp[] = { preload_env, exec_cache_env, decision_cache_env, "CREW_PRELOAD_MANIFEST=",
+                               (char *) modes[m].env, NULL };
+      pid_t worker;
+
+      snprintf(iterations_str, sizeof(iterations_str), "%i", iterations);
+      snprintf(label, sizeof(label), "%s/%s", sizes[s].name, modes[m].name);
+      fflush(stdout);
+
+      if (posix_spawn(&worker, self_path, NULL, NULL, worker_argv, worker_envp) != 0) {
+        perror("posix_spawn");
+        return 1;
+      }
+
+      waitpid(worker, NULL, 0);
+    }
+  }
+
+  fflush(stdout);
+  execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  return 0;
+}
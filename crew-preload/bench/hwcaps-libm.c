@@ -0,0 +1,260 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  hwcaps-libm: Compare libm and string functions of the baseline glibc with its glibc-hwcaps variants
+
+  The benchmark runs itself once per level through the dynamic linker, with --glibc-hwcaps-mask limiting the
+  subdirectories the dynamic linker may use to that level ("baseline" matches none of them), and reports the time per
+  call of each function and which libc.so.6/libm.so.6 the run got. Chromebrew's dynamic linker finds the variants
+  under CREW_GLIBC_PREFIX/glibc-hwcaps (../patches/0007-*.patch, built with ../hwcaps/build-glibc-hwcaps), other
+  dynamic linkers need the directory that has the glibc-hwcaps subdirectory as [library dir]. Levels the CPU does not
+  support fall back to the baseline libraries.
+
+  The string functions already pick an implementation for the CPU at runtime (IFUNC), so they should not change;
+  they are here to show that. Without any variant installed, all rows show the same numbers.
+
+  Usage:
+
+    make bench
+    ./hwcaps-libm [dynamic linker (default: the one of this program)] [library dir]
+*/
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <limits.h>
+#include <link.h>
+#include <math.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define INPUTS     1024
+#define CALLS      (4 * 1024 * 1024) // calls per measurement
+#define STRING_LEN 256
+
+typedef double (*MathFunction)(double);
+
+static const char *levels[] = { "baseline", "x86-64-v2", "x86-64-v3", "x86-64-v4" };
+
+// called through volatile pointers, so that the compiler cannot inline or drop the calls
+static struct {
+  const char            *name;
+  MathFunction volatile function;
+  double                min, max;
+} math_functions[] = {
+  { "exp",    exp,    -20, 20 },
+  { "log",    log,    1e-3, 1e6 },
+  { "sin",    sin,    -100, 100 },
+  { "cbrt",   cbrt,   -1e6, 1e6 },
+  { "erf",    erf,    -4, 4 },
+  { "tgamma", tgamma, 0.5, 20 },
+};
+
+static size_t (*volatile call_strlen)(const char *)              = strlen;
+static void  *(*volatile call_memchr)(const void *, int, size_t) = memchr;
+static char  *(*volatile call_strchr)(const char *, int)         = strchr;
+
+#define NUM_LEVELS         (sizeof(levels) / sizeof(levels[0]))
+#define NUM_MATH_FUNCTIONS (sizeof(math_functions) / sizeof(math_functions[0]))
+#define NUM_FUNCTIONS      (NUM_MATH_FUNCTIONS + 3)
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int print_library(struct dl_phdr_info *info, size_t size, void *data) {
+  // print_library(): prints the path of libc.so.6 and libm.so.6 as loaded
+  const char *base = strrchr(info->dlpi_name, '/');
+
+  (void) size;
+  (void) data;
+
+  if (base && (strcmp(base, "/libc.so.6") == 0 || strcmp(base, "/libm.so.6") == 0)) printf("lib %s\n", info->dlpi_name);
+  return 0;
+}
+
+static int find_interpreter(struct dl_phdr_info *info, size_t size, void *data) {
+  // find_interpreter(): the PT_INTERP of the main program (the first object)
+  (void) size;
+
+  for (int i = 0; i < info->dlpi_phnum; i++) {
+    if (info->dlpi_phdr[i].p_type == PT_INTERP) {
+      snprintf(data, PATH_MAX, "%s", (const char *) (info->dlpi_addr + info->dlpi_phdr[i].p_vaddr));
+      break;
+    }
+  }
+
+  return 1;
+}
+
+static int worker(void) {
+  // worker(): prints the libraries in use and "<function index> <ns per call>" for every function
+  static double inputs[INPUTS];
+  static char   string[STRING_LEN + 1];
+  volatile double sink_d = 0;
+  volatile size_t sink_s = 0;
+  double          start, elapsed;
+
+  dl_iterate_phdr(print_library, NULL);
+
+  for (size_t f = 0; f < NUM_MATH_FUNCTIONS; f++) {
+    double best = 1e9;
+
+    for (int i = 0; i < INPUTS; i++) {
+      inputs[i] = math_functions[f].min + (math_functions[f].max - math_functions[f].min) * i / INPUTS;
+    }
+
+    // best of 3
+    for (int run = 0; run < 3; run++) {
+      start = now();
+      for (int i = 0; i < CALLS; i++) sink_d += math_functions[f].function(inputs[i % INPUTS]);
+
+      elapsed = now() - start;
+      if (elapsed * 1e9 / CALLS < best) best = elapsed * 1e9 / CALLS;
+    }
+
+    printf("%zu %.2f\n", f, best);
+  }
+
+  memset(string, 'x', STRING_LEN);
+
+  for (int f = 0; f < 3; f++) {
+    double best = 1e9;
+
+    for (int run = 0; run < 3; run++) {
+      start = now();
+
+      for (int i = 0; i < CALLS / 16; i++) {
+        switch (f) {
+          case 0: sink_s += call_strlen(string + (i & 15)); break;
+          case 1: sink_s += (size_t) call_memchr(string + (i & 15), 'y', STRING_LEN - 16); break;
+          case 2: sink_s += (size_t) call_strchr(string + (i & 15), 'y'); break;
+        }
+      }
+
+      elapsed = now() - start;
+      if (elapsed * 1e9 / (CALLS / 16) < best) best = elapsed * 1e9 / (CALLS / 16);
+    }
+
+    printf("%zu %.2f\n", NUM_MATH_FUNCTIONS + f, best);
+  }
+
+  (void) sink_d;
+  (void) sink_s;
+  return 0;
+}
+
+static int run_level(char *self, char *interpreter, char *library_dir, const char *level,
+                     double *results, char *libraries, size_t libraries_size) {
+  // run_level(): runs the worker under the given level and collects its output
+  posix_spawn_file_actions_t actions;
+  char   *argv[16], line[PATH_MAX + 16];
+  int    argc = 0, pipe_fds[2], status;
+  pid_t  child;
+  FILE   *output;
+
+  argv[argc++] = interpreter;
+  argv[argc++] = "--glibc-hwcaps-mask";
+  argv[argc++] = (char *) level; // no subdirectory matches "baseline"
+  if (library_dir) {
+    argv[argc++] = "--library-path";
+    argv[argc++] = library_dir;
+  }
+  argv[argc++] = self;
+  argv[argc++] = "--worker";
+  argv[argc]   = NULL;
+
+  if (pipe(pipe_fds) == -1) return -1;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, pipe_fds[0]);
+
+  if (posix_spawn(&child, interpreter, &actions, NULL, argv, environ) != 0) {
+    posix_spawn_file_actions_destroy(&actions);
+    return -1;
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  close(pipe_fds[1]);
+
+  libraries[0] = '\0';
+  output       = fdopen(pipe_fds[0], "r");
+
+  while (fgets(line, sizeof(line), output)) {
+    size_t f;
+    double ns;
+
+    if (strncmp(line, "lib ", 4) == 0) {
+      line[strcspn(line, "\n")] = '\0';
+      snprintf(libraries + strlen(libraries), libraries_size - strlen(libraries), "  %s", line + 4);
+    } else if (sscanf(line, "%zu %lf", &f, &ns) == 2 && f < NUM_FUNCTIONS) {
+      results[f] = ns;
+    }
+  }
+
+  fclose(output);
+  if (waitpid(child, &status, 0) == -1) return -1;
+
+  return status;
+}
+
+int main(int argc, char **argv) {
+  static double results[NUM_LEVELS][NUM_FUNCTIONS];
+  char          self[PATH_MAX], interpreter[PATH_MAX] = "", libraries[NUM_LEVELS][PATH_MAX * 2 + 8];
+
+  if (argc == 2 && strcmp(argv[1], "--worker") == 0) return worker();
+
+  if (argc > 3 || realpath("/proc/self/exe", self) == NULL) {
+    fprintf(stderr, "Usage: %s [dynamic linker] [library dir]\n", argv[0]);
+    return 1;
+  }
+
+  if (argc > 1) {
+    snprintf(interpreter, sizeof(interpreter), "%s", argv[1]);
+  } else {
+    dl_iterate_phdr(find_interpreter, interpreter);
+  }
+
+  printf("dynamic linker: %s\n\n", interpreter);
+
+  for (size_t l = 0; l < NUM_LEVELS; l++) {
+    fflush(stdout);
+
+    if (run_level(self, interpreter, (argc > 2) ? argv[2] : NULL, levels[l], results[l],
+                  libraries[l], sizeof(libraries[l])) != 0) {
+      fprintf(stderr, "Worker failed at level %s\n", levels[l]);
+      return 1;
+    }
+
+    printf("%-10s%s\n", levels[l], libraries[l]);
+  }
+
+  printf("\n%-10s", "ns/call");
+  for (size_t l = 0; l < NUM_LEVELS; l++) printf(" %10s", levels[l]);
+  printf("\n");
+
+  for (size_t f = 0; f < NUM_FUNCTIONS; f++) {
+    const char *string_names[] = { "strlen", "memchr", "strchr" };
+
+    printf("%-10s", (f < NUM_MATH_FUNCTIONS) ? math_functions[f].name : string_names[f - NUM_MATH_FUNCTIONS]);
+    for (size_t l = 0; l < NUM_LEVELS; l++) printf(" %10.2f", results[l][f]);
+    printf("\n");
+  }
+
+  return 0;
+}
@@ -0,0 +1,291 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  lib-startup: Measure how long the dynamic linker takes to reach main() of a program with many libraries spread
+               over a long RUNPATH, and how many files it tries to open on the way
+
+  Builds a synthetic application (with cc) linked against <libraries> empty libraries, library n being placed in
+  directory n % <dirs>. The RUNPATH lists all directories, so most libraries (and libc) are only found after failed
+  openat() calls in the directories before theirs, which is what the crew library cache
+  (tools/crew-preload-ldconfig.c, ../patches/0005-*.patch) avoids. main() of the application reports its
+  CLOCK_MONOTONIC time, so the time to main() excludes exit().
+
+  The application is run directly (with the host dynamic linker) or as "<interpreter> <application>". The number of
+  files tried and directories skipped are counted from one extra run with LD_DEBUG=libs.
+
+  To compare with and without the cache, keep the application in a fixed directory (--dir, reused if it exists,
+  so that the directories are not modified between runs), then write a cache for these directories and run again:
+
+    make bench
+    ./lib-startup --dir /tmp/lib-startup --interpreter <patched ld.so>
+    crew-preload-ldconfig /usr/local/lib64 /tmp/lib-startup/lib[0-9]*
+    ./lib-startup --dir /tmp/lib-startup --interpreter <patched ld.so>
+
+  Usage:
+
+    ./lib-startup [--interpreter <ld.so>] [--dir <directory>] [--libraries <n> (default: 200)]
+                  [--dirs <n> (default: 20)] [iterations (default: 100)]
+*/
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+static const char *app_source = "#include <stdio.h>\n"
+                                "#include <time.h>\n"
+                                "int main(void) {\n"
+                                "  struct timespec now;\n"
+                                "  clock_gettime(CLOCK_MONOTONIC, &now);\n"
+                                "  printf(\"%lli %li\\n\", (long long) now.tv_sec, now.tv_nsec);\n"
+                                "  return 0;\n"
+                                "}\n";
+
+static int compare_double(const void *a, const void *b) {
+  return (*(double *) a > *(double *) b) - (*(double *) a < *(double *) b);
+}
+
+static int run_command(const char *command) {
+  int status = system(command);
+
+  if (status != 0) fprintf(stderr, "command failed (status %i): %.200s...\n", status, command);
+  return status;
+}
+
+static int build_app(const char *dir, int num_libraries, int num_dirs) {
+  // build_app(): write dir/app.c, one empty library copied into dir/lib<n>/libbench<n>.so, then link dir/app
+  size_t cmd_size = 256 + strlen(dir) * 3 * (num_libraries + num_dirs) + 64 * (num_libraries + num_dirs);
+  char   path[PATH_MAX + 16], *cmd = malloc(cmd_size);
+  size_t len;
+  FILE   *fp;
+
+  snprintf(path, sizeof(path), "%s/app.c", dir);
+
+  if (mkdir(dir, 0755) == -1 || (fp = fopen(path, "w")) == NULL) {
+    perror(dir);
+    return -1;
+  }
+
+  fputs(app_source, fp);
+  fclose(fp);
+
+  // no DT_SONAME: DT_NEEDED entries are the file names given to the linker below
+  snprintf(cmd, cmd_size, "echo 'int bench_function(void) { return 0; }' | cc -x c -shared -fPIC - -o %s/libbench.so", dir);
+  if (run_command(cmd) != 0) return -1;
+
+  for (int d = 0; d < num_dirs; d++) {
+    snprintf(path, sizeof(path), "%s/lib%i", dir, d);
+    mkdir(path, 0755);
+  }
+
+  len = snprintf(cmd, cmd_size, "set -e; cd %s", dir);
+  for (int n = 0; n < num_libraries; n++) len += snprintf(cmd + len, cmd_size - len, "; cp libbench.so lib%i/libbench%i.so", n % num_dirs, n);
+  if (run_command(cmd) != 0) return -1;
+
+  len = snprintf(cmd, cmd_size, "cd %s && cc app.c -o app -Wl,--no-as-needed -Wl,--enable-new-dtags -Wl,-rpath,", dir);
+
+  for (int d = 0; d < num_dirs; d++) len += snprintf(cmd + len, cmd_size - len, "%s%s/lib%i", d ? ":" : "", dir, d);
+  for (int d = 0; d < num_dirs; d++) len += snprintf(cmd + len, cmd_size - len, " -Llib%i", d);
+  for (int n = 0; n < num_libraries; n++) len += snprintf(cmd + len, cmd_size - len, " -l:libbench%i.so", n);
+
+  if (run_command(cmd) != 0) return -1;
+
+  free(cmd);
+  return 0;
+}
+
+static pid_t spawn_app(char **argv, char **envp, int *out_fd, int *err_fd) {
+  // spawn_app(): posix_spawn() argv with stdout (and stderr if err_fd is set) redirected into pipes
+  posix_spawn_file_actions_t file_actions;
+  int                        out_pipe[2], err_pipe[2];
+  pid_t                      child;
+
+  if (pipe(out_pipe) == -1 || (err_fd && pipe(err_pipe) == -1)) return -1;
+
+  posix_spawn_file_actions_init(&file_actions);
+  posix_spawn_file_actions_adddup2(&file_actions, out_pipe[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&file_actions, out_pipe[0]);
+
+  if (err_fd) {
+    posix_spawn_file_actions_adddup2(&file_actions, err_pipe[1], STDERR_FILENO);
+    posix_spawn_file_actions_addclose(&file_actions, err_pipe[0]);
+  }
+
+  if (posix_spawn(&child, argv[0], &file_actions, NULL, argv, envp) != 0) child = -1;
+
+  posix_spawn_file_actions_destroy(&file_actions);
+  close(out_pipe[1]);
+  *out_fd = out_pipe[0];
+
+  if (err_fd) {
+    close(err_pipe[1]);
+    *err_fd = err_pipe[0];
+  }
+
+  return child;
+}
+
+static int count_lookups(char **argv, long *tried, long *skipped) {
+  // count_lookups(): run argv once with LD_DEBUG=libs, count "trying file=" and "skipping dir=" lines
+  char  *envp[] = { "LD_DEBUG=libs", NULL }, buf[4096], line[PATH_MAX + 64];
+  int   out_fd, err_fd, status;
+  pid_t child    = spawn_app(argv, envp, &out_fd, &err_fd);
+  FILE  *fp      = (child == -1) ? NULL : fdopen(err_fd, "r");
+
+  if (fp == NULL) return -1;
+
+  *tried = *skipped = 0;
+
+  while (fgets(line, sizeof(line), fp)) {
+    if (strstr(line, "trying file=")) (*tried)++;
+    if (strstr(line, "skipping dir=")) (*skipped)++;
+  }
+
+  while (read(out_fd, buf, sizeof(buf)) > 0);
+
+  fclose(fp);
+  close(out_fd);
+  waitpid(child, &status, 0);
+
+  return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
+
+int main(int argc, char **argv) {
+  char       dir[PATH_MAX] = "", app_path[PATH_MAX], tmp_dir[] = "/tmp/lib-startup.XXXXXX";
+  const char *interpreter  = NULL;
+  char       *app_argv[3];
+  int        num_libraries = 200, num_dirs = 20, iterations = 100, argi;
+  bool       keep_dir      = false;
+  long       tried = 0, skipped = 0;
+  double     *to_main, *to_exit, total_main = 0, total_exit = 0;
+
+  for (argi = 1; argi + 1 < argc && strncmp(argv[argi], "--", 2) == 0; argi += 2) {
+    if (strcmp(argv[argi], "--interpreter") == 0) {
+      interpreter = argv[argi + 1];
+    } else if (strcmp(argv[argi], "--dir") == 0) {
+      snprintf(dir, sizeof(dir), "%s", argv[argi + 1]);
+      keep_dir = true;
+    } else if (strcmp(argv[argi], "--libraries") == 0) {
+      num_libraries = atoi(argv[argi + 1]);
+    } else if (strcmp(argv[argi], "--dirs") == 0) {
+      num_dirs = atoi(argv[argi + 1]);
+    } else {
+      break;
+    }
+  }
+
+  if (argi < argc) iterations = atoi(argv[argi++]);
+
+  if (argi < argc || iterations < 1 || num_libraries < 1 || num_dirs < 1) {
+    fprintf(stderr, "Usage: %s [--interpreter <ld.so>] [--dir <directory>] [--libraries <n>] [--dirs <n>] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  if (!keep_dir) {
+    if (mkdtemp(tmp_dir) == NULL) {
+      perror(tmp_dir);
+      return 1;
+    }
+
+    snprintf(dir, sizeof(dir), "%s/app", tmp_dir);
+  }
+
+  snprintf(app_path, sizeof(app_path), "%s/app", dir);
+
+  // rebuilding would change the modification time of the directories and invalidate a cache written for them
+  if (access(app_path, X_OK) == 0) {
+    char path[PATH_MAX + 48];
+
+    for (num_dirs = 0; snprintf(path, sizeof(path), "%s/lib%i", dir, num_dirs), access(path, F_OK) == 0; num_dirs++);
+    for (num_libraries = 0; num_dirs > 0 && (snprintf(path, sizeof(path), "%s/lib%i/libbench%i.so", dir, num_libraries % num_dirs,
+                                                      num_libraries), access(path, F_OK) == 0); num_libraries++);
+
+    printf("using the existing application in %s\n", dir);
+  } else if (build_app(dir, num_libraries, num_dirs) != 0) {
+    return 1;
+  }
+
+  app_argv[0] = (char *) (interpreter ? interpreter : app_path);
+  app_argv[1] = interpreter ? app_path : NULL;
+  app_argv[2] = NULL;
+
+  if (count_lookups(app_argv, &tried, &skipped) != 0) {
+    fprintf(stderr, "%s: failed to run\n", app_argv[0]);
+    return 1;
+  }
+
+  to_main = calloc(iterations, sizeof(double));
+  to_exit = calloc(iterations, sizeof(double));
+
+  for (int i = -1; i < iterations; i++) {
+    struct timespec start, end;
+    char            report[64] = "";
+    long long       main_sec   = 0;
+    long            main_nsec  = 0;
+    int             out_fd, status;
+    ssize_t         len;
+    pid_t           child;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    if ((child = spawn_app(app_argv, environ, &out_fd, NULL)) == -1) {
+      perror(app_argv[0]);
+      return 1;
+    }
+
+    if ((len = read(out_fd, report, sizeof(report) - 1)) > 0) report[len] = '\0';
+    waitpid(child, &status, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(out_fd);
+
+    if (sscanf(report, "%lli %li", &main_sec, &main_nsec) != 2 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "%s: failed (status %i)\n", app_argv[0], status);
+      return 1;
+    }
+
+    // the first run (page cache, dentries) is not measured
+    if (i >= 0) {
+      to_main[i]  = (main_sec - start.tv_sec) * 1e6 + (main_nsec - start.tv_nsec) / 1e3;
+      to_exit[i]  = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+      total_main += to_main[i];
+      total_exit += to_exit[i];
+    }
+  }
+
+  qsort(to_main, iterations, sizeof(double), compare_double);
+  qsort(to_exit, iterations, sizeof(double), compare_double);
+
+  printf("%i libraries in %i directories (%s/lib0 ... %s/lib%i), %s, %i iterations\n", num_libraries, num_dirs, dir, dir,
+         num_dirs - 1, interpreter ? interpreter : "host dynamic linker", iterations);
+  printf("files tried: %li, directories skipped (crew library cache): %li\n\n", tried, skipped);
+  printf("%-12s %9s %9s %9s\n", "latency (us)", "mean", "p50", "p90");
+  printf("%-12s %9.1f %9.1f %9.1f\n", "to main()", total_main / iterations, to_main[iterations / 2], to_main[iterations * 9 / 10]);
+  printf("%-12s %9.1f %9.1f %9.1f\n", "to exit", total_exit / iterations, to_exit[iterations / 2], to_exit[iterations * 9 / 10]);
+
+  free(to_main);
+  free(to_exit);
+
+  if (!keep_dir) {
+    fflush(stdout);
+    execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  }
+
+  return 0;
+}
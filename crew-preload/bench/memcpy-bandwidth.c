@@ -0,0 +1,252 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  memcpy-bandwidth: Check and measure memcpy()/memmove() of the glibc this program runs with, over copy sizes and
+                    alignments, and find the crossover of the armv7 memcpy to its unaligned loop
+
+  Modes:
+    (default)    bandwidth in MiB/s of memcpy() with the same and different alignment of source and destination,
+                 and of memmove() with and without overlap, for copies of 1 KiB to 12 MiB
+    --check      compares memcpy()/memmove() with a byte-by-byte copy for all sizes up to <max size> (default: 512)
+                 and all source/destination alignments up to 16, overlaps of up to 32 bytes in both directions and
+                 a few sizes around the crossovers; fast enough for qemu-user (qemu-arm -L <sysroot> ./...)
+    --calibrate  runs the bandwidth of same-alignment copies twice, with the aligned loop forced
+                 (glibc.cpu.memcpy_unaligned_threshold=4294967295) and with the unaligned loop forced (=64), and
+                 prints the smallest size from which the unaligned loop stays faster as a GLIBC_TUNABLES setting
+                 (../patches/0006-*.patch, needs Chromebrew's glibc on an armv7l board)
+
+  Usage:
+
+    make bench
+    ./memcpy-bandwidth [--check [max size] | --calibrate]
+*/
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_SIZE      (12 * 1024 * 1024)
+#define TARGET_BYTES  (64L * 1024 * 1024) // bytes copied per measurement
+#define TUNABLE       "glibc.cpu.memcpy_unaligned_threshold"
+
+typedef void *(*CopyFunction)(void *, const void *, size_t);
+
+// called through volatile pointers, so that the compiler cannot inline or drop the copies
+static CopyFunction volatile copy_memcpy  = memcpy,
+                             copy_memmove = memmove;
+
+static const size_t sizes[] = {
+  1024, 2048, 4096, 8192, 12288, 16384, 24576, 32768, 49152, 65536, 98304, 131072, 196608, 262144, 524288,
+  1048576, 4194304, MAX_SIZE
+};
+
+#define NUM_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+static char *src_buf, *dst_buf;
+
+static double now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double bandwidth(CopyFunction copy, char *dst, const char *src, size_t size) {
+  // bandwidth(): best of 3 runs of TARGET_BYTES copied, in MiB/s
+  long   reps = TARGET_BYTES / size;
+  double best = 0;
+
+  if (reps < 4) reps = 4;
+
+  for (int run = 0; run < 3; run++) {
+    double start = now(), elapsed;
+
+    for (long i = 0; i < reps; i++) copy(dst, src, size);
+
+    elapsed = now() - start;
+    if (elapsed > 0 && reps * size / elapsed / 1048576 > best) best = reps * size / elapsed / 1048576;
+  }
+
+  return best;
+}
+
+static int check_copy(CopyFunction copy, const char *name, char *buf, size_t src_off, size_t dst_off, size_t size) {
+  // check_copy(): copy size bytes within buf (ranges may overlap) and compare with a byte-by-byte reference
+  static char   *expected     = NULL;
+  static size_t expected_size = 0;
+  size_t        buf_size      = (src_off > dst_off ? src_off : dst_off) + size + 64;
+
+  if (buf_size > expected_size) {
+    expected      = realloc(expected, buf_size);
+    expected_size = buf_size;
+  }
+
+  for (size_t i = 0; i < buf_size; i++) buf[i] = (char) (i * 7 + i / 251);
+
+  memcpy(expected, buf, buf_size);
+
+  if (src_off < dst_off) {
+    for (size_t i = size; i > 0; i--) expected[dst_off + i - 1] = expected[src_off + i - 1];
+  } else {
+    for (size_t i = 0; i < size; i++) expected[dst_off + i] = expected[src_off + i];
+  }
+
+  if (copy(buf + dst_off, buf + src_off, size) != buf + dst_off || memcmp(buf, expected, buf_size) != 0) {
+    fprintf(stderr, "%s: wrong result for size %zu, source offset %zu, destination offset %zu\n", name, size, src_off, dst_off);
+    return 1;
+  }
+
+  return 0;
+}
+
+static int run_check(size_t max_size) {
+  // run_check(): exhaustive small sizes and alignments, then a few large sizes around the crossovers
+  static const size_t large_sizes[] = { 16383, 16384, 16385, 98304, 131071, 131072, 131073, 1048576 + 3 };
+  size_t              largest = (max_size > large_sizes[7]) ? max_size : large_sizes[7];
+  char                *buf    = malloc(2 * largest + 256);
+  long                cases   = 0;
+  int                 errors  = 0;
+
+  for (size_t size = 0; size <= max_size; size++) {
+    for (size_t src_align = 0; src_align < 16; src_align++) {
+      for (size_t dst_align = 0; dst_align < 16; dst_align++) {
+        // distinct ranges for memcpy(), then memmove() with overlap in both directions
+        errors += check_copy(copy_memcpy, "memcpy", buf, src_align, max_size + 64 + dst_align, size);
+        errors += check_copy(copy_memmove, "memmove", buf, src_align + 32, src_align + 32 + dst_align, size);
+        errors += check_copy(copy_memmove, "memmove", buf, src_align + 32, src_align + 32 - dst_align - 16, size);
+        cases  += 3;
+
+        if (errors) return 1;
+      }
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(large_sizes) / sizeof(large_sizes[0]); i++) {
+    for (size_t src_align = 0; src_align < 8; src_align += 4) {
+      for (size_t dst_align = 0; dst_align < 8; dst_align++) {
+        errors += check_copy(copy_memcpy, "memcpy", buf, src_align, large_sizes[i] + 64 + dst_align, large_sizes[i]);
+        errors += check_copy(copy_memmove, "memmove", buf, src_align + 32, src_align + 32 + dst_align + 64, large_sizes[i]);
+        cases  += 2;
+
+        if (errors) return 1;
+      }
+    }
+  }
+
+  printf("%li cases checked, no errors\n", cases);
+  return 0;
+}
+
+static int run_table(void) {
+  printf("%10s %12s %12s %12s %12s   (MiB/s)\n", "size", "memcpy", "memcpy src+1", "memmove", "memmove ovl");
+
+  for (size_t i = 0; i < NUM_SIZES; i++) {
+    printf("%10zu %12.0f %12.0f %12.0f %12.0f\n", sizes[i],
+           bandwidth(copy_memcpy, dst_buf, src_buf, sizes[i]),
+           bandwidth(copy_memcpy, dst_buf, src_buf + 1, sizes[i]),
+           bandwidth(copy_memmove, dst_buf, src_buf, sizes[i]),
+           bandwidth(copy_memmove, src_buf + 64, src_buf, sizes[i]));
+    fflush(stdout);
+  }
+
+  return 0;
+}
+
+static int run_worker(void) {
+  // run_worker(): same-alignment memcpy() bandwidth per size, one "<size> <MiB/s>" line each
+  for (size_t i = 0; i < NUM_SIZES; i++) printf("%zu %f\n", sizes[i], bandwidth(copy_memcpy, dst_buf, src_buf, sizes[i]));
+
+  return 0;
+}
+
+static int measure_with_tunable(const char *value, double *results) {
+  // measure_with_tunable(): re-execute this program as a worker with the tunable set, read its results
+  char command[256];
+  FILE *fp;
+
+  snprintf(command, sizeof(command), "GLIBC_TUNABLES=%s=%s /proc/%i/exe --worker", TUNABLE, value, getpid());
+
+  if ((fp = popen(command, "r")) == NULL) return -1;
+
+  for (size_t i = 0; i < NUM_SIZES; i++) {
+    size_t size;
+
+    if (fscanf(fp, "%zu %lf", &size, &results[i]) != 2 || size != sizes[i]) {
+      pclose(fp);
+      return -1;
+    }
+  }
+
+  return pclose(fp) == 0 ? 0 : -1;
+}
+
+static int run_calibrate(void) {
+  // run_calibrate(): the crossover is the smallest size from which the unaligned loop is faster for all larger sizes
+  double aligned[NUM_SIZES], unaligned[NUM_SIZES];
+  size_t crossover = 0;
+  bool   differs   = false;
+
+#ifndef __arm__
+  fprintf(stderr, "warning: the tunable only exists for the armv7 memcpy, both runs use the same code here\n\n");
+#endif
+
+  if (measure_with_tunable("4294967295", aligned) != 0 || measure_with_tunable("64", unaligned) != 0) {
+    fprintf(stderr, "worker failed\n");
+    return 1;
+  }
+
+  printf("%10s %12s %12s   (MiB/s, same alignment)\n", "size", "aligned", "unaligned");
+
+  for (size_t i = 0; i < NUM_SIZES; i++) {
+    printf("%10zu %12.0f %12.0f%s\n", sizes[i], aligned[i], unaligned[i], unaligned[i] > aligned[i] ? "  *" : "");
+
+    // run-to-run noise of medium sizes easily reaches a few percent, the two loops differ by much more
+    if (unaligned[i] > aligned[i] * 1.1 || aligned[i] > unaligned[i] * 1.1) differs = true;
+  }
+
+  // not slower by more than 2% counts as faster, so that noise at one size does not move the crossover up
+  for (size_t i = NUM_SIZES; i > 0 && unaligned[i - 1] > aligned[i - 1] * 0.98; i--) crossover = sizes[i - 1];
+
+  if (!differs) {
+    printf("\nno difference between both loops: this glibc does not have the %s tunable (or not the armv7 memcpy)\n", TUNABLE);
+  } else if (crossover == 0) {
+    printf("\nthe aligned loop is faster for all sizes: GLIBC_TUNABLES=%s=4294967295\n", TUNABLE);
+  } else {
+    printf("\ncrossover: GLIBC_TUNABLES=%s=%zu\n", TUNABLE, crossover);
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  if (argc >= 2 && strcmp(argv[1], "--check") == 0) return run_check(argc > 2 ? strtoul(argv[2], NULL, 0) : 512);
+  if (argc == 2 && strcmp(argv[1], "--calibrate") == 0) return run_calibrate();
+
+  if (argc > 2 || (argc == 2 && strcmp(argv[1], "--worker") != 0)) {
+    fprintf(stderr, "Usage: %s [--check [max size] | --calibrate]\n", argv[0]);
+    return 1;
+  }
+
+  // page-aligned buffers, so that "aligned" means the same alignment on every system
+  if (posix_memalign((void **) &src_buf, 4096, MAX_SIZE + 4096) != 0 || posix_memalign((void **) &dst_buf, 4096, MAX_SIZE + 4096) != 0) {
+    perror("posix_memalign");
+    return 1;
+  }
+
+  memset(src_buf, 1, MAX_SIZE + 4096);
+  memset(dst_buf, 2, MAX_SIZE + 4096);
+
+  return (argc == 2) ? run_worker() : run_table();
+}
@@ -0,0 +1,267 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  parallel-link: Measure wall time and peak memory of a link-heavy `make -j` with and without the linker limits of
+                 crew-preload.so (see link-jobs.c)
+
+  The project is generated once: a few large objects (thousands of functions and relocations each, compiled
+  without crew-preload.so) and a Makefile that links all of them into one shared library per target with `ld`.
+  Every run is `make -B -j<jobs>`, so the whole build is the link phase.
+
+  Modes:
+    none        without LD_PRELOAD
+    unlimited   LD_PRELOAD, CREW_PRELOAD_ENABLE_COMPILE_HACKS=1, CREW_PRELOAD_LINK_JOBS=0
+    limited     LD_PRELOAD, CREW_PRELOAD_ENABLE_COMPILE_HACKS=1, CREW_PRELOAD_LINK_JOBS=<slots>
+
+  Peak RSS is the largest sum of the RSS of all processes below make, sampled every 2 ms. If mold is found in
+  PATH, crew-preload.so runs it instead of ld (and passes --threads), ld is used otherwise (CREW_PRELOAD_NO_MOLD=1).
+  Use crew-preload-standin.so (see Makefile) to run this on any Linux box.
+
+  Usage:
+
+    make bench
+    ./parallel-link <path to crew-preload.so> [jobs (default: 8)] [link slots (default: 1)] [runs (default: 3)]
+*/
+
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <dirent.h>
+#include <limits.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define OBJECTS   8    // objects linked into every library
+#define FUNCTIONS 4000 // functions per object
+#define TARGETS   16   // libraries linked per run
+#define MAX_PROCS 4096
+
+static const char *modes[] = { "none", "unlimited", "limited" };
+
+static void write_object_source(const char *path, int object) {
+  // write_object_source(): functions calling each other through the GOT and a table of pointers to all of them,
+  //                        so that the linker has symbols and relocations to process
+  FILE *fp = fopen(path, "w");
+
+  for (int i = 0; i < FUNCTIONS; i++) {
+    fprintf(fp, "int f%i_%i(int x) { return x * %i; }\n", object, i, i);
+    if (i > 0) fprintf(fp, "int g%i_%i(int x) { return f%i_%i(x) + f%i_%i(x); }\n", object, i, object, i - 1, object, i);
+  }
+
+  fprintf(fp, "void *table%i[] = {\n", object);
+  for (int i = 0; i < FUNCTIONS; i++) fprintf(fp, "  (void *) f%i_%i,\n", object, i);
+  fprintf(fp, "};\n");
+
+  fclose(fp);
+}
+
+static bool in_path(const char *name) {
+  char path_list[PATH_MAX * 4], file[PATH_MAX * 5], *dir, *saveptr;
+
+  snprintf(path_list, sizeof(path_list), "%s", getenv("PATH") ?: "/usr/bin:/bin");
+
+  for (dir = strtok_r(path_list, ":", &saveptr); dir; dir = strtok_r(NULL, ":", &saveptr)) {
+    snprintf(file, sizeof(file), "%s/%s", dir, name);
+    if (access(file, X_OK) == 0) return true;
+  }
+
+  return false;
+}
+
+static int run(char **argv, char **envp) {
+  pid_t child;
+  int   status;
+
+  if (posix_spawnp(&child, argv[0], NULL, NULL, argv, envp) != 0) return -1;
+  if (waitpid(child, &status, 0) == -1) return -1;
+
+  return status;
+}
+
+static long tree_rss_kb(pid_t root) {
+  // tree_rss_kb(): sum of the RSS of root and all of its descendants
+  static pid_t  pids[MAX_PROCS], ppids[MAX_PROCS];
+  static long   rss[MAX_PROCS];
+  static char   in_tree[MAX_PROCS];
+  struct dirent *entry;
+  DIR           *proc = opendir("/proc");
+  long          page_kb = sysconf(_SC_PAGESIZE) / 1024, total = 0;
+  int           count = 0;
+  bool          changed = true;
+
+  while ((entry = readdir(proc)) && count < MAX_PROCS) {
+    char path[NAME_MAX + 16], buf[1024], *fields;
+    FILE *fp;
+
+    if (!isdigit(entry->d_name[0])) continue;
+
+    snprintf(path, sizeof(path), "/proc/%s/stat", entry->d_name);
+    if ((fp = fopen(path, "r")) == NULL) continue;
+
+    // the command name might contain spaces and parentheses, fields start after the last ')'
+    // state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt cmajflt utime stime cutime cstime priority
+    // nice num_threads itrealvalue starttime vsize rss
+    if (fgets(buf, sizeof(buf), fp) && (fields = strrchr(buf, ')')) &&
+        sscanf(fields + 1, " %*c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u %*u %*d %*d %*d %*d %*d %*d %*u %*u %ld",
+               &ppids[count], &rss[count]) == 2) {
+      pids[count]    = atoi(entry->d_name);
+      in_tree[count] = (pids[count] == root);
+      count++;
+    }
+
+    fclose(fp);
+  }
+
+  closedir(proc);
+
+  while (changed) {
+    changed = false;
+
+    for (int i = 0; i < count; i++) {
+      if (in_tree[i]) continue;
+
+      for (int j = 0; j < count; j++) {
+        if (in_tree[j] && pids[j] == ppids[i]) {
+          in_tree[i] = changed = true;
+          break;
+        }
+      }
+    }
+  }
+
+  for (int i = 0; i < count; i++) {
+    if (in_tree[i]) total += rss[i] * page_kb;
+  }
+
+  return total;
+}
+
+static int run_make(char **argv, char **envp, double *wall_s, long *peak_kb) {
+  // run_make(): run make, sampling the memory of its process tree until it exits
+  struct timespec start, end, interval = { 0, 2000000 };
+  pid_t           child;
+  int             status;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (posix_spawnp(&child, argv[0], NULL, NULL, argv, envp) != 0) return -1;
+
+  *peak_kb = 0;
+
+  while (waitpid(child, &status, WNOHANG) == 0) {
+    long rss_kb = tree_rss_kb(child);
+
+    if (rss_kb > *peak_kb) *peak_kb = rss_kb;
+    nanosleep(&interval, NULL);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  *wall_s = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  return status;
+}
+
+int main(int argc, char **argv) {
+  char tmp_dir[] = "/tmp/parallel-link.XXXXXX", preload[PATH_MAX], path[PATH_MAX + 32], jobs_arg[16],
+       preload_env[PATH_MAX + 16], exec_cache_env[PATH_MAX + 32], decision_cache_env[PATH_MAX + 32],
+       slots_env[48], path_env[PATH_MAX + 8];
+  int  jobs  = (argc > 2) ? atoi(argv[2]) : 8,
+       slots = (argc > 3) ? atoi(argv[3]) : 1,
+       runs  = (argc > 4) ? atoi(argv[4]) : 3;
+  bool have_mold = in_path("mold");
+  FILE *makefile;
+
+  if (argc < 2 || argc > 5 || realpath(argv[1], preload) == NULL || jobs < 1 || slots < 1 || runs < 1) {
+    fprintf(stderr, "Usage: %s <path to crew-preload.so> [jobs] [link slots] [runs]\n", argv[0]);
+    return 1;
+  }
+
+  if (mkdtemp(tmp_dir) == NULL) {
+    perror(argv[0]);
+    return 1;
+  }
+
+  // generate and compile the objects (without crew-preload.so)
+  for (int i = 0; i < OBJECTS; i++) {
+    char source[PATH_MAX + 16], object[PATH_MAX + 16];
+    char *cc_argv[] = { "cc", "-O0", "-fPIC", "-c", source, "-o", object, NULL };
+
+    snprintf(source, sizeof(source), "%s/o%i.c", tmp_dir, i);
+    snprintf(object, sizeof(object), "%s/o%i.o", tmp_dir, i);
+    write_object_source(source, i);
+
+    if (run(cc_argv, environ) != 0) {
+      fprintf(stderr, "Failed to compile %s\n", source);
+      return 1;
+    }
+  }
+
+  snprintf(path, sizeof(path), "%s/Makefile", tmp_dir);
+  makefile = fopen(path, "w");
+
+  fprintf(makefile, "all:");
+  for (int i = 0; i < TARGETS; i++) fprintf(makefile, " lib%i.so", i);
+  fprintf(makefile, "\n\nlib%%.so:\n\tld -shared -o $@ $(wildcard o*.o)\n");
+  fclose(makefile);
+
+  snprintf(jobs_arg, sizeof(jobs_arg), "-j%i", jobs);
+  snprintf(path_env, sizeof(path_env), "PATH=%s", getenv("PATH") ?: "/usr/bin:/bin");
+  snprintf(slots_env, sizeof(slots_env), "CREW_PRELOAD_LINK_JOBS=%i", slots);
+  snprintf(preload_env, sizeof(preload_env), "LD_PRELOAD=%s", preload);
+  snprintf(exec_cache_env, sizeof(exec_cache_env), "CREW_PRELOAD_EXEC_CACHE_DIR=%s/exec-cache", tmp_dir);
+  snprintf(decision_cache_env, sizeof(decision_cache_env), "CREW_PRELOAD_DECISION_CACHE=%s/decisions", tmp_dir);
+
+  printf("%i libraries of %i objects, make %s, %i link slots, linker: %s, %i runs per mode\n\n", TARGETS, OBJECTS,
+         jobs_arg, slots, have_mold ? "mold" : "ld", runs);
+  printf("%-12s %12s %12s %16s %16s\n", "mode", "mean wall", "max wall", "mean peak rss", "max peak rss");
+  printf("%-12s %12s %12s %16s %16s\n", "", "(s)", "(s)", "(MiB)", "(MiB)");
+
+  for (int m = 0; m < (int) (sizeof(modes) / sizeof(modes[0])); m++) {
+    char   *make_argv[] = { "make", "-s", "-B", jobs_arg, "-C", tmp_dir, NULL };
+    char   *make_envp[] = { path_env, exec_cache_env, decision_cache_env,
+                            (m == 2) ? slots_env : "CREW_PRELOAD_LINK_JOBS=0",
+                            "CREW_PRELOAD_ENABLE_COMPILE_HACKS=1",
+                            have_mold ? "CREW_PRELOAD_VERBOSE=0" : "CREW_PRELOAD_NO_MOLD=1",
+                            (m > 0) ? preload_env : NULL, NULL };
+    double total_wall = 0, max_wall = 0;
+    long   total_peak = 0, max_peak = 0;
+
+    fflush(stdout);
+
+    // first run warms up page cache and the caches of crew-preload.so
+    for (int r = -1; r < runs; r++) {
+      double wall_s;
+      long   peak_kb;
+
+      if (run_make(make_argv, make_envp, &wall_s, &peak_kb) != 0) {
+        fprintf(stderr, "make failed in mode %s\n", modes[m]);
+        return 1;
+      }
+
+      if (r < 0) continue;
+
+      total_wall += wall_s;
+      total_peak += peak_kb;
+      if (wall_s > max_wall) max_wall = wall_s;
+      if (peak_kb > max_peak) max_peak = peak_kb;
+    }
+
+    printf("%-12s %12.2f %12.2f %16.1f %16.1f\n", modes[m], total_wall / runs, max_wall,
+           total_peak / runs / 1024.0, max_peak / 1024.0);
+  }
+
+  fflush(stdout);
+  execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  return 0;
+}
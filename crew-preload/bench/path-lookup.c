@@ -0,0 +1,126 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  path-lookup: Measure PATH resolution cost of search_in_path() (see path-index.c) against the previous
+               access()-based implementation
+
+  Creates a PATH with 15 directories (200 executables each) and resolves 10000 names against it, about 1/4
+  of them do not exist in any directory (as configure scripts probe for plenty of tools that are not installed).
+
+  Usage:
+
+    cc -O2 -I.. path-lookup.c ../path-index.c ../stats.c ../trace.c ../../prebuilt/<ARCH>/libc-*.so* -o path-lookup
+    ./path-lookup [lookups (default: 10000)]
+*/
+
+#include "./main.h"
+
+#define NUM_DIRS       15
+#define FILES_PER_DIR  200
+#define MISSING_NAMES  100
+
+bool verbose = false;
+
+static int search_in_path_access(const char *file, char *result) {
+  // search_in_path_access(): the previous implementation of search_in_path()
+  char cs_path[PATH_MAX * 32], *search_path, *path_copy, *saveptr;
+  int  return_value = ENOENT;
+
+  confstr(_CS_PATH, cs_path, sizeof(cs_path));
+  path_copy = strdup(getenv("PATH") ?: cs_path);
+
+  for (search_path = strtok_r(path_copy, ":", &saveptr); search_path; search_path = strtok_r(NULL, ":", &saveptr)) {
+    snprintf(result, PATH_MAX, "%s/%s", search_path, file);
+
+    if (access(result, X_OK) == 0) {
+      return_value = 0;
+      break;
+    } else if (access(result, F_OK) == 0) {
+      return_value = EACCES;
+    }
+  }
+
+  free(path_copy);
+  return return_value;
+}
+
+static double run(const char *label, int (*search)(const char *, char *), char **names, int lookups, char (*results)[PATH_MAX]) {
+  struct timespec start, end;
+  char            result[PATH_MAX];
+  double          elapsed;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int i = 0; i < lookups; i++) {
+    if (search(names[i], result) == 0) {
+      if (results) strcpy(results[i], result);
+    } else if (results) {
+      results[i][0] = '\0';
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+
+  printf("%-8s %10.3f %14.1f\n", label, elapsed, elapsed * 1e6 / lookups);
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  char tmp_dir[] = "/tmp/path-lookup.XXXXXX", path_env[PATH_MAX * 2] = "", file_path[PATH_MAX];
+  int  lookups   = (argc > 1) ? atoi(argv[1]) : 10000, mismatches = 0;
+  char **names, (*expected)[PATH_MAX], (*actual)[PATH_MAX];
+
+  if (lookups < 1 || mkdtemp(tmp_dir) == NULL) {
+    fprintf(stderr, "Usage: %s [lookups]\n", argv[0]);
+    return 1;
+  }
+
+  for (int d = 0; d < NUM_DIRS; d++) {
+    snprintf(file_path, sizeof(file_path), "%s/dir%02i", tmp_dir, d);
+    mkdir(file_path, 0755);
+
+    snprintf(path_env + strlen(path_env), sizeof(path_env) - strlen(path_env), "%s%s", d ? ":" : "", file_path);
+
+    for (int f = 0; f < FILES_PER_DIR; f++) {
+      snprintf(file_path, sizeof(file_path), "%s/dir%02i/cmd-%i-%i", tmp_dir, d, d, f);
+      close(open(file_path, O_WRONLY | O_CREAT, 0755));
+    }
+  }
+
+  setenv("PATH", path_env, true);
+
+  names    = calloc(lookups, sizeof(char *));
+  expected = calloc(lookups, PATH_MAX);
+  actual   = calloc(lookups, PATH_MAX);
+  srand(1);
+
+  for (int i = 0; i < lookups; i++) {
+    if (rand() % 4 == 0) {
+      asprintf(&names[i], "missing-%i", rand() % MISSING_NAMES);
+    } else {
+      asprintf(&names[i], "cmd-%i-%i", rand() % NUM_DIRS, rand() % FILES_PER_DIR);
+    }
+  }
+
+  printf("%i lookups, %i PATH entries\n", lookups, NUM_DIRS);
+  printf("%-8s %10s %14s\n", "method", "total (ms)", "per lookup (ns)");
+
+  double before = run("access", search_in_path_access, names, lookups, expected),
+         after  = run("index", search_in_path, names, lookups, actual);
+
+  for (int i = 0; i < lookups; i++) mismatches += (strcmp(expected[i], actual[i]) != 0);
+
+  printf("speedup: %.1fx, mismatches: %i\n", before / after, mismatches);
+
+  fflush(stdout);
+  execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  return 0;
+}
@@ -0,0 +1,240 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  relr-startup: Compare libraries linked with and without packed relative relocations (ld -z pack-relative-relocs,
+                DT_RELR) by the time an application takes to reach main() and the memory the library uses
+
+  Builds (with cc, which needs binutils >= 2.38 or lld) a library of 10000, 100000 and 1000000 relative relocations
+  (a table of pointers in .data.rel.ro, like the vtables and function tables of large C++ libraries), once packed and
+  once unpacked, and an application linked against it. main() of the application reports its CLOCK_MONOTONIC time
+  and the Rss/Private_Dirty of the library mappings (from /proc/self/smaps):
+
+    Rss            includes the relocation table, read from the page cache and mapped by every process
+    Private_Dirty  pages written by the relocations, the same with and without DT_RELR
+
+  The application is run directly (needs a dynamic linker with DT_RELR support, glibc >= 2.36) or as
+  "<interpreter> <application>", the library is selected with LD_LIBRARY_PATH. Use tools/crew-preload-relr.c to
+  see how many relative relocations installed libraries have.
+
+  Usage:
+
+    make bench
+    ./relr-startup [--interpreter <ld.so>] [iterations (default: 100)]
+*/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+extern char **environ;
+
+struct RelocCount {
+  const char *name;
+  long       relocations;
+};
+
+static const struct RelocCount counts[] = {
+  { "10k",  10000 },
+  { "100k", 100000 },
+  { "1m",   1000000 },
+};
+
+static const char *app_source = "#include <stdio.h>\n"
+                                "#include <string.h>\n"
+                                "#include <time.h>\n"
+                                "int main(void) {\n"
+                                "  struct timespec now;\n"
+                                "  char line[256];\n"
+                                "  long rss = 0, dirty = 0, value;\n"
+                                "  int in_library = 0;\n"
+                                "  FILE *fp = fopen(\"/proc/self/smaps\", \"r\");\n"
+                                "  clock_gettime(CLOCK_MONOTONIC, &now);\n"
+                                "  while (fp && fgets(line, sizeof(line), fp)) {\n"
+                                "    if (strchr(line, '-') && strchr(line, '-') < strchr(line, ' ')) in_library = (strstr(line, \"libbench-relr.so\") != NULL);\n"
+                                "    else if (in_library && sscanf(line, \"Rss: %li\", &value) == 1) rss += value;\n"
+                                "    else if (in_library && sscanf(line, \"Private_Dirty: %li\", &value) == 1) dirty += value;\n"
+                                "  }\n"
+                                "  printf(\"%lli %li %li %li\\n\", (long long) now.tv_sec, now.tv_nsec, rss, dirty);\n"
+                                "  return 0;\n"
+                                "}\n";
+
+static int compare_double(const void *a, const void *b) {
+  return (*(double *) a > *(double *) b) - (*(double *) a < *(double *) b);
+}
+
+static int run_command(const char *command) {
+  int status = system(command);
+
+  if (status != 0) fprintf(stderr, "command failed (status %i): %s\n", status, command);
+  return status;
+}
+
+static int build_library(const char *dir, long relocations) {
+  // build_library(): write dir/libbench-relr.s with a table of pointers, link it packed and unpacked, then write the
+  //                  libraries back (page cache pages that were never written back count as dirty in smaps)
+  char cmd[PATH_MAX * 2 + 256], path[PATH_MAX + 32];
+  FILE *fp;
+
+  snprintf(path, sizeof(path), "%s/libbench-relr.s", dir);
+
+  if ((fp = fopen(path, "w")) == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  // assembled instead of compiled, a C initializer with 1000000 pointers takes cc several seconds
+  fprintf(fp, "\t.section .data.rel.ro,\"aw\"\n\t.p2align 3\n\t.globl bench_table\nbench_table:\n"
+              "\t.rept %li\n\t.dc.a bench_data\n\t.endr\n"
+              "\t.local bench_data\n\t.comm bench_data,64,8\n\t.section .note.GNU-stack,\"\",%%progbits\n", relocations);
+  fclose(fp);
+
+  snprintf(cmd, sizeof(cmd), "set -e; cd %s; mkdir -p packed unpacked; "
+                             "cc -shared libbench-relr.s -o packed/libbench-relr.so -Wl,-z,pack-relative-relocs; "
+                             "cc -shared libbench-relr.s -o unpacked/libbench-relr.so -Wl,-z,nopack-relative-relocs; "
+                             "sync packed/libbench-relr.so unpacked/libbench-relr.so", dir);
+
+  return run_command(cmd);
+}
+
+static int run_app(char **argv, char **envp, double *to_main, long *rss, long *dirty) {
+  // run_app(): spawn the application, returns the time to main() and the library's memory from its report
+  posix_spawn_file_actions_t file_actions;
+  struct timespec            start;
+  char                       report[128] = "";
+  long long                  main_sec    = 0;
+  long                       main_nsec   = 0;
+  int                        pipe_fds[2], status;
+  ssize_t                    len;
+  pid_t                      child;
+
+  if (pipe(pipe_fds) == -1) return -1;
+
+  posix_spawn_file_actions_init(&file_actions);
+  posix_spawn_file_actions_adddup2(&file_actions, pipe_fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&file_actions, pipe_fds[0]);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (posix_spawn(&child, argv[0], &file_actions, NULL, argv, envp) != 0) {
+    posix_spawn_file_actions_destroy(&file_actions);
+    return -1;
+  }
+
+  posix_spawn_file_actions_destroy(&file_actions);
+  close(pipe_fds[1]);
+
+  if ((len = read(pipe_fds[0], report, sizeof(report) - 1)) > 0) report[len] = '\0';
+  close(pipe_fds[0]);
+  waitpid(child, &status, 0);
+
+  if (sscanf(report, "%lli %li %li %li", &main_sec, &main_nsec, rss, dirty) != 4 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s: failed (status %i)\n", argv[0], status);
+    return -1;
+  }
+
+  *to_main = (main_sec - start.tv_sec) * 1e6 + (main_nsec - start.tv_nsec) / 1e3;
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  char       tmp_dir[] = "/tmp/relr-startup.XXXXXX", dir[PATH_MAX], app_path[PATH_MAX + 16], cmd[PATH_MAX * 2 + 128];
+  const char *interpreter = NULL;
+  int        iterations   = 100, argi = 1;
+
+  if (argc > 2 && strcmp(argv[1], "--interpreter") == 0) {
+    interpreter = argv[2];
+    argi        = 3;
+  }
+
+  if (argi < argc) iterations = atoi(argv[argi++]);
+
+  if (argi < argc || iterations < 1) {
+    fprintf(stderr, "Usage: %s [--interpreter <ld.so>] [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  if (mkdtemp(tmp_dir) == NULL) {
+    perror(tmp_dir);
+    return 1;
+  }
+
+  printf("%i iterations per case, %s, latency in us, memory of the library in kB\n\n", iterations,
+         interpreter ? interpreter : "host dynamic linker");
+  printf("%-16s %9s %9s %9s %10s %10s %10s\n", "relocs/linking", "mean", "p50", "p90", "file", "rss", "dirty");
+
+  for (int c = 0; c < (int) (sizeof(counts) / sizeof(counts[0])); c++) {
+    FILE *fp;
+
+    snprintf(dir, sizeof(dir), "%s/%s", tmp_dir, counts[c].name);
+    snprintf(app_path, sizeof(app_path), "%s/app.c", dir);
+
+    if (mkdir(dir, 0755) == -1 || (fp = fopen(app_path, "w")) == NULL) {
+      perror(dir);
+      return 1;
+    }
+
+    fputs(app_source, fp);
+    fclose(fp);
+
+    if (build_library(dir, counts[c].relocations) != 0) return 1;
+
+    snprintf(cmd, sizeof(cmd), "cd %s && cc app.c -o app -Wl,--no-as-needed -Lunpacked -lbench-relr", dir);
+    if (run_command(cmd) != 0) return 1;
+
+    snprintf(app_path, sizeof(app_path), "%s/app", dir);
+
+    for (int packed = 0; packed < 2; packed++) {
+      char        library_path_env[PATH_MAX + 32], library[PATH_MAX + 32], label[64];
+      char        *app_argv[] = { (char *) (interpreter ? interpreter : app_path), interpreter ? app_path : NULL, NULL };
+      char        *app_envp[] = { library_path_env, NULL };
+      double      *to_main    = calloc(iterations, sizeof(double)), total = 0;
+      long        rss = 0, dirty = 0;
+      struct stat library_info;
+
+      snprintf(library_path_env, sizeof(library_path_env), "LD_LIBRARY_PATH=%s/%s", dir, packed ? "packed" : "unpacked");
+      snprintf(library, sizeof(library), "%s/%s/libbench-relr.so", dir, packed ? "packed" : "unpacked");
+      snprintf(label, sizeof(label), "%s/%s", counts[c].name, packed ? "packed" : "unpacked");
+
+      if (stat(library, &library_info) == -1) {
+        perror(library);
+        return 1;
+      }
+
+      // the first run (page cache) is not measured
+      for (int i = -1; i < iterations; i++) {
+        double result;
+
+        if (run_app(app_argv, app_envp, &result, &rss, &dirty) != 0) return 1;
+
+        if (i >= 0) {
+          to_main[i] = result;
+          total     += result;
+        }
+      }
+
+      qsort(to_main, iterations, sizeof(double), compare_double);
+
+      printf("%-16s %9.1f %9.1f %9.1f %10lli %10li %10li\n", label, total / iterations, to_main[iterations / 2],
+             to_main[iterations * 9 / 10], (long long) library_info.st_size / 1024, rss, dirty);
+      fflush(stdout);
+      free(to_main);
+    }
+  }
+
+  execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  return 0;
+}
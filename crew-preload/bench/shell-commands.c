@@ -0,0 +1,170 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  shell-commands: Measure system()/popen() latency for commands as configure scripts and build tools run them,
+                  without crew-preload.so, with it going through the shell and with it executing simple
+                  commands directly (see shell.c)
+
+  Cases:
+    system-true       system("true")
+    system-test       system("test -d /usr")
+    popen-uname       popen("uname -m", "r") and read the output
+    popen-getconf     popen("getconf LONG_BIT", "r") and read the output
+    popen-pipe        popen("uname -m | tr a-z A-Z", "r"), needs the shell in all modes (for comparison)
+
+  Modes:
+    none      without LD_PRELOAD
+    shell     LD_PRELOAD, CREW_PRELOAD_NO_SHELL_BYPASS=1 (every command through /bin/sh -c)
+    direct    LD_PRELOAD (simple commands spawned directly)
+
+  Each combination runs in a separate worker process (this program re-executed with or without LD_PRELOAD).
+  Wait status and output of the last run are printed next to the latency, they should not differ between the modes.
+  Use crew-preload-standin.so (see Makefile) to run this on any Linux box.
+
+  Usage:
+
+    make bench
+    ./shell-commands <path to crew-preload.so> [iterations (default: 200)]
+*/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+struct ShellCase {
+  const char *name,
+             *command;
+  bool       use_popen;
+};
+
+static const struct ShellCase cases[] = {
+  { "system-true",   "true",                        false },
+  { "system-test",   "test -d /usr",                false },
+  { "popen-uname",   "uname -m",                    true  },
+  { "popen-getconf", "getconf LONG_BIT",            true  },
+  { "popen-pipe",    "uname -m | tr a-z A-Z",       true  },
+};
+
+static const char *modes[] = { "none", "shell", "direct" };
+
+static int compare_double(const void *a, const void *b) {
+  return (*(double *) a > *(double *) b) - (*(double *) a < *(double *) b);
+}
+
+static int run_command(const struct ShellCase *shell_case, char *output, size_t output_size) {
+  // run_command(): run the command once, returns its wait status, output receives what it printed (popen() only)
+  FILE   *fp;
+  size_t len;
+
+  output[0] = '\0';
+
+  if (!shell_case->use_popen) return system(shell_case->command);
+
+  if ((fp = popen(shell_case->command, "r")) == NULL) return -1;
+
+  len         = fread(output, 1, output_size - 1, fp);
+  output[len] = '\0';
+
+  return pclose(fp);
+}
+
+static int run_worker(const struct ShellCase *shell_case, int iterations, const char *label) {
+  // run_worker(): run the command repeatedly, print latency distribution, status and output of the last run
+  double *results = calloc(iterations, sizeof(double)), total = 0;
+  char   output[256], *newline;
+  int    status = 0;
+
+  for (int i = -1; i < iterations; i++) {
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    status = run_command(shell_case, output, sizeof(output));
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    // first iteration warms up page cache and the caches of crew-preload.so
+    if (i >= 0) {
+      results[i] = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+      total     += results[i];
+    }
+  }
+
+  if ((newline = strchr(output, '\n'))) *newline = '\0';
+  qsort(results, iterations, sizeof(double), compare_double);
+
+  printf("%-24s %9.1f %9.1f %9.1f %9.1f %7i  %s\n", label, total / iterations, results[iterations / 2],
+         results[iterations * 9 / 10], results[iterations - 1], status, output);
+
+  free(results);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  char    tmp_dir[] = "/tmp/shell-commands.XXXXXX", preload[PATH_MAX], self_path[PATH_MAX],
+          preload_env[PATH_MAX + 16], exec_cache_env[PATH_MAX + 32], decision_cache_env[PATH_MAX + 32], path_env[32];
+  int     iterations = (argc > 2) ? atoi(argv[2]) : 200;
+  ssize_t len;
+
+  // worker mode: shell-commands --worker <case> <iterations> <label>
+  if (argc == 5 && strcmp(argv[1], "--worker") == 0) return run_worker(&cases[atoi(argv[2])], atoi(argv[3]), argv[4]);
+
+  if (argc < 2 || argc > 3 || realpath(argv[1], preload) == NULL || iterations < 1) {
+    fprintf(stderr, "Usage: %s <path to crew-preload.so> [iterations]\n", argv[0]);
+    return 1;
+  }
+
+  if ((len = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1)) == -1 || mkdtemp(tmp_dir) == NULL) {
+    perror(argv[0]);
+    return 1;
+  }
+
+  self_path[len] = '\0';
+
+  snprintf(path_env, sizeof(path_env), "PATH=/usr/bin:/bin");
+  snprintf(preload_env, sizeof(preload_env), "LD_PRELOAD=%s", preload);
+  snprintf(exec_cache_env, sizeof(exec_cache_env), "CREW_PRELOAD_EXEC_CACHE_DIR=%s/exec-cache", tmp_dir);
+  snprintf(decision_cache_env, sizeof(decision_cache_env), "CREW_PRELOAD_DECISION_CACHE=%s/decisions", tmp_dir);
+
+  printf("%i iterations per case, latency in us\n\n", iterations);
+  printf("%-24s %9s %9s %9s %9s %7s  %s\n", "case/mode", "mean", "p50", "p90", "max", "status", "output");
+
+  for (int c = 0; c < (int) (sizeof(cases) / sizeof(cases[0])); c++) {
+    for (int m = 0; m < (int) (sizeof(modes) / sizeof(modes[0])); m++) {
+      char  case_str[16], iterations_str[16], label[64];
+      char  *worker_argv[] = { self_path, "--worker", case_str, iterations_str, label, NULL };
+      char  *worker_envp[] = { path_env, exec_cache_env, decision_cache_env,
+                               (m == 1) ? "CREW_PRELOAD_NO_SHELL_BYPASS=1" : "CREW_PRELOAD_VERBOSE=0",
+                               (m > 0) ? preload_env : NULL, NULL };
+      pid_t worker;
+
+      snprintf(case_str, sizeof(case_str), "%i", c);
+      snprintf(iterations_str, sizeof(iterations_str), "%i", iterations);
+      snprintf(label, sizeof(label), "%s/%s", cases[c].name, modes[m]);
+      fflush(stdout);
+
+      if (posix_spawn(&worker, self_path, NULL, NULL, worker_argv, worker_envp) != 0) {
+        perror("posix_spawn");
+        return 1;
+      }
+
+      waitpid(worker, NULL, 0);
+    }
+  }
+
+  fflush(stdout);
+  execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  return 0;
+}
@@ -0,0 +1,116 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  spawn-leak: Check that RSS and the number of open fds of a process calling posix_spawn() through
+              crew-preload.so stay flat (like make/ninja spawning lots of jobs)
+
+  Spawns true(1) with an environment of 5000 variables (more than the fixed-size arrays exec_wrapper() used to have),
+  through both posix_spawn() and posix_spawnp(). Both the exec cache and the memfd path are exercised if
+  crew-preload.so is built with CREW_GLIBC_INTERPRETER pointing to an existing dynamic linker.
+
+  Exits with status 1 if RSS grows by more than 1 MiB or any fd is leaked after the first 1000 spawns (warm up).
+
+  Usage:
+
+    cc -O2 spawn-leak.c -o spawn-leak
+
+    LD_PRELOAD=crew-preload.so ./spawn-leak [spawns (default: 100000)]
+    LD_PRELOAD=crew-preload.so CREW_PRELOAD_NO_EXEC_CACHE=1 ./spawn-leak [spawns (default: 100000)]
+*/
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define NUM_ENVS     5000
+#define WARM_UP      1000
+#define MAX_RSS_GROW 1024
+
+extern char **environ;
+
+static long rss_kb(void) {
+  long size, pages = 0;
+  FILE *fp   = fopen("/proc/self/statm", "r");
+
+  if (fp == NULL || fscanf(fp, "%ld %ld", &size, &pages) != 2) pages = -1;
+  if (fp) fclose(fp);
+
+  return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int count_fds(void) {
+  DIR *dir  = opendir("/proc/self/fd");
+  int count = 0;
+
+  while (dir && readdir(dir)) count++;
+  if (dir) closedir(dir);
+
+  // ".", ".." and the fd of dir itself
+  return count - 3;
+}
+
+int main(int argc, char **argv) {
+  int  spawns   = (argc > 1) ? atoi(argv[1]) : 100000, base_fds = 0, failures = 0;
+  long base_rss = 0;
+  char **envp   = calloc(NUM_ENVS + 2, sizeof(char *));
+
+  if (getenv("LD_PRELOAD") == NULL) fprintf(stderr, "warning: LD_PRELOAD is not set, testing without crew-preload.so\n");
+
+  if (spawns <= WARM_UP || envp == NULL) {
+    fprintf(stderr, "Usage: %s [spawns (> %i)]\n", argv[0], WARM_UP);
+    return 1;
+  }
+
+  for (int i = 0; i < NUM_ENVS; i++) asprintf(&envp[i], "SPAWN_LEAK_TEST_%i=%i", i, i);
+
+  // keep crew-preload.so loaded in the children
+  if (getenv("LD_PRELOAD")) asprintf(&envp[NUM_ENVS], "LD_PRELOAD=%s", getenv("LD_PRELOAD"));
+
+  printf("%10s %10s %6s\n", "spawns", "rss (kB)", "fds");
+
+  for (int i = 1; i <= spawns; i++) {
+    char  *spawn_argv[] = { "true", NULL };
+    pid_t child;
+    int   ret = (i % 2) ? posix_spawn(&child, "/bin/true", NULL, NULL, spawn_argv, envp)
+                        : posix_spawnp(&child, "true", NULL, NULL, spawn_argv, envp);
+
+    if (ret != 0) {
+      if (failures++ == 0) fprintf(stderr, "posix_spawn: %s\n", strerror(ret));
+      continue;
+    }
+
+    waitpid(child, NULL, 0);
+
+    if (i == WARM_UP) {
+      base_rss = rss_kb();
+      base_fds = count_fds();
+    }
+
+    if (i % (spawns / 10) == 0 || i == WARM_UP) printf("%10i %10li %6i\n", i, rss_kb(), count_fds());
+  }
+
+  long rss_grow = rss_kb() - base_rss;
+  int  fd_grow  = count_fds() - base_fds;
+
+  printf("rss growth after warm up: %li kB, fd growth: %i, failed spawns: %i\n", rss_grow, fd_grow, failures);
+
+  if (rss_grow > MAX_RSS_GROW || fd_grow > 0 || failures > 0) {
+    printf("FAIL\n");
+    return 1;
+  }
+
+  printf("PASS\n");
+  return 0;
+}
@@ -0,0 +1,257 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  spawn-threads: Measure posix_spawn() throughput of a multithreaded process with and without crew-preload.so, and
+                 check that no spawn gets the arguments or environment of another thread
+
+  Every thread cycles through:
+    path      posix_spawn() of this program by path
+    name      posix_spawnp() of a symlink to this program, found in the first PATH directory (see path-index.c)
+    script    posix_spawn() of a script whose shebang is `#!<this program> --script`
+
+  Each child gets a token unique to the spawn as argument and as SPAWN_TOKEN in its environment, and exits with 1
+  if they differ (or its arguments are not what the spawn passed), which counts as a failure like a failed spawn.
+
+  Modes:
+    none      without LD_PRELOAD
+    preload   LD_PRELOAD
+
+  Each combination of mode and thread count runs in a separate worker process (this program re-executed with or
+  without LD_PRELOAD). Scaling is the throughput relative to one thread in the same mode.
+  Use crew-preload-standin.so (see Makefile) to run this on any Linux box.
+
+  Usage:
+
+    make bench
+    ./spawn-threads <path to crew-preload.so> [spawns per thread (default: 200)]
+*/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define MAX_THREADS 16
+#define CHILD_NAME  "spawn-threads-child"
+
+static const int  thread_counts[] = { 1, 2, 4, 8, 16 };
+static const char *modes[]        = { "none", "preload" };
+
+static char self_path[PATH_MAX], script_path[PATH_MAX + 16];
+static int  spawns_per_thread;
+
+struct SpawnThread {
+  pthread_t thread;
+  int       index,
+            failures;
+};
+
+static int check_child(int argc, char **argv) {
+  // check_child(): exit status of a child, argv is `--child <token>` (after the script part, if any)
+  const char *token = getenv("SPAWN_TOKEN");
+
+  return (argc == 3 && strcmp(argv[1], "--child") == 0 && token && strcmp(argv[2], token) == 0) ? 0 : 1;
+}
+
+static void *spawn_thread(void *arg) {
+  // spawn_thread(): spawn children by path, by name and as scripts, counting failures
+  struct SpawnThread *thread = arg;
+  extern char        **environ;
+  char               **envp, token[32], token_env[48];
+  int                num_env = 0;
+
+  for (char **env = environ; *env; env++) num_env++;
+
+  envp = calloc(num_env + 2, sizeof(char *));
+  memcpy(envp, environ, num_env * sizeof(char *));
+  envp[num_env] = token_env;
+
+  for (int i = 0; i < spawns_per_thread; i++) {
+    char  *path_argv[]   = { self_path, "--child", token, NULL },
+          *name_argv[]   = { CHILD_NAME, "--child", token, NULL },
+          *script_argv[] = { script_path, "--child", token, NULL };
+    pid_t child;
+    int   status, ret;
+
+    snprintf(token, sizeof(token), "%i-%i", thread->index, i);
+    snprintf(token_env, sizeof(token_env), "SPAWN_TOKEN=%s", token);
+
+    switch (i % 3) {
+      case 0:  ret = posix_spawn(&child, self_path, NULL, NULL, path_argv, envp); break;
+      case 1:  ret = posix_spawnp(&child, CHILD_NAME, NULL, NULL, name_argv, envp); break;
+      default: ret = posix_spawn(&child, script_path, NULL, NULL, script_argv, envp); break;
+    }
+
+    if (ret != 0 || waitpid(child, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      thread->failures++;
+    }
+  }
+
+  free(envp);
+  return NULL;
+}
+
+static int run_worker(int num_threads) {
+  // run_worker(): run num_threads spawning threads, prints "<spawns per second> <failures>"
+  struct SpawnThread threads[MAX_THREADS];
+  struct timespec    start, end;
+  double             elapsed;
+  int                failures = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  for (int t = 0; t < num_threads; t++) {
+    threads[t].index    = t;
+    threads[t].failures = 0;
+    pthread_create(&threads[t].thread, NULL, spawn_thread, &threads[t]);
+  }
+
+  for (int t = 0; t < num_threads; t++) {
+    pthread_join(threads[t].thread, NULL);
+    failures += threads[t].failures;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  printf("%.1f %i\n", num_threads * spawns_per_thread / elapsed, failures);
+  return 0;
+}
+
+static int run_mode(char **worker_envp, int num_threads, double *rate, int *failures) {
+  // run_mode(): run a worker and collect its output
+  posix_spawn_file_actions_t actions;
+  char                       threads_str[16], spawns_str[16];
+  char                       *worker_argv[] = { self_path, "--worker", threads_str, spawns_str, NULL };
+  int                        pipe_fds[2], status;
+  pid_t                      worker;
+  FILE                       *output;
+
+  snprintf(threads_str, sizeof(threads_str), "%i", num_threads);
+  snprintf(spawns_str, sizeof(spawns_str), "%i", spawns_per_thread);
+
+  if (pipe(pipe_fds) == -1) return -1;
+
+  posix_spawn_file_actions_init(&actions);
+  posix_spawn_file_actions_adddup2(&actions, pipe_fds[1], STDOUT_FILENO);
+  posix_spawn_file_actions_addclose(&actions, pipe_fds[0]);
+
+  if (posix_spawn(&worker, self_path, &actions, NULL, worker_argv, worker_envp) != 0) {
+    posix_spawn_file_actions_destroy(&actions);
+    return -1;
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  close(pipe_fds[1]);
+
+  output = fdopen(pipe_fds[0], "r");
+  if (fscanf(output, "%lf %i", rate, failures) != 2) *rate = 0;
+
+  fclose(output);
+  if (waitpid(worker, &status, 0) == -1 || *rate == 0) return -1;
+
+  return status;
+}
+
+int main(int argc, char **argv) {
+  char    tmp_dir[] = "/tmp/spawn-threads.XXXXXX", preload[PATH_MAX], link_path[PATH_MAX + 32],
+          preload_env[PATH_MAX + 16], exec_cache_env[PATH_MAX + 32], decision_cache_env[PATH_MAX + 32],
+          path_env[PATH_MAX + 32];
+  ssize_t len;
+  FILE    *script;
+
+  // child modes: spawn-threads --child <token>, spawn-threads --script <script> --child <token>
+  if (argc > 1 && strcmp(argv[1], "--child") == 0) return check_child(argc, argv);
+  if (argc > 2 && strcmp(argv[1], "--script") == 0) return check_child(argc - 2, argv + 2);
+
+  if ((len = readlink("/proc/self/exe", self_path, sizeof(self_path) - 1)) == -1) {
+    perror(argv[0]);
+    return 1;
+  }
+
+  self_path[len] = '\0';
+
+  // worker mode: spawn-threads --worker <threads> <spawns per thread>, script path is PATH's first directory/..
+  if (argc == 4 && strcmp(argv[1], "--worker") == 0) {
+    const char *bin_dir = getenv("PATH");
+
+    snprintf(script_path, sizeof(script_path), "%.*s/../child.sh", (int) strcspn(bin_dir, ":"), bin_dir);
+    spawns_per_thread = atoi(argv[3]);
+
+    return run_worker(atoi(argv[2]));
+  }
+
+  spawns_per_thread = (argc > 2) ? atoi(argv[2]) : 200;
+
+  if (argc < 2 || argc > 3 || realpath(argv[1], preload) == NULL || spawns_per_thread < 1) {
+    fprintf(stderr, "Usage: %s <path to crew-preload.so> [spawns per thread]\n", argv[0]);
+    return 1;
+  }
+
+  if (mkdtemp(tmp_dir) == NULL) {
+    perror(argv[0]);
+    return 1;
+  }
+
+  snprintf(link_path, sizeof(link_path), "%s/bin", tmp_dir);
+  mkdir(link_path, 0755);
+  snprintf(link_path, sizeof(link_path), "%s/bin/" CHILD_NAME, tmp_dir);
+
+  snprintf(script_path, sizeof(script_path), "%s/child.sh", tmp_dir);
+  script = fopen(script_path, "w");
+  fprintf(script, "#!%s --script\n", self_path);
+  fclose(script);
+
+  if (symlink(self_path, link_path) == -1 || chmod(script_path, 0755) == -1) {
+    perror(argv[0]);
+    return 1;
+  }
+
+  snprintf(path_env, sizeof(path_env), "PATH=%s/bin:/usr/bin:/bin", tmp_dir);
+  snprintf(preload_env, sizeof(preload_env), "LD_PRELOAD=%s", preload);
+  snprintf(exec_cache_env, sizeof(exec_cache_env), "CREW_PRELOAD_EXEC_CACHE_DIR=%s/exec-cache", tmp_dir);
+  snprintf(decision_cache_env, sizeof(decision_cache_env), "CREW_PRELOAD_DECISION_CACHE=%s/decisions", tmp_dir);
+
+  printf("%i spawns per thread (path, name and script in turn)\n\n", spawns_per_thread);
+  printf("%-10s %8s %12s %8s %9s\n", "mode", "threads", "spawns/s", "scaling", "failures");
+
+  for (int m = 0; m < (int) (sizeof(modes) / sizeof(modes[0])); m++) {
+    char   *worker_envp[] = { path_env, exec_cache_env, decision_cache_env, (m > 0) ? preload_env : NULL, NULL };
+    double single_rate    = 0;
+
+    // first run (one thread) warms up page cache and the caches of crew-preload.so
+    for (int t = -1; t < (int) (sizeof(thread_counts) / sizeof(thread_counts[0])); t++) {
+      int    num_threads = thread_counts[(t < 0) ? 0 : t], failures;
+      double rate;
+
+      if (run_mode(worker_envp, num_threads, &rate, &failures) != 0) {
+        fprintf(stderr, "Worker failed in mode %s with %i threads\n", modes[m], num_threads);
+        return 1;
+      }
+
+      if (t < 0) continue;
+      if (t == 0) single_rate = rate;
+
+      printf("%-10s %8i %12.1f %7.2fx %9i\n", modes[m], thread_counts[t], rate, rate / single_rate, failures);
+      fflush(stdout);
+    }
+  }
+
+  fflush(stdout);
+  execlp("rm", "rm", "-rf", tmp_dir, NULL);
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  startup: Measure what loading crew-preload.so costs a process that never calls exec*()
+
+  Runs an executable (/bin/true by default) repeatedly with posix_spawn() + waitpid(), alternating between runs
+  with and without LD_PRELOAD, and prints the latency distribution of both. This program itself is not
+  preloaded, so only the cost inside the child (loading the library, relocations, constructor) is measured.
+
+  Usage:
+
+    make bench
+    ./startup <path to crew-preload.so> [iterations (default: 10000)] [executable (default: /bin/true)]
+*/
+
+#define _GNU_SOURCE
+#include <limits.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static int compare_double(const void *a, const void *b) {
+  return (*(double *) a > *(double *) b) - (*(double *) a < *(double *) b);
+}
+
+static double spawn_once(const char *exec_path, char **envp) {
+  struct timespec start, end;
+  char            *argv[] = { (char *) exec_path, NULL };
+  pid_t           child;
+  int             status;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (posix_spawn(&child, exec_path, NULL, NULL, argv, envp) != 0 || waitpid(child, &status, 0) == -1 ||
+      !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    fprintf(stderr, "%s: spawn failed\n", exec_path);
+    exit(1);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+}
+
+static double print_results(const char *label, double *results, int iterations) {
+  double total = 0;
+
+  for (int i = 0; i < iterations; i++) total += results[i];
+  qsort(results, iterations, sizeof(double), compare_double);
+
+  printf("%-8s %9.1f %9.1f %9.1f %9.1f\n", label, total / iterations,
+         results[iterations / 2], results[iterations * 9 / 10], results[iterations * 99 / 100]);
+
+  return total / iterations;
+}
+
+int main(int argc, char **argv) {
+  char       preload[PATH_MAX], preload_env[PATH_MAX + 16];
+  int        iterations = (argc > 2) ? atoi(argv[2]) : 10000;
+  const char *exec_path = (argc > 3) ? argv[3] : "/bin/true";
+  char       *plain_envp[]   = { "PATH=/usr/bin:/bin", NULL },
+             *preload_envp[] = { "PATH=/usr/bin:/bin", preload_env, NULL };
+  double     *plain          = calloc(iterations, sizeof(double)),
+             *preloaded      = calloc(iterations, sizeof(double)),
+             plain_mean, preloaded_mean;
+
+  if (argc < 2 || realpath(argv[1], preload) == NULL || iterations < 1) {
+    fprintf(stderr, "Usage: %s <path to crew-preload.so> [iterations] [executable]\n", argv[0]);
+    return 1;
+  }
+
+  snprintf(preload_env, sizeof(preload_env), "LD_PRELOAD=%s", preload);
+
+  // warm up page cache
+  spawn_once(exec_path, plain_envp);
+  spawn_once(exec_path, preload_envp);
+
+  // interleaved, so that both sides see the same system noise
+  for (int i = 0; i < iterations; i++) {
+    plain[i]     = spawn_once(exec_path, plain_envp);
+    preloaded[i] = spawn_once(exec_path, preload_envp);
+  }
+
+  printf("%s, %i iterations, latency in us\n", exec_path, iterations);
+  printf("%-8s %9s %9s %9s %9s\n", "preload", "mean", "p50", "p90", "p99");
+
+  plain_mean     = print_results("none", plain, iterations);
+  preloaded_mean = print_results("preload", preloaded, iterations);
+
+  printf("overhead: %.1f us per process\n", preloaded_mean - plain_mean);
+  return 0;
+}
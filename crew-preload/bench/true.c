@@ -0,0 +1,17 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  true: Minimal executable used by exec-matrix, built as static ELF, dynamic ELF (with the host interpreter)
+        and dynamic ELF using the stand-in interpreter (see Makefile)
+*/
+
+int main(void) {
+  return 0;
+}
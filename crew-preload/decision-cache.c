@@ -0,0 +1,247 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  decision-cache.c: Cross-process cache of exec_wrapper() decisions
+
+  Configure scripts and recursive builds execute the same few commands (sh, sed, grep, cc...) tens of thousands
+  of times, each exec would repeat realpath(), access(), open(), mmap() and ELF/shebang parsing with identical results.
+
+  The result of all of these (see struct ExecDecision) is stored in a hash table inside a file mapped by every
+  process using crew-preload.so (CREW_PRELOAD_DECISION_CACHE, default: /dev/shm/crew-preload-decisions-v1.<uid>).
+  Entries are keyed by executable path and validated by (st_dev, st_ino, st_size, st_mtim) of both the executable
+  and the resolved target, so a cache hit costs one or two stat() calls.
+
+  Each entry is protected by a sequence lock: writers make the sequence number odd while updating an entry (and skip
+  the entry if another writer holds it), readers treat an entry as missing if its sequence number is odd or has
+  changed while copying it out. No process ever waits for another one.
+*/
+
+#include "./main.h"
+
+#define DECISION_CACHE_MAGIC   0x43525044 // "CRPD"
+#define DECISION_CACHE_VERSION 1
+#define DECISION_CACHE_ENTRIES 2048
+#define DECISION_CACHE_WAYS    4
+#define DECISION_CACHE_TTL     300
+
+// all fields have fixed size as the table is shared between 32-bit and 64-bit processes
+struct DecisionCacheEntry {
+  uint32_t      seq,
+                key_hash,
+                config,
+                created;
+  struct FileId key_id,
+                target_id;
+  uint8_t       type,
+                is_dyn_exec,
+                is_system,
+                is_libc,
+                rewrite_interp,
+                padding[3];
+  char          key[DECISION_PATH_MAX],
+                target[DECISION_PATH_MAX],
+                shebang[DECISION_PATH_MAX];
+};
+
+struct DecisionCache {
+  uint32_t magic,
+           version,
+           num_entries,
+           padding;
+  uint64_t hits,
+           misses,
+           stores;
+  struct DecisionCacheEntry entries[DECISION_CACHE_ENTRIES];
+};
+
+static struct DecisionCache *decision_cache = NULL;
+static bool                 cache_mapped    = false;
+
+static uint32_t hash_path(const char *path) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+
+  while (*path) hash = (hash ^ (uint8_t) *path++) * 16777619u;
+
+  return hash ?: 1;
+}
+
+static uint32_t current_config(void) {
+  // decisions depend on the following settings and the rule set, entries created with different ones will not be used
+  return ((no_crew_cmd << 0) | (no_crew_glibc << 1) | (CREW_GLIBC_IS_64BIT << 2) | ((sizeof(void *) == 8) << 3)) ^
+         (rules_checksum() << 4);
+}
+
+static struct DecisionCache *map_decision_cache(void) {
+  char                 default_path[64];
+  const char           *cache_path = getenv("CREW_PRELOAD_DECISION_CACHE");
+  struct DecisionCache *cache;
+  struct stat          cache_info;
+  void                 *mem;
+  int                  fd;
+
+  if (__atomic_exchange_n(&cache_mapped, true, __ATOMIC_ACQ_REL)) return __atomic_load_n(&decision_cache, __ATOMIC_ACQUIRE);
+
+  if (cache_path == NULL) {
+    snprintf(default_path, sizeof(default_path), "/dev/shm/crew-preload-decisions-v%i.%i", DECISION_CACHE_VERSION, geteuid());
+    cache_path = default_path;
+  }
+
+  if ((fd = open(cache_path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)) == -1) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Failed to open decision cache %s (%s)\n", getpid(), PROMPT_NAME, cache_path, strerror(errno));
+    return NULL;
+  }
+
+  // never trust a table that can be modified by someone else
+  if (fstat(fd, &cache_info) == -1 || !S_ISREG(cache_info.st_mode) ||
+      cache_info.st_uid != geteuid() || (cache_info.st_mode & (S_IWGRP | S_IWOTH))) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Decision cache %s is unusable, ignoring\n", getpid(), PROMPT_NAME, cache_path);
+    close(fd);
+    return NULL;
+  }
+
+  // a newly created (empty) file, all-zero entries are treated as empty
+  if (cache_info.st_size < (off_t) sizeof(struct DecisionCache) && ftruncate(fd, sizeof(struct DecisionCache)) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  mem = mmap(NULL, sizeof(struct DecisionCache), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED) return NULL;
+
+  cache = mem;
+
+  if (__atomic_load_n(&cache->magic, __ATOMIC_ACQUIRE) == 0) {
+    cache->version     = DECISION_CACHE_VERSION;
+    cache->num_entries = DECISION_CACHE_ENTRIES;
+    __atomic_store_n(&cache->magic, DECISION_CACHE_MAGIC, __ATOMIC_RELEASE);
+  }
+
+  if (cache->magic != DECISION_CACHE_MAGIC || cache->version != DECISION_CACHE_VERSION ||
+      cache->num_entries != DECISION_CACHE_ENTRIES) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Decision cache %s has incompatible format, ignoring\n", getpid(), PROMPT_NAME, cache_path);
+
+    munmap(mem, sizeof(struct DecisionCache));
+    return NULL;
+  }
+
+  // published only once usable, threads that come in meanwhile see no cache
+  __atomic_store_n(&decision_cache, cache, __ATOMIC_RELEASE);
+  return cache;
+}
+
+int decision_cache_lookup(const char *key, struct ExecDecision *decision) {
+  // decision_cache_lookup(): look up decision made for executable path key, the entry is validated by stat()-ing the
+  //                          executable (and the resolved target, if different)
+  //
+  //                          returns 0 on hit, -1 otherwise
+  struct DecisionCache *cache = map_decision_cache();
+  uint32_t             hash   = hash_path(key);
+  struct stat          file_info;
+  struct FileId        id;
+
+  if (cache == NULL || strlen(key) >= DECISION_PATH_MAX) return -1;
+
+  for (int i = 0; i < DECISION_CACHE_WAYS; i++) {
+    struct DecisionCacheEntry *shared = &cache->entries[(hash + i) % DECISION_CACHE_ENTRIES], entry;
+    uint32_t                  seq     = __atomic_load_n(&shared->seq, __ATOMIC_ACQUIRE);
+
+    if (seq & 1 || shared->key_hash != hash) continue;
+
+    memcpy(&entry, shared, sizeof(entry));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    // entry was modified while we are reading it
+    if (__atomic_load_n(&shared->seq, __ATOMIC_RELAXED) != seq) continue;
+
+    if (entry.key_hash != hash || entry.config != current_config() || strncmp(entry.key, key, DECISION_PATH_MAX) != 0) continue;
+    if ((uint32_t) time(NULL) - entry.created > DECISION_CACHE_TTL) break;
+
+    // make sure that the executable (and the resolved target) was not modified since the decision was made
+    if (stat(key, &file_info) == -1) break;
+    file_id_from_stat(&file_info, &id);
+    if (memcmp(&id, &entry.key_id, sizeof(id)) != 0) break;
+
+    if (strncmp(entry.target, key, DECISION_PATH_MAX) != 0) {
+      if (stat(entry.target, &file_info) == -1) break;
+      file_id_from_stat(&file_info, &id);
+      if (memcmp(&id, &entry.target_id, sizeof(id)) != 0) break;
+    }
+
+    decision->type           = entry.type;
+    decision->is_dyn_exec    = entry.is_dyn_exec;
+    decision->is_system      = entry.is_system;
+    decision->is_libc        = entry.is_libc;
+    decision->rewrite_interp = entry.rewrite_interp;
+    decision->target_id      = entry.target_id;
+
+    strncpy(decision->target, entry.target, DECISION_PATH_MAX);
+    strncpy(decision->shebang, entry.shebang, sizeof(decision->shebang));
+
+    __atomic_fetch_add(&cache->hits, 1, __ATOMIC_RELAXED);
+    stats_add(STAT_DECISION_CACHE_HITS, 1);
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Decision cache hit for %s (hits: %llu, misses: %llu)\n", getpid(), PROMPT_NAME, key,
+                         (unsigned long long) cache->hits, (unsigned long long) cache->misses);
+    return 0;
+  }
+
+  __atomic_fetch_add(&cache->misses, 1, __ATOMIC_RELAXED);
+  stats_add(STAT_DECISION_CACHE_MISSES, 1);
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: Decision cache miss for %s (hits: %llu, misses: %llu)\n", getpid(), PROMPT_NAME, key,
+                       (unsigned long long) cache->hits, (unsigned long long) cache->misses);
+  return -1;
+}
+
+void decision_cache_store(const char *key, const struct FileId *key_id, const struct ExecDecision *decision) {
+  // decision_cache_store(): save decision made for executable path key, entries that are being updated by another process
+  //                         will be skipped
+  struct DecisionCache      *cache = map_decision_cache();
+  struct DecisionCacheEntry *entry = NULL;
+  uint32_t                  hash   = hash_path(key), seq;
+
+  if (cache == NULL || strlen(key) >= DECISION_PATH_MAX || strlen(decision->target) >= DECISION_PATH_MAX ||
+      strlen(decision->shebang) >= DECISION_PATH_MAX) return;
+
+  // use the slot that holds the same key or an empty one, otherwise replace the oldest entry
+  for (int i = 0; i < DECISION_CACHE_WAYS; i++) {
+    struct DecisionCacheEntry *candidate = &cache->entries[(hash + i) % DECISION_CACHE_ENTRIES];
+
+    if (candidate->key_hash == hash || candidate->key_hash == 0) {
+      entry = candidate;
+      break;
+    }
+
+    if (entry == NULL || (int32_t) (candidate->created - entry->created) < 0) entry = candidate;
+  }
+
+  seq = __atomic_load_n(&entry->seq, __ATOMIC_RELAXED);
+  if (seq & 1 || !__atomic_compare_exchange_n(&entry->seq, &seq, seq + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return;
+
+  entry->key_hash       = hash;
+  entry->config         = current_config();
+  entry->created        = time(NULL);
+  entry->key_id         = *key_id;
+  entry->target_id      = decision->target_id;
+  entry->type           = decision->type;
+  entry->is_dyn_exec    = decision->is_dyn_exec;
+  entry->is_system      = decision->is_system;
+  entry->is_libc        = decision->is_libc;
+  entry->rewrite_interp = decision->rewrite_interp;
+
+  // lengths are checked above
+  memcpy(entry->key, key, strlen(key) + 1);
+  memcpy(entry->target, decision->target, strlen(decision->target) + 1);
+  memcpy(entry->shebang, decision->shebang, strlen(decision->shebang) + 1);
+
+  __atomic_store_n(&entry->seq, seq + 2, __ATOMIC_RELEASE);
+  __atomic_fetch_add(&cache->stores, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,191 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  elf-class.h: ELF parsing/patching for one ELF class, included by elf.c once with ELF_BITS 32 and once with 64
+
+  ElfW(Ehdr) expands to Elf32_Ehdr or Elf64_Ehdr, ELF_FUNC(name) to name32 or name64, so every function below
+  exists once per class without branching on the class at runtime.
+*/
+
+#define ELF_PASTE_(a, b)     a##b
+#define ELF_PASTE(a, b)      ELF_PASTE_(a, b)
+#define ELF_PASTE3_(a, b, c) a##b##_##c
+#define ELF_PASTE3(a, b, c)  ELF_PASTE3_(a, b, c)
+
+#define ElfW(type)     ELF_PASTE3(Elf, ELF_BITS, type)
+#define ELF_FUNC(name) ELF_PASTE(name, ELF_BITS)
+#define ELF_MEMBER     ELF_PASTE(elf, ELF_BITS)
+
+// number of program/section headers read at once if they are not part of the head
+#define ELF_CHUNK 32
+
+static const void *ELF_FUNC(read_table)(int exec_fd, const char *head, size_t head_len, void *buf, size_t len, off_t offset) {
+  // read_table(): headers at offset, from head if they are part of it (and aligned), read into buf otherwise
+  if (offset + len <= head_len && offset % sizeof(ElfW(Addr)) == 0) return head + offset;
+  if (pread(exec_fd, buf, len, offset) != (ssize_t) len) return NULL;
+
+  return buf;
+}
+
+static int ELF_FUNC(parse_program_headers)(int exec_fd, const char *head, size_t head_len, struct ElfInfo *output) {
+  // parse_program_headers(): find PT_INTERP and read the interpreter path, returns -1 if the file is malformed
+  ElfW(Ehdr) *elf_header = &output->elf_header.ELF_MEMBER;
+  ElfW(Phdr) buf[ELF_CHUNK];
+  uint16_t   phnum;
+
+  if (head_len < sizeof(ElfW(Ehdr))) return -1;
+
+  memcpy(elf_header, head, sizeof(ElfW(Ehdr)));
+  phnum = elf_header->e_phnum;
+
+  if (elf_header->e_phentsize != sizeof(ElfW(Phdr)) ||
+      elf_header->e_phoff + (uint64_t) phnum * sizeof(ElfW(Phdr)) > (uint64_t) output->size) {
+    return -1;
+  }
+
+  for (uint16_t first = 0; first < phnum; first += ELF_CHUNK) {
+    uint16_t         count  = (phnum - first < ELF_CHUNK) ? phnum - first : ELF_CHUNK;
+    off_t            offset = elf_header->e_phoff + (off_t) first * sizeof(ElfW(Phdr));
+    const ElfW(Phdr) *table = ELF_FUNC(read_table)(exec_fd, head, head_len, buf, count * sizeof(ElfW(Phdr)), offset);
+
+    if (table == NULL) return -1;
+
+    for (uint16_t i = 0; i < count; i++) {
+      const ElfW(Phdr) *program_header = &table[i];
+
+      if (program_header->p_type != PT_INTERP) continue;
+
+      size_t interp_len;
+
+      if (program_header->p_filesz == 0 || program_header->p_offset + program_header->p_filesz > (uint64_t) output->size) {
+        return -1;
+      }
+
+      output->is_dyn_exec           = true;
+      output->interp_proghdr_offset = offset + i * sizeof(ElfW(Phdr));
+      memcpy(&output->interp_proghdr.ELF_MEMBER, program_header, sizeof(ElfW(Phdr)));
+
+      interp_len = (program_header->p_filesz < sizeof(output->interpreter)) ? program_header->p_filesz : sizeof(output->interpreter) - 1;
+
+      if (program_header->p_offset + interp_len <= head_len) {
+        memcpy(output->interpreter, head + program_header->p_offset, interp_len);
+      } else if (pread(exec_fd, output->interpreter, interp_len, program_header->p_offset) != (ssize_t) interp_len) {
+        return -1;
+      }
+
+      output->interpreter[interp_len] = '\0';
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+static off_t ELF_FUNC(find_interp_section)(int exec_fd, const struct ElfInfo *elf_info, ElfW(Shdr) *section_header) {
+  // find_interp_section(): locate the .interp section header, which covers the same bytes as PT_INTERP
+  //                        (no need to read the section name string table), returns its offset or 0 if none
+  const ElfW(Ehdr) *elf_header     = &elf_info->elf_header.ELF_MEMBER;
+  const ElfW(Phdr) *program_header = &elf_info->interp_proghdr.ELF_MEMBER;
+  ElfW(Shdr)       buf[ELF_CHUNK];
+  uint16_t         shnum           = elf_header->e_shnum;
+
+  if (elf_header->e_shentsize != sizeof(ElfW(Shdr)) ||
+      elf_header->e_shoff + (uint64_t) shnum * sizeof(ElfW(Shdr)) > (uint64_t) elf_info->size) {
+    return 0;
+  }
+
+  for (uint16_t first = 0; first < shnum; first += ELF_CHUNK) {
+    uint16_t count  = (shnum - first < ELF_CHUNK) ? shnum - first : ELF_CHUNK;
+    off_t    offset = elf_header->e_shoff + (off_t) first * sizeof(ElfW(Shdr));
+
+    if (pread(exec_fd, buf, count * sizeof(ElfW(Shdr)), offset) != (ssize_t) (count * sizeof(ElfW(Shdr)))) return 0;
+
+    for (uint16_t i = 0; i < count; i++) {
+      if (buf[i].sh_type == SHT_PROGBITS && buf[i].sh_offset == program_header->p_offset && buf[i].sh_size == program_header->p_filesz) {
+        memcpy(section_header, &buf[i], sizeof(ElfW(Shdr)));
+        return offset + i * sizeof(ElfW(Shdr));
+      }
+    }
+  }
+
+  return 0;
+}
+
+static off_t ELF_FUNC(write_patched_executable)(const char *exec_path, int output_fd, int exec_fd, const struct ElfInfo *elf_info) {
+  // write_patched_executable(): write a copy of the executable with Chromebrew's dynamic linker as its interpreter into output_fd,
+  //                           returns size of the modified executable or -1 on error
+  //
+  //                           only the modified headers are built in memory, everything else is copied from exec_fd by the kernel
+  ElfW(Ehdr) elf_header     = elf_info->elf_header.ELF_MEMBER;
+  ElfW(Phdr) program_header = elf_info->interp_proghdr.ELF_MEMBER;
+  ElfW(Shdr) section_header;
+  off_t      old_section_header_offset = elf_header.e_shoff,
+             interp_offset             = old_section_header_offset,
+             new_section_header_offset = (interp_offset + sizeof(CREW_GLIBC_INTERPRETER) + 7) & ~7,
+             sechdr_offset;
+
+  /*
+    allocate room between the last ELF section and the first section header for our new interpreter's path
+    Before:
+
+        | ELF header | Program headers | Sections | Section headers |
+
+    After:
+
+        | ELF header | Program headers | Sections | New interpreter path | Section headers |
+
+  */
+
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: Modifying ELF interpreter path for %s...\n", getpid(), PROMPT_NAME, exec_path);
+
+  if (old_section_header_offset == 0 || old_section_header_offset > elf_info->size) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Invalid section header offset in %s\n", getpid(), PROMPT_NAME, exec_path);
+    return -1;
+  }
+
+  if ((sechdr_offset = ELF_FUNC(find_interp_section)(exec_fd, elf_info, &section_header)) != 0) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: .interp section found at offset 0x%llx\n", getpid(), PROMPT_NAME, (unsigned long long) sechdr_offset);
+  }
+
+  // update section header offset, point PT_INTERP and .interp to our new interpreter string
+  elf_header.e_shoff       = new_section_header_offset;
+  program_header.p_offset  = interp_offset;
+  program_header.p_paddr   = interp_offset;
+  program_header.p_vaddr   = interp_offset;
+  program_header.p_filesz  = sizeof(CREW_GLIBC_INTERPRETER);
+  program_header.p_memsz   = sizeof(CREW_GLIBC_INTERPRETER);
+
+  section_header.sh_addr   = interp_offset;
+  section_header.sh_offset = interp_offset;
+  section_header.sh_size   = sizeof(CREW_GLIBC_INTERPRETER);
+
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: New PT_INTERP for %s: %s\n", getpid(), PROMPT_NAME, exec_path, CREW_GLIBC_INTERPRETER);
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: Writing modified executable into fd %i...\n", getpid(), PROMPT_NAME, output_fd);
+
+  // copy sections and section headers, then write the interpreter path and modified headers on top of them
+  if (copy_file_data(exec_fd, 0, output_fd, 0, old_section_header_offset) == -1 ||
+      copy_file_data(exec_fd, old_section_header_offset, output_fd, new_section_header_offset, elf_info->size - old_section_header_offset) == -1 ||
+      pwrite(output_fd, CREW_GLIBC_INTERPRETER "\0\0\0\0\0\0\0", new_section_header_offset - interp_offset, interp_offset) == -1 ||
+      pwrite(output_fd, &elf_header, sizeof(elf_header), 0) == -1 ||
+      pwrite(output_fd, &program_header, sizeof(program_header), elf_info->interp_proghdr_offset) == -1 ||
+      (sechdr_offset &&
+       pwrite(output_fd, &section_header, sizeof(section_header), new_section_header_offset + sechdr_offset - old_section_header_offset) == -1)) {
+
+    fprintf(stderr, "[PID %-7i] %s: Failed to write modified executable (%s)\n", getpid(), PROMPT_NAME, strerror(errno));
+    return -1;
+  }
+
+  return new_section_header_offset + elf_info->size - old_section_header_offset;
+}
+
+#undef ElfW
+#undef ELF_FUNC
+#undef ELF_MEMBER
+#undef ELF_CHUNK
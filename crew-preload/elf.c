@@ -0,0 +1,140 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  elf.c: Locate and rewrite the interpreter (PT_INTERP/.interp) of ELF executables
+
+  Used by exec_wrapper() to run executables with Chromebrew's dynamic linker, and by tools/crew-preload-patch.c
+  to patch installed executables ahead of time.
+
+  Executables are never mapped: callers read the first EXEC_HEAD_SIZE bytes (which usually contain the ELF header,
+  the program headers and the interpreter path), anything beyond that is fetched with pread(). Section headers are
+  only read when an executable is actually rewritten. The parser is instantiated once per ELF class (see elf-class.h).
+*/
+
+#include "./main.h"
+
+#define COPY_BUFFER_SIZE 65536
+
+static int copy_file_data(int in_fd, off_t in_offset, int out_fd, off_t out_offset, size_t len) {
+  // copy_file_data(): copy len bytes from in_fd to out_fd without bringing them into our address space,
+  //                   try copy_file_range() first, then sendfile(), then fallback to a plain read()/write() loop
+  static bool no_copy_file_range = false, no_sendfile = false;
+  ssize_t     copied;
+  char        *buf;
+
+#ifdef SYS_copy_file_range
+  while (!no_copy_file_range && len > 0) {
+    if ((copied = syscall(SYS_copy_file_range, in_fd, &in_offset, out_fd, &out_offset, len, 0)) <= 0) {
+      // ENOSYS: kernel older than 4.5, EXDEV: cross-filesystem copy is not supported (e.g. ext4 => memfd)
+      if (copied == 0 || errno == ENOSYS || errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP) {
+        no_copy_file_range = (copied != 0 && errno == ENOSYS);
+        break;
+      }
+
+      return -1;
+    }
+
+    len -= copied;
+  }
+#endif
+
+  if (len > 0 && !no_sendfile && lseek(out_fd, out_offset, SEEK_SET) != -1) {
+    while (len > 0) {
+      if ((copied = sendfile(out_fd, in_fd, &in_offset, len)) <= 0) {
+        if (copied == 0 || errno == ENOSYS || errno == EINVAL) {
+          no_sendfile = (copied != 0 && errno == ENOSYS);
+          break;
+        }
+
+        return -1;
+      }
+
+      out_offset += copied;
+      len        -= copied;
+    }
+  }
+
+  if (len == 0) return 0;
+
+  // the bounce buffer is taken from the heap, this runs on the stack of the exec*() caller (threads might have small stacks)
+  if ((buf = malloc(COPY_BUFFER_SIZE)) == NULL) return -1;
+
+  while (len > 0) {
+    if ((copied = pread(in_fd, buf, (len < COPY_BUFFER_SIZE) ? len : COPY_BUFFER_SIZE, in_offset)) <= 0) break;
+    if (pwrite(out_fd, buf, copied, out_offset) != copied) break;
+
+    in_offset  += copied;
+    out_offset += copied;
+    len        -= copied;
+  }
+
+  free(buf);
+  return (len == 0) ? 0 : -1;
+}
+
+#define ELF_BITS 32
+#include "./elf-class.h"
+#undef ELF_BITS
+
+#define ELF_BITS 64
+#include "./elf-class.h"
+#undef ELF_BITS
+
+int get_elf_information(const char *exec_path, int exec_fd, const char *head, size_t head_len, off_t size, struct ElfInfo *output) {
+  // get_elf_information(): fill output with the interpreter of an ELF executable, head holds its first head_len bytes,
+  //                        returns -1 if the executable is malformed
+  uint64_t trace_start = trace_now();
+  int      ret         = -1;
+
+  output->is_dyn_exec           = false;
+  output->size                  = size;
+  output->interp_proghdr_offset = 0;
+  output->interpreter[0]        = '\0';
+
+  if (head_len >= EI_NIDENT && memcmp(head, ELFMAG, SELFMAG) == 0) {
+    output->is_64bit = (head[EI_CLASS] == ELFCLASS64);
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: %i-bit ELF executable detected\n", getpid(), PROMPT_NAME, output->is_64bit ? 64 : 32);
+
+    if (output->is_64bit) {
+      ret = parse_program_headers64(exec_fd, head, head_len, output);
+    } else {
+      ret = parse_program_headers32(exec_fd, head, head_len, output);
+    }
+  }
+
+  if (verbose) {
+    if (ret == -1) {
+      fprintf(stderr, "[PID %-7i] %s: Malformed ELF executable %s\n", getpid(), PROMPT_NAME, exec_path);
+    } else if (output->is_dyn_exec) {
+      fprintf(stderr, "[PID %-7i] %s: PT_INTERP section found at offset 0x%llx (%s)\n", getpid(), PROMPT_NAME,
+              (unsigned long long) output->interp_proghdr_offset, output->interpreter);
+    } else {
+      fprintf(stderr, "[PID %-7i] %s: PT_INTERP section not found, probably linked statically\n", getpid(), PROMPT_NAME);
+    }
+  }
+
+  trace_event(TRACE_ELF_INFO, exec_path, trace_start, (ret == -1) ? TRACE_FLAG_FAILED : 0);
+  return ret;
+}
+
+off_t change_elf_interpreter(const char *exec_path, int output_fd, int exec_fd, const struct ElfInfo *elf_info) {
+  // change_elf_interpreter(): see write_patched_executable() in elf-class.h, elf_info must come from get_elf_information()
+  uint64_t trace_start = trace_now();
+  off_t    size;
+
+  if (elf_info->is_64bit) {
+    size = write_patched_executable64(exec_path, output_fd, exec_fd, elf_info);
+  } else {
+    size = write_patched_executable32(exec_path, output_fd, exec_fd, elf_info);
+  }
+
+  trace_event(TRACE_INTERP_REWRITE, exec_path, trace_start, (size == -1) ? TRACE_FLAG_FAILED : 0);
+  return size;
+}
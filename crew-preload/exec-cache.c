@@ -0,0 +1,234 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  exec-cache.c: Persistent store of executables with patched ELF interpreter
+
+  Instead of writing a private copy of every executable into a memfd, patched executables are stored
+  under CREW_PRELOAD_EXEC_CACHE_DIR (default: ${CREW_PREFIX}/var/cache/crew-preload) and executed from there.
+  All processes running the same executable will then share the same page cache pages.
+
+  Cached images are keyed by (st_dev, st_ino, st_size, st_mtim) of the original executable, written into a
+  temporary file (per thread) and then renamed to their final name, so a cached image is either complete or absent.
+
+  Eviction: when the total size of the cache exceeds CREW_PRELOAD_EXEC_CACHE_SIZE (in MiB, default 1024),
+  least recently used images (by mtime, refreshed at most once a day on hit) are removed until the cache
+  shrinks to 3/4 of its limit. Stale images (whose original executable was updated or removed) are never hit
+  again and will be removed by the same mechanism. The image just written by a process is never evicted by that
+  process, and an image evicted by another process before it is executed is replaced by a memfd (see main.c).
+  A size limit of 0 disables the cache.
+*/
+
+#include "./main.h"
+
+#define EXEC_CACHE_REFRESH_INTERVAL (24 * 60 * 60)
+#define EXEC_CACHE_TMPFILE_TIMEOUT  (60 * 60)
+
+struct CacheEntry {
+  char   name[NAME_MAX + 1];
+  off_t  size;
+  time_t mtime;
+};
+
+static int compare_cache_entry(const void *a, const void *b) {
+  const struct CacheEntry *x = a, *y = b;
+  return (x->mtime > y->mtime) - (x->mtime < y->mtime);
+}
+
+static off_t exec_cache_size(void) {
+  // exec_cache_size(): size limit of the cache in bytes, 0 if the cache is disabled
+  return (off_t) strtoul(getenv("CREW_PRELOAD_EXEC_CACHE_SIZE") ?: "1024", NULL, 10) * 1024 * 1024;
+}
+
+static const char *exec_cache_dir(void) {
+  // exec_cache_dir(): the cache directory, created on first use by one thread (NULL for the others meanwhile, they
+  //                   use a memfd instead), NULL if the cache is disabled by CREW_PRELOAD_EXEC_CACHE_SIZE=0
+  static char cache_dir[PATH_MAX];
+  static int  dir_state = 0; // 0: not set up, 1: being set up, 2: ready, 3: disabled
+  struct stat dir_info;
+  int         state     = 0;
+
+  if (!__atomic_compare_exchange_n(&dir_state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    return (state == 2) ? cache_dir : NULL;
+  }
+
+  if (exec_cache_size() == 0) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: CREW_PRELOAD_EXEC_CACHE_SIZE is 0, exec cache disabled\n", getpid(), PROMPT_NAME);
+    __atomic_store_n(&dir_state, 3, __ATOMIC_RELEASE);
+    return NULL;
+  }
+
+  snprintf(cache_dir, sizeof(cache_dir), "%s", getenv("CREW_PRELOAD_EXEC_CACHE_DIR") ?: CREW_PREFIX "/var/cache/crew-preload");
+
+  // create cache directory (and its parents) if it does not exist
+  for (char *p = cache_dir + 1; *p; p++) {
+    if (*p != '/') continue;
+
+    *p = '\0';
+    mkdir(cache_dir, 0755);
+    *p = '/';
+  }
+
+  if (mkdir(cache_dir, 0755) == -1 && errno != EEXIST) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Failed to create exec cache directory %s (%s)\n", getpid(), PROMPT_NAME, cache_dir, strerror(errno));
+    __atomic_store_n(&dir_state, 0, __ATOMIC_RELEASE);
+    return NULL;
+  }
+
+  // refuse to execute anything from a directory that can be modified by someone else
+  if (stat(cache_dir, &dir_info) == -1 || !S_ISDIR(dir_info.st_mode) ||
+      (dir_info.st_uid != geteuid() && dir_info.st_uid != 0) || (dir_info.st_mode & (S_IWGRP | S_IWOTH))) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Exec cache directory %s is unusable, ignoring\n", getpid(), PROMPT_NAME, cache_dir);
+    __atomic_store_n(&dir_state, 0, __ATOMIC_RELEASE);
+    return NULL;
+  }
+
+  __atomic_store_n(&dir_state, 2, __ATOMIC_RELEASE);
+  return cache_dir;
+}
+
+static void exec_cache_evict(const char *cache_dir, const char *keep) {
+  // exec_cache_evict(): remove least recently used images until the cache shrinks to 3/4 of its size limit,
+  //                     except keep (the image about to be executed by the caller)
+  DIR               *dir;
+  struct dirent     *entry;
+  struct CacheEntry *entries     = NULL;
+  size_t            num_entries  = 0,
+                    max_entries  = 0;
+  off_t             total_size   = 0,
+                    max_size     = exec_cache_size();
+  time_t            now          = time(NULL);
+  int               dir_fd;
+
+  if ((dir = opendir(cache_dir)) == NULL) return;
+  dir_fd = dirfd(dir);
+
+  // only one process needs to do this at a time
+  if (flock(dir_fd, LOCK_EX | LOCK_NB) == -1) {
+    closedir(dir);
+    return;
+  }
+
+  while ((entry = readdir(dir))) {
+    struct stat file_info;
+
+    if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) continue;
+    if (__fstatat(dir_fd, entry->d_name, &file_info, AT_SYMLINK_NOFOLLOW) == -1 || !S_ISREG(file_info.st_mode)) continue;
+
+    // remove temporary files left behind by killed processes
+    if (entry->d_name[0] == '.') {
+      if (now - file_info.st_mtime > EXEC_CACHE_TMPFILE_TIMEOUT) unlinkat(dir_fd, entry->d_name, 0);
+      continue;
+    }
+
+    if (num_entries == max_entries) {
+      struct CacheEntry *new_entries = realloc(entries, (max_entries = max_entries * 2 + 64) * sizeof(*entries));
+
+      if (new_entries == NULL) break;
+      entries = new_entries;
+    }
+
+    strncpy(entries[num_entries].name, entry->d_name, NAME_MAX + 1);
+    entries[num_entries].size  = file_info.st_blocks * 512;
+    entries[num_entries].mtime = file_info.st_mtime;
+    total_size                += entries[num_entries++].size;
+  }
+
+  if (total_size > max_size) {
+    qsort(entries, num_entries, sizeof(*entries), compare_cache_entry);
+
+    for (size_t i = 0; i < num_entries && total_size > max_size / 4 * 3; i++) {
+      if (strcmp(entries[i].name, keep) == 0) continue;
+
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: Evicting %s from exec cache\n", getpid(), PROMPT_NAME, entries[i].name);
+      if (unlinkat(dir_fd, entries[i].name, 0) == 0) total_size -= entries[i].size;
+    }
+  }
+
+  free(entries);
+  closedir(dir);
+}
+
+static int exec_cache_path(const char *cache_dir, const struct FileId *id, char *cache_path) {
+  int len = snprintf(cache_path, PATH_MAX, "%s/%jx-%jx-%jx-%jx.%jx", cache_dir,
+                     (uintmax_t) id->dev, (uintmax_t) id->ino, (uintmax_t) id->size,
+                     (uintmax_t) id->mtime_sec, (uintmax_t) id->mtime_nsec);
+
+  return (len < PATH_MAX) ? 0 : -1;
+}
+
+int exec_cache_lookup(char *exec_path, const struct FileId *id) {
+  // exec_cache_lookup(): replace exec_path with the path of a cached copy of the executable that uses Chromebrew's
+  //                      dynamic linker if there is one
+  //
+  //                      returns 0 on success, -1 if the executable is not cached
+  const char  *cache_dir = exec_cache_dir();
+  char        cache_path[PATH_MAX];
+  struct stat cache_info;
+
+  if (cache_dir == NULL || exec_cache_path(cache_dir, id, cache_path) == -1) return -1;
+
+  // a partially written image would never have been renamed, but still check its size just in case
+  if (stat(cache_path, &cache_info) == -1 || cache_info.st_size < (off_t) (id->size + sizeof(CREW_GLIBC_INTERPRETER))) return -1;
+
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: Exec cache hit for %s (%s)\n", getpid(), PROMPT_NAME, exec_path, cache_path);
+  stats_add(STAT_EXEC_CACHE_HITS, 1);
+
+  // refresh mtime occasionally so that frequently used images won't be evicted
+  if (time(NULL) - cache_info.st_mtime > EXEC_CACHE_REFRESH_INTERVAL) utimensat(AT_FDCWD, cache_path, NULL, 0);
+
+  strncpy(exec_path, cache_path, PATH_MAX);
+  return 0;
+}
+
+int exec_cache_store(char *exec_path, int exec_fd, const struct FileId *id, const struct ElfInfo *elf_info) {
+  // exec_cache_store(): write a copy of the executable that uses Chromebrew's dynamic linker into the cache,
+  //                     exec_path will be replaced with the path of the cached copy
+  //
+  //                     returns 0 on success, -1 if the executable cannot be served from cache
+  const char  *cache_dir = exec_cache_dir();
+  char        cache_path[PATH_MAX], tmp_path[PATH_MAX];
+  off_t       cached_size;
+  struct stat cache_info;
+  bool        written;
+  int         fd;
+
+  if (cache_dir == NULL || exec_cache_path(cache_dir, id, cache_path) == -1) return -1;
+
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: Exec cache miss for %s, writing %s...\n", getpid(), PROMPT_NAME, exec_path, cache_path);
+
+  // threads of one process might store the same executable at the same time
+  if (snprintf(tmp_path, sizeof(tmp_path), "%s/.tmp-%i-%li-%s", cache_dir, getpid(), (long) syscall(SYS_gettid),
+               basename(cache_path)) >= (int) sizeof(tmp_path)) {
+    return -1;
+  }
+
+  if ((fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0755)) == -1) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Failed to create %s (%s)\n", getpid(), PROMPT_NAME, tmp_path, strerror(errno));
+    return -1;
+  }
+
+  cached_size = change_elf_interpreter(exec_path, fd, exec_fd, elf_info);
+  written     = (cached_size != -1 && fstat(fd, &cache_info) == 0 && cache_info.st_size == cached_size);
+
+  // the file must be closed before executing it, otherwise execve() will fail with ETXTBSY
+  if (close(fd) == -1 || !written || rename(tmp_path, cache_path) == -1) {
+    fprintf(stderr, "[PID %-7i] %s: Failed to write %s\n", getpid(), PROMPT_NAME, cache_path);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  stats_add(STAT_EXEC_CACHE_STORES, 1);
+  stats_add(STAT_EXEC_CACHE_BYTES, cached_size);
+
+  exec_cache_evict(cache_dir, basename(cache_path));
+
+  strncpy(exec_path, cache_path, PATH_MAX);
+  return 0;
+}
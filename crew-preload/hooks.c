@@ -24,17 +24,25 @@ __attribute__ ((visibility("default"))) int posix_spawnp(pid_t *pid, const char
                                                          const posix_spawn_file_actions_t *file_actions,
                                                          const posix_spawnattr_t *attrp,
                                                          char *const *argv, char *const *envp);
+__attribute__ ((visibility("default"))) int system(const char *command);
+__attribute__ ((visibility("default"))) FILE *popen(const char *command, const char *mode);
+__attribute__ ((visibility("default"))) int pclose(FILE *stream);
+__attribute__ ((visibility("default"))) pid_t wait(int *status);
+__attribute__ ((visibility("default"))) pid_t waitpid(pid_t pid, int *status, int options);
+__attribute__ ((visibility("default"))) pid_t wait3(int *status, int options, struct rusage *usage);
+__attribute__ ((visibility("default"))) pid_t wait4(pid_t pid, int *status, int options, struct rusage *usage);
+__attribute__ ((visibility("default"))) int waitid(idtype_t idtype, id_t id, siginfo_t *info, int options);
 
 int execl(const char *path, const char *arg, ...) {
   char    **argv;
   int     argc;
   va_list argp;
 
-  if (!initialized) preload_init();
+  exec_init_once();
 
   va_start(argp, arg);
   argc    = count_args(argp);
-  argv    = alloca(argc * sizeof(char *));
+  argv    = alloca((argc + 1) * sizeof(char *));
   argv[0] = (char *) arg;
 
   va2array(argp, argc, argv);
@@ -48,11 +56,11 @@ int execle(const char *path, const char *arg, ...) {
   int     argc;
   va_list argp;
 
-  if (!initialized) preload_init();
+  exec_init_once();
 
   va_start(argp, arg);
   argc    = count_args(argp);
-  argv    = alloca(argc * sizeof(char *));
+  argv    = alloca((argc + 1) * sizeof(char *));
   argv[0] = (char *) arg;
 
   va2array(argp, argc, argv);
@@ -67,11 +75,11 @@ int execlp(const char *path, const char *arg, ...) {
   int     argc;
   va_list argp;
 
-  if (!initialized) preload_init();
+  exec_init_once();
 
   va_start(argp, arg);
   argc    = count_args(argp);
-  argv    = alloca(argc * sizeof(char *));
+  argv    = alloca((argc + 1) * sizeof(char *));
   argv[0] = (char *) arg;
 
   va2array(argp, argc, argv);
@@ -81,22 +89,22 @@ int execlp(const char *path, const char *arg, ...) {
 }
 
 int execv(const char *path, char *const *argv) {
-  if (!initialized) preload_init();
+  exec_init_once();
   return exec_wrapper(path, argv, environ, false, NULL, NULL, NULL);
 }
 
 int execve(const char *path, char *const *argv, char *const *envp) {
-  if (!initialized) preload_init();
+  exec_init_once();
   return exec_wrapper(path, argv, envp, false, NULL, NULL, NULL);
 }
 
 int execvp(const char *file, char *const *argv) {
-  if (!initialized) preload_init();
+  exec_init_once();
   return exec_wrapper(file, argv, environ, true, NULL, NULL, NULL);
 }
 
 int execvpe(const char *file, char *const *argv, char *const *envp) {
-  if (!initialized) preload_init();
+  exec_init_once();
   return exec_wrapper(file, argv, envp, true, NULL, NULL, NULL);
 }
 
@@ -104,7 +112,7 @@ int posix_spawn(pid_t *pid, const char *path,
                 const posix_spawn_file_actions_t *file_actions,
                 const posix_spawnattr_t *attrp,
                 char *const *argv, char *const *envp) {
-  if (!initialized) preload_init();
+  exec_init_once();
   return exec_wrapper(path, argv, envp, false, pid, file_actions, attrp);
 }
 
@@ -112,6 +120,46 @@ int posix_spawnp(pid_t *pid, const char *file,
                  const posix_spawn_file_actions_t *file_actions,
                  const posix_spawnattr_t *attrp,
                  char *const *argv, char *const *envp) {
-  if (!initialized) preload_init();
+  exec_init_once();
   return exec_wrapper(file, argv, envp, true, pid, file_actions, attrp);
 }
+
+int system(const char *command) {
+  exec_init_once();
+  return system_wrapper(command);
+}
+
+FILE *popen(const char *command, const char *mode) {
+  exec_init_once();
+  return popen_wrapper(command, mode);
+}
+
+int pclose(FILE *stream) {
+  exec_init_once();
+  return pclose_wrapper(stream);
+}
+
+pid_t wait(int *status) {
+  exec_init_once();
+  return account_wait4(-1, status, 0, NULL);
+}
+
+pid_t waitpid(pid_t pid, int *status, int options) {
+  exec_init_once();
+  return account_wait4(pid, status, options, NULL);
+}
+
+pid_t wait3(int *status, int options, struct rusage *usage) {
+  exec_init_once();
+  return account_wait4(-1, status, options, usage);
+}
+
+pid_t wait4(pid_t pid, int *status, int options, struct rusage *usage) {
+  exec_init_once();
+  return account_wait4(pid, status, options, usage);
+}
+
+int waitid(idtype_t idtype, id_t id, siginfo_t *info, int options) {
+  exec_init_once();
+  return account_waitid(idtype, id, info, options);
+}
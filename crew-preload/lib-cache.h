@@ -0,0 +1,63 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  lib-cache.h: Layout of the crew library cache, written by tools/crew-preload-ldconfig.c and read by Chromebrew's
+               dynamic linker (../patches/0005-*.patch, elf/dl-crew-cache.h has a copy of this layout)
+
+  The cache lists the contents of the library directories under CREW_PREFIX (lib, lib64...), so that the dynamic
+  linker can skip a directory of a search path (LD_LIBRARY_PATH, RUNPATH, default directories) without trying to
+  open a library in it when the library is not there. The search order itself is left untouched.
+
+  A directory is only trusted while its modification time matches the one recorded here (checked once per process),
+  so installing or removing a library without updating the cache only makes the dynamic linker fall back to the
+  usual search for that directory.
+
+    | struct LibCacheHeader | struct LibCacheDir[num_dirs] | struct LibCacheEntry[num_entries] | strings |
+
+  Entries are sorted by name (strcmp() order), strings are NUL-terminated.
+*/
+
+#ifndef LIB_CACHE_H_INCLUDED
+#define LIB_CACHE_H_INCLUDED
+
+#include <stdint.h>
+
+#define LIB_CACHE_MAGIC    0x43524c43 // "CRLC"
+#define LIB_CACHE_VERSION  1
+#define LIB_CACHE_MAX_DIRS 32         // one bit per directory in struct LibCacheEntry
+
+// default location, relative to CREW_PREFIX
+#define LIB_CACHE_PATH     "/etc/ld.so.crew-cache"
+
+// all fields have fixed size as the cache is shared between 32-bit and 64-bit processes
+struct LibCacheHeader {
+  uint32_t magic,
+           version,
+           num_dirs,
+           num_entries,
+           strings_offset,
+           strings_size,
+           padding[2];
+};
+
+struct LibCacheDir {
+  uint32_t name_offset, // directory name with a trailing slash, as in the dynamic linker's search paths
+           name_len;
+  int64_t  mtime_sec;   // st_mtim of the directory before it was read
+  uint32_t mtime_nsec,
+           padding;
+};
+
+struct LibCacheEntry {
+  uint32_t name_offset,
+           dirs;        // bit n set: file exists in directory n
+};
+
+#endif
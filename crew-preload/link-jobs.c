@@ -0,0 +1,219 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  link-jobs.c: Limit concurrent linkers (CREW_PRELOAD_ENABLE_COMPILE_HACKS only)
+
+  mold uses a thread per core by default, so the link phase of `make -jN` runs N linkers with N threads each, which
+  runs small devices out of memory. Every linker executed through exec_wrapper() therefore:
+
+    - takes one of CREW_PRELOAD_LINK_JOBS slots first (default: one per 2 GiB of RAM, at most one per core). If all
+      of them are taken, all slots are tried again after a short sleep (growing from 1 ms to 100 ms), so that the
+      first one released is taken. Slots are open file description locks on bytes of a file in /dev/shm, the
+      descriptor is close-on-exec and only inherited by the linker (see link_jobs_spawn(), exec_final() in main.c),
+      so the slot is held until the linker (and everything it forked) has exited, even if it was killed, and not by
+      other children spawned meanwhile. CREW_PRELOAD_LINK_JOBS=0 disables this
+
+    - gets --threads=<cores / slots> (mold only, unless it was given a thread count already), reduced to one thread
+      plus the number of idle jobs if it runs under a GNU make jobserver (--jobserver-auth=R,W or fifo:PATH in
+      MAKEFLAGS). Idle jobs are only counted (FIONREAD), not taken from the jobserver: they would never be returned
+      if the linker is killed
+*/
+
+#include "./main.h"
+#include <sys/ioctl.h>
+#include <sys/sysinfo.h>
+
+#define LINK_MEMORY_PER_JOB   (2ull << 30)
+#define LINK_SLOT_POLL_MIN_NS 1000000
+#define LINK_SLOT_POLL_MAX_NS 100000000
+
+static int link_slot_count(int cores) {
+  // link_slot_count(): CREW_PRELOAD_LINK_JOBS, or one slot per LINK_MEMORY_PER_JOB of RAM (at least one, at most one per core)
+  const char     *jobs_env = getenv("CREW_PRELOAD_LINK_JOBS");
+  struct sysinfo info;
+  uint64_t       slots;
+
+  if (jobs_env && jobs_env[0]) return atoi(jobs_env);
+  if (sysinfo(&info) == -1) return cores;
+
+  slots = (uint64_t) info.totalram * info.mem_unit / LINK_MEMORY_PER_JOB;
+
+  return (slots < 1) ? 1 : (slots > (uint64_t) cores) ? cores : (int) slots;
+}
+
+static int idle_make_jobs(char *const *envp) {
+  // idle_make_jobs(): number of tokens available in the jobserver of our make, -1 if there is none
+  const char  *makeflags = getenvfp((char **) envp, "MAKEFLAGS"), *auth = NULL, *next;
+  char        fifo_path[PATH_MAX];
+  struct stat fd_info;
+  int         fd, tokens = -1;
+
+  if (makeflags == NULL) return -1;
+
+  // make uses the last one if there are several
+  for (next = makeflags; (next = strstr(next, "--jobserver-")); next++) {
+    if (strncmp(next, "--jobserver-auth=", 17) == 0) auth = next + 17;
+    if (strncmp(next, "--jobserver-fds=", 16) == 0) auth = next + 16;
+  }
+
+  if (auth == NULL) return -1;
+
+  if (strncmp(auth, "fifo:", 5) == 0) {
+    snprintf(fifo_path, sizeof(fifo_path), "%.*s", (int) strcspn(auth + 5, " "), auth + 5);
+
+    if ((fd = open(fifo_path, O_RDONLY | O_NONBLOCK | O_CLOEXEC)) == -1) return -1;
+    if (ioctl(fd, FIONREAD, &tokens) == -1) tokens = -1;
+
+    close(fd);
+    return tokens;
+  }
+
+  // make does not pass the pipe to commands that are not sub-makes, the descriptor might be something else by now
+  fd = atoi(auth);
+  if (fd < 0 || fstat(fd, &fd_info) == -1 || !S_ISFIFO(fd_info.st_mode)) return -1;
+  if (ioctl(fd, FIONREAD, &tokens) == -1) return -1;
+
+  return tokens;
+}
+
+static int open_slot_file(void) {
+  // open_slot_file(): the file slots are locked in
+  char        slot_path[64];
+  struct stat slot_info;
+  int         fd;
+
+  snprintf(slot_path, sizeof(slot_path), "/dev/shm/crew-preload-link-slots.%i", geteuid());
+
+  if ((fd = open(slot_path, O_RDWR | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0600)) == -1) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Failed to open link slots %s (%s)\n", getpid(), PROMPT_NAME, slot_path, strerror(errno));
+    return -1;
+  }
+
+  if (fstat(fd, &slot_info) == -1 || !S_ISREG(slot_info.st_mode) || slot_info.st_uid != geteuid()) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Link slots %s are unusable, ignoring\n", getpid(), PROMPT_NAME, slot_path);
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int lock_any_slot(int fd, int slots, int start) {
+  // lock_any_slot(): try to lock each slot once, beginning with start; returns 0 if one was locked, 1 if all of them
+  //                  are taken, -1 on error (no open file description locks before Linux 3.15)
+  for (int i = 0; i < slots; i++) {
+    struct flock lock = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = (start + i) % slots, .l_len = 1 };
+    int          ret;
+
+    while ((ret = fcntl(fd, F_OFD_SETLK, &lock)) == -1 && errno == EINTR);
+
+    if (ret == 0) return 0;
+    if (errno != EAGAIN && errno != EACCES) return -1;
+  }
+
+  return 1;
+}
+
+int link_jobs_acquire(char *const *argv, char *const *envp, int *threads) {
+  // link_jobs_acquire(): take a link slot for a linker about to be executed, returns the descriptor holding it (to be
+  //                      closed once the linker has been spawned, or if exec*() failed) or -1, threads receives the
+  //                      thread count to pass to mold (0 to leave it alone)
+  int             cores    = sysconf(_SC_NPROCESSORS_ONLN), slots = link_slot_count(cores), start, idle, fd, ret;
+  long            delay_ns = LINK_SLOT_POLL_MIN_NS;
+  struct timespec wait_start, wait_end;
+
+  *threads = 0;
+  if (slots <= 0 || cores <= 0 || (fd = open_slot_file()) == -1) return -1;
+
+  // start looking at a different slot in every process, so that waiters spread over the slots
+  start = getpid() % slots;
+
+  if ((ret = lock_any_slot(fd, slots, start)) == 1) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: All %i link slots are taken, waiting...\n", getpid(), PROMPT_NAME, slots);
+
+    clock_gettime(CLOCK_MONOTONIC, &wait_start);
+
+    // waiting for one particular slot could wait for the longest running linker, whichever is released first is taken
+    do {
+      struct timespec delay = { .tv_sec = 0, .tv_nsec = delay_ns };
+
+      nanosleep(&delay, NULL);
+      delay_ns = (delay_ns * 2 < LINK_SLOT_POLL_MAX_NS) ? delay_ns * 2 : LINK_SLOT_POLL_MAX_NS;
+    } while ((ret = lock_any_slot(fd, slots, start)) == 1);
+
+    clock_gettime(CLOCK_MONOTONIC, &wait_end);
+    stats_add(STAT_LINK_SLOT_WAITS, 1);
+    stats_add(STAT_LINK_SLOT_WAIT_NS, (wait_end.tv_sec - wait_start.tv_sec) * 1000000000ull + wait_end.tv_nsec - wait_start.tv_nsec);
+  }
+
+  if (ret == -1) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Failed to lock link slot (%s), not limiting linkers\n", getpid(), PROMPT_NAME, strerror(errno));
+    close(fd);
+    return -1;
+  }
+
+  for (char *const *arg = argv; arg && *arg; arg++) {
+    if (strncmp(*arg, "--threads", 9) == 0 || strncmp(*arg, "-threads", 8) == 0 ||
+        strcmp(*arg, "--no-threads") == 0 || strncmp(*arg, "--thread-count", 14) == 0) {
+      return fd;
+    }
+  }
+
+  *threads = (cores / slots > 1) ? cores / slots : 1;
+  if ((idle = idle_make_jobs(envp)) != -1 && *threads > idle + 1) *threads = idle + 1;
+
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: Got a link slot (%i slots, %i idle make jobs), linker threads: %i\n",
+                       getpid(), PROMPT_NAME, slots, idle, *threads);
+
+  return fd;
+}
+
+int link_jobs_spawn(int slot_fd, pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                    const posix_spawnattr_t *attrp, char *const *argv, char *const *envp) {
+  // link_jobs_spawn(): posix_spawn() the linker so that it inherits the (close-on-exec) link slot, through the public
+  //                    posix_spawn_file_actions_*() functions only, as the layout of posix_spawn_file_actions_t is
+  //                    private to the glibc we are loaded into:
+  //
+  //                    - without file actions: a dup2() of the slot onto a close-on-exec duplicate, which the linker
+  //                      inherits without the flag (dup2() onto the same descriptor does not clear it before glibc 2.29)
+  //                    - with file actions (which cannot be copied, and might be used by other threads meanwhile): a
+  //                      duplicate without close-on-exec, closed once the linker has been spawned. A child forked by
+  //                      another thread in the meantime holds the slot too, until it executes or exits
+  posix_spawn_file_actions_t actions;
+  int                        inherit_fd, ret;
+
+  if (file_actions) {
+    if ((inherit_fd = dup(slot_fd)) == -1) {
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: Cannot hand the link slot to the linker, not limiting it\n", getpid(), PROMPT_NAME);
+      return orig_posix_spawn(pid, path, file_actions, attrp, argv, envp);
+    }
+
+    ret = orig_posix_spawn(pid, path, file_actions, attrp, argv, envp);
+    close(inherit_fd);
+    return ret;
+  }
+
+  if ((inherit_fd = fcntl(slot_fd, F_DUPFD_CLOEXEC, 0)) == -1 || posix_spawn_file_actions_init(&actions) != 0) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Cannot hand the link slot to the linker, not limiting it\n", getpid(), PROMPT_NAME);
+    if (inherit_fd != -1) close(inherit_fd);
+    return orig_posix_spawn(pid, path, NULL, attrp, argv, envp);
+  }
+
+  if (posix_spawn_file_actions_adddup2(&actions, slot_fd, inherit_fd) == 0) {
+    ret = orig_posix_spawn(pid, path, &actions, attrp, argv, envp);
+  } else {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Cannot hand the link slot to the linker, not limiting it\n", getpid(), PROMPT_NAME);
+    ret = orig_posix_spawn(pid, path, NULL, attrp, argv, envp);
+  }
+
+  posix_spawn_file_actions_destroy(&actions);
+  close(inherit_fd);
+  return ret;
+}
@@ -20,62 +20,81 @@
 
   This wrapper does the following things:
     - Fix hardcoded shebang/command path (e.g `#!/usr/bin/perl` will be converted to `#!${CREW_PREFIX}/bin/perl`)
+    - Run `#!/usr/bin/env <command>` scripts with <command> directly, without executing env
     - Unset LD_LIBRARY_PATH before running any system commands (executables located under /{bin,sbin} or /usr/{bin,sbin})
-    - Redirect /bin/{bash,sh,coreutils} to ${CREW_PREFIX}/bin/{bash,sh,coreutils} instead (unless CREW_PRELOAD_NO_CREW_CMD=1)
-    - Run all dynamically linked executables with Chromebrew's glibc/dynamic linker (unless CREW_PRELOAD_NO_CREW_GLIBC=1)
+    - Redirect /bin/{bash,sh}, /usr/bin/{perl,python3,...} to ${CREW_PREFIX}/bin instead (unless CREW_PRELOAD_NO_CREW_CMD=1)
+    - Run all dynamically linked executables with Chromebrew's glibc/dynamic linker (unless CREW_PRELOAD_NO_CREW_GLIBC=1),
+      patched executables are shared between processes via a persistent cache (unless CREW_PRELOAD_NO_EXEC_CACHE=1),
+      or run as arguments of the dynamic linker (CREW_PRELOAD_EXEC_MODE=loader)
+    - Run simple system()/popen() commands without /bin/sh (unless CREW_PRELOAD_NO_SHELL_BYPASS=1, see shell.c)
+
+  Which paths are redirected/treated as system commands is defined by rewrite rules (see default.rules and rules.c).
 
   If CREW_PRELOAD_ENABLE_COMPILE_HACKS is set, this wrapper will also:
     - Append --dynamic-linker flag to linker commend
     - Replace linker command with mold (can be disabled with CREW_PRELOAD_NO_MOLD)
+    - Limit concurrent linkers and the threads of mold (see link-jobs.c)
 
   Usage: LD_PRELOAD=crew-preload.so <command>
 
-  For armv7l/i686/x86_64:
-
-    cc -Wall -Wextra -Wundef -O3 -fPIC -shared -fvisibility=hidden -Wl,-soname,crew-preload.so \
-      -DCREW_PREFIX=\"...\" -DCREW_GLIBC_PREFIX=\"...\" -DCREW_GLIBC_INTERPRETER=\"...\" \
-      ../prebuilt/<ARCH>/lib{c,dl}-*.so* main.c hooks.c -o crew-preload.so
+  Building (see Makefile for the underlying compiler commands):
 
-  For aarch64:
-
-    cc -Wall -Wextra -Wundef -O3 -fPIC -shared -fvisibility=hidden -Wl,-soname,crew-preload.so \
-      -DCREW_PREFIX=\"...\" -DCREW_GLIBC_PREFIX=\"...\" -DCREW_GLIBC_INTERPRETER=\"...\" \
-      -lc -ldl main.c hooks.c -o crew-preload.so
+    make CREW_PREFIX=... CREW_GLIBC_PREFIX=... CREW_GLIBC_INTERPRETER=...
 */
 
 #include "./main.h"
-
-bool  compile_hacks = false,
-      disabled      = false,
-      initialized   = false,
-      no_crew_cmd   = false,
-      no_crew_glibc = false,
-      no_mold       = false,
-      verbose       = false;
-pid_t pid           = 0;
-
-struct utsname kernel_info;
-
-const char *cmd_override_list[] = {
-  "/bin/bash",
-  "/bin/sh",
-  "/usr/bin/coreutils"
+#include <sched.h>
+#include <signal.h>
+
+bool  compile_hacks     = false,
+      disabled          = false,
+      initialized       = false,
+      no_crew_cmd       = false,
+      no_crew_glibc     = false,
+      no_decision_cache = false,
+      no_exec_cache     = false,
+      no_mold           = false,
+      no_shell_bypass   = false,
+      loader_exec       = false,
+      verbose           = false;
+
+// process whose thread is running exec_init(), see exec_init()
+static pid_t init_owner = 0;
+
+// whether CREW_GLIBC_INTERPRETER understands --argv0 (see loader_supports_argv0()), -1 if not probed yet
+static int loader_argv0 = -1;
+
+// boolean options, in the order of their bits in CREW_PRELOAD_FLAGS (see load_options())
+enum PreloadOption {
+  OPTION_DISABLED,
+  OPTION_ENABLE_COMPILE_HACKS,
+  OPTION_NO_CREW_CMD,
+  OPTION_NO_CREW_GLIBC,
+  OPTION_NO_DECISION_CACHE,
+  OPTION_NO_EXEC_CACHE,
+  OPTION_NO_MOLD,
+  OPTION_VERBOSE,
+  OPTION_EXEC_MODE_LOADER,
+  OPTION_NO_SHELL_BYPASS,
+  OPTION_MAX
 };
 
-const char *linkers[] = {
-  "ld",
-  "ld.bfd",
-  "ld.gold",
-  "ld.lld",
-  "ld.mold",
-  "mold"
-};
-
-const char *system_exe_path[] = {
-  "/usr/bin/",
-  "/usr/sbin/",
-  "/bin/",
-  "/sbin/"
+// result of the loader probe, handed down in CREW_PRELOAD_FLAGS next to the options so that it runs once per process tree
+#define FLAG_LOADER_PROBED (1u << 30)
+#define FLAG_LOADER_ARGV0  (1u << 31)
+
+// options are set by NAME=1 unless a value is given here
+static const char option_names[OPTION_MAX][40] = {
+  "CREW_PRELOAD_DISABLED",
+  "CREW_PRELOAD_ENABLE_COMPILE_HACKS",
+  "CREW_PRELOAD_NO_CREW_CMD",
+  "CREW_PRELOAD_NO_CREW_GLIBC",
+  "CREW_PRELOAD_NO_DECISION_CACHE",
+  "CREW_PRELOAD_NO_EXEC_CACHE",
+  "CREW_PRELOAD_NO_MOLD",
+  "CREW_PRELOAD_VERBOSE",
+  "CREW_PRELOAD_EXEC_MODE=loader",
+  "CREW_PRELOAD_NO_SHELL_BYPASS"
 };
 
 int (*orig_execl)(const char *path, const char *arg, ...);
@@ -93,20 +112,107 @@ int (*orig_posix_spawnp)(pid_t *pid, const char *file,
                          const posix_spawn_file_actions_t *file_actions,
                          const posix_spawnattr_t *attrp,
                          char *const *argv, char *const *envp);
+int  (*orig_system)(const char *command);
+FILE *(*orig_popen)(const char *command, const char *mode);
+int  (*orig_pclose)(FILE *stream);
+pid_t (*orig_waitpid)(pid_t pid, int *status, int options);
+pid_t (*orig_wait4)(pid_t pid, int *status, int options, struct rusage *usage);
+int   (*orig_waitid)(idtype_t idtype, id_t id, siginfo_t *info, int options);
+
+static uint32_t options_from_env(char **envp) {
+  // options_from_env(): parse CREW_PRELOAD_* options in envp into a bit mask of enum PreloadOption
+  uint32_t options = 0;
+
+  for (int i = 0; envp && envp[i]; i++) {
+    // skip everything that cannot be one of our options quickly
+    if (strncmp(envp[i], "CREW_PRELOAD_", 13) != 0) continue;
+
+    for (int opt = 0; opt < OPTION_MAX; opt++) {
+      const char *value   = strchr(option_names[opt], '=');
+      int        name_len = value ? value - option_names[opt] : (int) strlen(option_names[opt]);
+
+      if (strncmp(envp[i], option_names[opt], name_len) == 0 && envp[i][name_len] == '=') {
+        if (strcmp(envp[i] + name_len + 1, value ? value + 1 : "1") == 0) options |= (1 << opt);
+        break;
+      }
+    }
+  }
+
+  return options;
+}
+
+static void load_options(void) {
+  // load_options(): use the options handed down by our parent in CREW_PRELOAD_FLAGS if possible (see exec_wrapper_impl()),
+  //                 parse all CREW_PRELOAD_* variables otherwise
+  const char *flags  = getenv("CREW_PRELOAD_FLAGS");
+  char       *end;
+  uint32_t   options;
+
+  if (flags == NULL || flags[0] == '\0' || (options = strtoul(flags, &end, 16), *end != '\0')) options = options_from_env(environ);
+
+  disabled          = options & (1 << OPTION_DISABLED);
+  compile_hacks     = options & (1 << OPTION_ENABLE_COMPILE_HACKS);
+  no_crew_cmd       = options & (1 << OPTION_NO_CREW_CMD);
+  no_crew_glibc     = options & (1 << OPTION_NO_CREW_GLIBC);
+  no_decision_cache = options & (1 << OPTION_NO_DECISION_CACHE);
+  no_exec_cache     = options & (1 << OPTION_NO_EXEC_CACHE);
+  no_mold           = options & (1 << OPTION_NO_MOLD);
+  verbose           = options & (1 << OPTION_VERBOSE);
+  loader_exec       = options & (1 << OPTION_EXEC_MODE_LOADER);
+  no_shell_bypass   = options & (1 << OPTION_NO_SHELL_BYPASS);
+
+  if (options & FLAG_LOADER_PROBED) loader_argv0 = !!(options & FLAG_LOADER_ARGV0);
+}
 
 void preload_init(void) {
-  char *old_library_path = getenv("CREW_PRELOAD_LIBRARY_PATH");
+  // preload_init(): runs in every process started with this wrapper, most of them never call exec*(),
+  //                 so everything only needed by the hooks is left to exec_init()
+  char            *old_library_path = getenv("CREW_PRELOAD_LIBRARY_PATH");
+  struct timespec init_start;
 
-  if (uname(&kernel_info) == -1) fprintf(stderr, "[PID %-7i] %s: uname() failed (%s)\n", pid, PROMPT_NAME, strerror(errno));
+  stats_init_begin(&init_start);
+  trace_init_begin();
 
-  if (strcmp(getenv("CREW_PRELOAD_DISABLED") ?: "0", "1") == 0)             disabled      = true;
-  if (strcmp(getenv("CREW_PRELOAD_ENABLE_COMPILE_HACKS") ?: "0", "1") == 0) compile_hacks = true;
-  if (strcmp(getenv("CREW_PRELOAD_NO_CREW_CMD") ?: "0", "1") == 0)          no_crew_cmd   = true;
-  if (strcmp(getenv("CREW_PRELOAD_NO_CREW_GLIBC") ?: "0", "1") == 0)        no_crew_glibc = true;
-  if (strcmp(getenv("CREW_PRELOAD_NO_MOLD") ?: "0", "1") == 0)              no_mold       = true;
-  if (strcmp(getenv("CREW_PRELOAD_VERBOSE") ?: "0", "1") == 0)              verbose       = true;
+  // restore LD_LIBRARY_PATH from CREW_PRELOAD_LIBRARY_PATH if it was unset previously by LD_PRELOAD in the parent process
+  if (old_library_path) {
+    load_options();
+
+    if (!disabled) {
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: LD_LIBRARY_PATH restored (%s)\n", getpid(), PROMPT_NAME, old_library_path);
+
+      setenv("LD_LIBRARY_PATH", old_library_path, true);
+      unsetenv("CREW_PRELOAD_LIBRARY_PATH");
+    }
+  }
+
+  stats_init_end(&init_start);
+  trace_init_end();
+}
+
+void exec_init(void) {
+  // exec_init(): called by the hooks on first use (see exec_init_once()), runs once per process: threads that come in
+  //              while another thread is initializing wait for it, a claim inherited through fork() from a thread
+  //              that was initializing in the parent is taken over. Signals are blocked meanwhile, so that a handler
+  //              calling waitpid() cannot wait for the thread it interrupted
+  pid_t    self  = getpid(),
+           owner = 0;
+  sigset_t all_signals, old_mask;
+
+  while (!__atomic_compare_exchange_n(&init_owner, &owner, self, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+    if (owner == self) {
+      while (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE)) sched_yield();
+      return;
+    }
+  }
+
+  sigfillset(&all_signals);
+  sigprocmask(SIG_BLOCK, &all_signals, &old_mask);
+
+  load_options();
+
+  // the rule table is needed by every exec*(), load it now rather than racing for it later
+  rules_checksum();
 
-  pid               = getpid();
   orig_execl        = dlsym(RTLD_NEXT, "execl");
   orig_execle       = dlsym(RTLD_NEXT, "execle");
   orig_execlp       = dlsym(RTLD_NEXT, "execlp");
@@ -116,22 +222,27 @@ void preload_init(void) {
   orig_execvpe      = dlsym(RTLD_NEXT, "execvpe");
   orig_posix_spawn  = dlsym(RTLD_NEXT, "posix_spawn");
   orig_posix_spawnp = dlsym(RTLD_NEXT, "posix_spawnp");
-  initialized       = true;
+  orig_system       = dlsym(RTLD_NEXT, "system");
+  orig_popen        = dlsym(RTLD_NEXT, "popen");
+  orig_pclose       = dlsym(RTLD_NEXT, "pclose");
+  orig_waitpid      = dlsym(RTLD_NEXT, "waitpid");
+  orig_wait4        = dlsym(RTLD_NEXT, "wait4");
+  orig_waitid       = dlsym(RTLD_NEXT, "waitid");
 
-  if (verbose) fprintf(stderr, "[PID %-7i] %s: Running on %s kernel, glibc version %s\n", pid, PROMPT_NAME, kernel_info.machine, gnu_get_libc_version());
+  if (verbose) {
+    struct utsname kernel_info;
 
-  if (disabled) {
-    fprintf(stderr, "[PID %-7i] %s: Disabled via environment variable\n", pid, PROMPT_NAME);
-    return;
+    if (uname(&kernel_info) == -1) {
+      fprintf(stderr, "[PID %-7i] %s: uname() failed (%s)\n", self, PROMPT_NAME, strerror(errno));
+    } else {
+      fprintf(stderr, "[PID %-7i] %s: Running on %s kernel, glibc version %s\n", self, PROMPT_NAME, kernel_info.machine, gnu_get_libc_version());
+    }
   }
 
-  // restore LD_LIBRARY_PATH from CREW_PRELOAD_LIBRARY_PATH if it was unset previously by LD_PRELOAD in the parent process
-  if (old_library_path) {
-    if (verbose) fprintf(stderr, "[PID %-7i] %s: LD_LIBRARY_PATH restored (%s)\n", pid, PROMPT_NAME, old_library_path);
+  if (disabled) fprintf(stderr, "[PID %-7i] %s: Disabled via environment variable\n", self, PROMPT_NAME);
 
-    setenv("LD_LIBRARY_PATH", old_library_path, true);
-    unsetenv("CREW_PRELOAD_LIBRARY_PATH");
-  }
+  __atomic_store_n(&initialized, true, __ATOMIC_RELEASE);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
 }
 
 int count_args(va_list argp) {
@@ -153,237 +264,518 @@ void va2array(va_list argp, int argc, char **argv) {
   argv[argc] = va_arg(argp, void *);
 }
 
+int count_array(char * const* array) {
+  // count_array(): count number of elements in a NULL-terminated array
+  int i = 0;
+
+  while (array && array[i]) i++;
+  return i;
+}
+
 int copy2array(char * const* src, char **dest, int offset) {
-  // copy2array(): copy all elements from src[i] to dest[offset + i]
+  // copy2array(): copy all element pointers from src[i] to dest[offset + i] (strings are not duplicated),
+  //               returns the number of elements in dest
   int i;
 
-  for (i = 0; src[i] != NULL; i++) dest[offset + i] = strdup(src[i]);
+  for (i = 0; src && src[i] != NULL; i++) dest[offset + i] = src[i];
   dest[offset + i] = NULL;
 
-  return i;
+  return offset + i;
 }
 
-int search_in_path(const char *file, char *result) {
-  // search_in_path: search given filename in PATH environment variable,
-  //                 full path will be written to the memory address that is pointed by the `result` pointer
-  const char *path_env;
-  char       cs_path[PATH_MAX * 32], *search_path;
-  int        return_value;
+static void *arena_alloc(struct ExecArena *arena, size_t size) {
+  // arena_alloc(): allocate memory that stays valid until arena_release(), small allocations are served from
+  //                the arena's own buffer (on the stack of exec_wrapper())
+  void **chunk;
 
-  confstr(_CS_PATH, cs_path, sizeof(cs_path));
+  size = (size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
 
-  return_value = ENOENT;
-  path_env     = getenv("PATH") ?: cs_path;
-  search_path  = strtok(strdup(path_env), ":");
+  if (arena->used + size <= sizeof(arena->buf)) {
+    arena->used += size;
+    return arena->buf + arena->used - size;
+  }
 
-  do {
-    snprintf(result, PATH_MAX, "%s/%s", search_path, file);
+  if ((chunk = malloc(sizeof(void *) + size)) == NULL) return NULL;
 
-    if (access(result, X_OK) == 0) {
-      // file found in path and it is executable
-      return_value = 0;
+  *chunk        = arena->chunks;
+  arena->chunks = chunk;
 
-      if (verbose) fprintf(stderr, "[PID %-7i] %s: %s => %s\n", pid, PROMPT_NAME, file, result);
-      break;
-    } else if (access(result, F_OK) == 0) {
-      // file found in path but it is not executable
-      return_value = EACCES;
+  return chunk + 1;
+}
+
+static char *arena_printf(struct ExecArena *arena, const char *format, ...) {
+  // arena_printf(): asprintf() into arena
+  va_list argp;
+  char    *str;
+  int     len;
+
+  va_start(argp, format);
+  len = vsnprintf(NULL, 0, format, argp);
+  va_end(argp);
+
+  if (len < 0 || (str = arena_alloc(arena, len + 1)) == NULL) return NULL;
+
+  va_start(argp, format);
+  vsnprintf(str, len + 1, format, argp);
+  va_end(argp);
+
+  return str;
+}
+
+static void arena_release(struct ExecArena *arena) {
+  while (arena->chunks) {
+    void *next = *(void **) arena->chunks;
+
+    free(arena->chunks);
+    arena->chunks = next;
+  }
+}
+
+static bool is_env_name(const char *env, const char *name, int name_len) {
+  return strncmp(env, name, name_len) == 0 && env[name_len] == '=';
+}
+
+const char *getenvfp(char **envp, const char *name) {
+  // getenvfp: Get value of specific environment variable from given environ pointer
+  int name_len = strlen(name);
+
+  for (int i = 0; envp[i]; i++) {
+    if (is_env_name(envp[i], name, name_len)) return envp[i] + name_len + 1;
+  }
+
+  return NULL;
+}
+
+int unsetenvfp(char **envp, const char *name) {
+  // unsetenvfp: Remove specific environment variable from given environ pointer
+  int i, name_len = strlen(name);
+
+  for (i = 0; envp[i]; i++) {
+    if (is_env_name(envp[i], name, name_len)) {
+      int j;
+
+      for (j = i; envp[j + 1]; j++) envp[j] = envp[j + 1];
+      envp[j] = NULL;
+
+      return j;
     }
-  } while ((search_path = strtok(NULL, ":")));
+  }
+
+  return i;
+}
+
+static void close_executable(struct OpenedExec *exec) {
+  if (exec->fd != -1) close(exec->fd);
 
-  return return_value;
+  exec->fd       = -1;
+  exec->head_len = 0;
 }
 
-void get_elf_information(void *executable, off_t elf_size, struct ElfInfo *output) {
-  uint8_t phnum, shnum;
-  void    *program_header = executable,
-          *section_header = executable,
-          *strtab_header  = executable;
+static int open_executable(const char *exec_path, struct OpenedExec *exec, struct stat *file_info) {
+  // open_executable(): open the executable and read its first EXEC_HEAD_SIZE bytes, which is all we need to
+  //                    classify it (nothing is mapped, see elf.c)
+  ssize_t head_len;
 
-  output->interp_proghdr = NULL;
-  output->interp_sechdr  = NULL;
+  if ((exec->fd = open(exec_path, O_RDONLY | O_CLOEXEC)) == -1) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Failed to open %s for reading (%s)\n", getpid(), PROMPT_NAME, exec_path, strerror(errno));
+    return -1;
+  }
 
-  // check if file is ELF
-  if (memcmp(executable, "\x7f""ELF", 4) != 0) return;
+  if (fstat(exec->fd, file_info) == -1) {
+    fprintf(stderr, "[PID %-7i] %s: fstat() failed for %s (%s)\n", getpid(), PROMPT_NAME, exec_path, strerror(errno));
+    close_executable(exec);
+    return -1;
+  }
 
-  // check ELF bitness, 32-bit or 64-bit
-  output->is_64bit = (*((uint8_t *) (executable + 4)) == ELFCLASS64) ? true : false;
-  if (verbose) fprintf(stderr, "[PID %-7i] %s: %i-bit ELF executable detected\n", pid, PROMPT_NAME, output->is_64bit ? 64 : 32);
+  if ((head_len = pread(exec->fd, exec->head, EXEC_HEAD_SIZE, 0)) < 4) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Failed to read %s, will execute as-is\n", getpid(), PROMPT_NAME, exec_path);
 
-  // get number of program headers
-  phnum           = output->is_64bit ? ((Elf64_Ehdr *) executable)->e_phnum : ((Elf32_Ehdr *) executable)->e_phnum;
-  program_header += output->is_64bit ? ((Elf64_Ehdr *) executable)->e_phoff : ((Elf32_Ehdr *) executable)->e_phoff;
+    close_executable(exec);
+    return -1;
+  }
 
-  // parse ELF program header
-  for (int i = 0; i < phnum; i++) {
-    if (*((uint32_t *) program_header) == 3) {
-      // section type 0x03: PT_INTERP
-      output->is_dyn_exec    = true;
-      output->interp_proghdr = program_header;
+  exec->head_len = head_len;
+  return 0;
+}
 
-      // get memory address of interpreter string
-      if (output->is_64bit) {
-        output->interpreter = (char *) (executable + ((Elf64_Phdr *) program_header)->p_offset);
-      } else {
-        output->interpreter = (char *) (executable + ((Elf32_Phdr *) program_header)->p_offset);
-      }
+static int make_exec_decision(const char *exec_path, struct ExecDecision *decision, struct FileId *key_id,
+                              struct OpenedExec *exec, struct ElfInfo *elf_info) {
+  // make_exec_decision(): examine the given executable and decide how it should be executed,
+  //                       exec will be left open for later use if available
+  //
+  //                       returns 0 on success, error number otherwise
+  const char       *filename = basename(exec_path);
+  char             new_path[PATH_MAX]; // replacement of a fallback or redirect rule
+  struct stat      file_info;
+  struct RuleMatch match;
+  uint16_t         target_flags;
+
+  decision->type           = EXEC_TYPE_OTHER;
+  decision->is_dyn_exec    = false;
+  decision->is_system      = false;
+  decision->is_libc        = false;
+  decision->rewrite_interp = false;
+  decision->shebang[0]     = '\0';
 
-      if (verbose) {
-        fprintf(stderr, "[PID %-7i] %s: PT_INTERP section found at offset 0x%lx (%s)\n", pid, PROMPT_NAME, (uintptr_t) (program_header - executable), output->interpreter);
-      }
+  // fully resolve the executable path first before we do anything
+  if (realpath(exec_path, decision->target) == NULL) {
+    int saved_errno = errno;
 
-      break;
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: realpath() failed (%s)\n", getpid(), PROMPT_NAME, strerror(saved_errno));
+
+    // try the replacement of a fallback rule if the executable cannot be found (e.g. #!/usr/bin/perl, see default.rules)
+    if (saved_errno != ENOENT || !(rule_match(exec_path, &match) & RULE_FALLBACK) ||
+        rule_replacement(&match, RULE_FALLBACK, new_path) == -1 || realpath(new_path, decision->target) == NULL) {
+      return saved_errno;
     }
 
-    program_header += output->is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
-    if ((program_header + (output->is_64bit ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr))) > (executable + elf_size)) break;
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: %s => %s\n", getpid(), PROMPT_NAME, exec_path, decision->target);
   }
 
-  // get number of section headers
-  if (output->is_64bit) {
-    section_header       += ((Elf64_Ehdr *) executable)->e_shoff;
-    strtab_header        += ((Elf64_Ehdr *) executable)->e_shoff + ((Elf64_Ehdr *) executable)->e_shentsize * ((Elf64_Ehdr *) executable)->e_shstrndx;
-    shnum                 = ((Elf64_Ehdr *) executable)->e_shnum;
-    output->string_table  = executable + ((Elf64_Shdr *) strtab_header)->sh_offset;
-  } else {
-    section_header       += ((Elf32_Ehdr *) executable)->e_shoff;
-    strtab_header        += ((Elf32_Ehdr *) executable)->e_shoff + ((Elf32_Ehdr *) executable)->e_shentsize * ((Elf32_Ehdr *) executable)->e_shstrndx;
-    shnum                 = ((Elf32_Ehdr *) executable)->e_shnum;
-    output->string_table  = executable + ((Elf32_Shdr *) strtab_header)->sh_offset;
+  if (stat(decision->target, &file_info) == -1) {
+    fprintf(stderr, "[PID %-7i] %s: stat() failed for %s (%s)\n", getpid(), PROMPT_NAME, decision->target, strerror(errno));
+    return errno;
   }
 
-  // parse ELF section header
-  for (int i = 0; i < shnum; i++) {
-    // search for .interp section header
-    if (strcmp(&output->string_table[*((uint32_t *) section_header)], ".interp") == 0) {
-      output->is_dyn_exec   = true;
-      output->interp_sechdr = section_header;
+  // check if path is directory
+  if (S_ISDIR(file_info.st_mode)) return EISDIR;
 
-      if (verbose) fprintf(stderr, "[PID %-7i] %s: .interp section found at offset 0x%lx\n", pid, PROMPT_NAME, (uintptr_t) (section_header - executable));
-      break;
+  // check for permission first, raise an error if the executable isn't executable
+  // EACCES: Permission denied
+  if (access(decision->target, X_OK) != 0) return EACCES;
+
+  file_id_from_stat(&file_info, key_id);
+  decision->target_id = *key_id;
+
+  // for commands with a redirect rule, always use Chromebrew provided one if available (matched before and after
+  // resolving symlinks, so that both /bin/sh and whatever it links to are redirected)
+  if ((rule_match(exec_path, &match) & RULE_REDIRECT) || (rule_match(decision->target, &match) & RULE_REDIRECT)) {
+    if (no_crew_cmd) {
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: CREW_PRELOAD_NO_CREW_CMD set, will NOT modify command path\n", getpid(), PROMPT_NAME);
+    } else if (rule_replacement(&match, RULE_REDIRECT, new_path) == 0 && strcmp(new_path, decision->target) != 0 &&
+               access(new_path, X_OK) == 0) {
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: Will use Chromebrew version of %s instead...\n", getpid(), PROMPT_NAME, basename(decision->target));
+      strncpy(decision->target, new_path, PATH_MAX);
+
+      if (stat(decision->target, &file_info) == -1) return errno;
+      file_id_from_stat(&file_info, &decision->target_id);
     }
+  }
+
+  // LD_PRELOAD/LD_LIBRARY_PATH need to be unset when executable is libc.so.6, as it will cause segfaults
+  if (strcmp(filename, "libc.so.6") == 0) {
+    decision->is_libc = true;
+    return 0;
+  }
+
+  // check if executable is a system command or not
+  target_flags        = rule_match(decision->target, &match);
+  decision->is_system = (target_flags & RULE_SYSTEM);
+
+  // executables listed in the native manifest use Chromebrew's dynamic linker already, no need to read them
+  if (manifest_lookup(&decision->target_id)) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: %s found in native manifest, will execute as-is\n", getpid(), PROMPT_NAME, decision->target);
+
+    decision->type        = EXEC_TYPE_ELF;
+    decision->is_dyn_exec = true;
+    return 0;
+  }
+
+  if (open_executable(decision->target, exec, &file_info) == -1) return 0;
+
+  file_id_from_stat(&file_info, &decision->target_id);
+
+  if (memcmp(exec->head, ELFMAG, SELFMAG) == 0) {
+    decision->type = EXEC_TYPE_ELF;
+
+    // malformed executables are executed as-is
+    if (get_elf_information(decision->target, exec->fd, exec->head, exec->head_len, file_info.st_size, elf_info) == -1) return 0;
+
+    decision->is_dyn_exec    = elf_info->is_dyn_exec;
+    decision->rewrite_interp = (!no_crew_glibc && !(target_flags & RULE_NO_CREW_GLIBC) && elf_info->is_dyn_exec &&
+                                elf_info->is_64bit == CREW_GLIBC_IS_64BIT &&
+                                strcmp(elf_info->interpreter, CREW_GLIBC_INTERPRETER) != 0 &&
+                                access(CREW_GLIBC_INTERPRETER, X_OK) == 0);
+  } else if (memcmp(exec->head, "#!", 2) == 0) {
+    const char *newline     = memchr(exec->head + 2, '\n', exec->head_len - 2);
+    size_t     shebang_len = newline ? (size_t) (newline - exec->head - 2) : exec->head_len - 2;
 
-    section_header += output->is_64bit ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr);
-    if ((section_header + (output->is_64bit ? sizeof(Elf64_Shdr) : sizeof(Elf32_Shdr))) > (executable + elf_size)) break;
+    if (shebang_len >= sizeof(decision->shebang)) shebang_len = sizeof(decision->shebang) - 1;
+
+    decision->type = EXEC_TYPE_SCRIPT;
+    memcpy(decision->shebang, exec->head + 2, shebang_len);
+    decision->shebang[shebang_len] = '\0';
   }
 
-  if (verbose && output->interp_proghdr == NULL) {
-    fprintf(stderr, "[PID %-7i] %s: PT_INTERP section not found, probably linked statically\n", pid, PROMPT_NAME);
-    output->is_dyn_exec = false;
+  return 0;
+}
+
+static bool loader_supports_argv0(void) {
+  // loader_supports_argv0(): check whether CREW_GLIBC_INTERPRETER accepts --argv0 (glibc 2.33+) by looking for the
+  //                          option in its usage text, older dynamic linkers would take it as the program to run
+  //
+  //                          threads probing at the same time come to the same result, it is only published once known
+  struct stat loader_info;
+  void        *mem;
+  int         fd, supported = __atomic_load_n(&loader_argv0, __ATOMIC_RELAXED);
+
+  if (supported != -1) return supported;
+  supported = 0;
+
+  if ((fd = open(CREW_GLIBC_INTERPRETER, O_RDONLY | O_CLOEXEC)) != -1) {
+    if (fstat(fd, &loader_info) == 0 &&
+        (mem = mmap(NULL, loader_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) != MAP_FAILED) {
+      supported = (memmem(mem, loader_info.st_size, "--argv0", 8) != NULL);
+      munmap(mem, loader_info.st_size);
+    }
+
+    close(fd);
   }
+
+  __atomic_store_n(&loader_argv0, supported, __ATOMIC_RELAXED);
+
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: %s %s --argv0\n", getpid(), PROMPT_NAME, CREW_GLIBC_INTERPRETER, supported ? "supports" : "does not support");
+
+  return supported;
 }
 
-void change_elf_interpreter(char *exec_path, int memfd, void *exec_in_mem, struct ElfInfo *elf_info) {
-  int  old_section_header_size = 0;
-  void *old_section_header     = NULL;
+static int loader_argv(const char *exec_path, char *const *argv, char **new_argv, struct ExecArena *arena) {
+  // loader_argv(): run exec_path as an argument of Chromebrew's dynamic linker, keeping argv[0] if the
+  //                dynamic linker supports it, returns the new argc or -1 if out of memory
+  char *const *argv_rest = (argv && argv[0]) ? &argv[1] : NULL;
+  int         argc       = 1;
 
-  /*
-    allocate room between the last ELF section and the first section header for our new interpreter's path
-    Before:
+  new_argv[0] = CREW_GLIBC_INTERPRETER;
 
-        | ELF header | Program headers | Sections | Section headers |
+  if (loader_supports_argv0()) {
+    new_argv[argc++] = "--argv0";
+    new_argv[argc++] = (argv && argv[0]) ? argv[0] : (char *) exec_path;
+  }
 
-    After:
+  // the dynamic linker searches library paths for names without a slash
+  if ((new_argv[argc++] = arena_printf(arena, "%s%s", strchr(exec_path, '/') ? "" : "./", exec_path)) == NULL) return -1;
 
-        | ELF header | Program headers | Sections | New interpreter path | Section headers |
+  return copy2array(argv_rest, new_argv, argc);
+}
 
-  */
+static bool is_env_word_char(char c) {
+  // is_env_word_char(): characters env -S passes through unchanged (no quoting, escapes, ${VAR} or comments)
+  return c > ' ' && c < 0x7f && !strchr("\"'\\$#", c);
+}
 
-  if (verbose) fprintf(stderr, "[PID %-7i] %s: Modifying ELF interpreter path for %s...\n", pid, PROMPT_NAME, exec_path);
+static bool collapse_env_shebang(const char *interpreter, const char *interpreter_opt, char *script_path,
+                                 char *const *argv_rest, char *const *envp, struct ExecArena *arena,
+                                 char *exec_path, char ***argv_out, char ***envp_out) {
+  // collapse_env_shebang(): for "#!/usr/bin/env [-S] [NAME=value...] <command> [args...]", build what env would
+  //                         execute (command resolved through our PATH index into exec_path), so that env itself
+  //                         does not need to be executed (and rewritten)
+  //
+  //                         returns false if env needs to run: options other than -S, no command, quoting/expansion
+  //                         in -S strings, PATH changed, command not found (env reports it and exits with 127)
+  char       *opt, *words[EXEC_EXTRA_ARGS * 8], *saveptr, *word;
+  char       **new_argv, **new_envp;
+  const char *path_env = getenvfp((char **) envp, "PATH"), *own_path = getenv("PATH");
+  int        num_words = 0, num_assigns = 0, argc, envc;
+  bool       split     = false;
+
+  if (strcmp(basename(interpreter), "env") != 0 || interpreter_opt == NULL) return false;
+
+  // the PATH index searches our own PATH, env would search the one passed to it
+  if ((path_env || own_path) && (!path_env || !own_path || strcmp(path_env, own_path) != 0)) return false;
+
+  if ((opt = arena_printf(arena, "%s", interpreter_opt)) == NULL) return false;
+
+  // without -S, the kernel passes everything after the interpreter as a single argument
+  while (*opt == ' ' || *opt == '\t') opt++;
+
+  if (strncmp(opt, "-S", 2) == 0) {
+    split = true;
+    opt  += 2;
+  }
 
-  if (elf_info->is_64bit) {
-    old_section_header      = exec_in_mem + ((Elf64_Ehdr *) exec_in_mem)->e_shoff;
-    old_section_header_size = elf_info->size - ((Elf64_Ehdr *) exec_in_mem)->e_shoff;
+  for (char *p = opt; *p; p++) {
+    if (split && (*p == ' ' || *p == '\t')) continue;
+    if (!is_env_word_char(*p) && !(*p == ' ' && p[strspn(p, " \t")] == '\0')) return false;
+  }
 
-    // update section header offset, point PT_INTERP and .interp to our new interpreter string
-    ((Elf64_Ehdr *) exec_in_mem)->e_shoff               = elf_info->size + sizeof(CREW_GLIBC_INTERPRETER) - old_section_header_size;
-    ((Elf64_Phdr *) elf_info->interp_proghdr)->p_offset = elf_info->size - old_section_header_size + 1;
-    ((Elf64_Phdr *) elf_info->interp_proghdr)->p_paddr  = elf_info->size - old_section_header_size + 1;
-    ((Elf64_Phdr *) elf_info->interp_proghdr)->p_vaddr  = elf_info->size - old_section_header_size + 1;
-    ((Elf64_Phdr *) elf_info->interp_proghdr)->p_filesz = sizeof(CREW_GLIBC_INTERPRETER);
-    ((Elf64_Phdr *) elf_info->interp_proghdr)->p_memsz  = sizeof(CREW_GLIBC_INTERPRETER);
+  for (word = strtok_r(opt, " \t", &saveptr); word; word = strtok_r(NULL, " \t", &saveptr)) {
+    if (num_words == (int) (sizeof(words) / sizeof(words[0]))) return false;
+    words[num_words++] = word;
+  }
 
-    ((Elf64_Shdr *) elf_info->interp_sechdr)->sh_addr   = elf_info->size - old_section_header_size + 1;
-    ((Elf64_Shdr *) elf_info->interp_sechdr)->sh_offset = elf_info->size - old_section_header_size + 1;
-    ((Elf64_Shdr *) elf_info->interp_sechdr)->sh_size   = sizeof(CREW_GLIBC_INTERPRETER);
-  } else {
-    old_section_header      = exec_in_mem + ((Elf32_Ehdr *) exec_in_mem)->e_shoff;
-    old_section_header_size = elf_info->size - ((Elf32_Ehdr *) exec_in_mem)->e_shoff;
+  // leading NAME=value words are assignments, env options are left to env
+  while (num_assigns < num_words && strchr(words[num_assigns], '=')) {
+    if (words[num_assigns][0] == '=' || strncmp(words[num_assigns], "PATH=", 5) == 0) return false;
+    num_assigns++;
+  }
 
-    // update section header offset, point PT_INTERP and .interp to our new interpreter string
-    ((Elf32_Ehdr *) exec_in_mem)->e_shoff               = elf_info->size + sizeof(CREW_GLIBC_INTERPRETER) - old_section_header_size;
-    ((Elf32_Phdr *) elf_info->interp_proghdr)->p_offset = elf_info->size - old_section_header_size + 1;
-    ((Elf32_Phdr *) elf_info->interp_proghdr)->p_paddr  = elf_info->size - old_section_header_size + 1;
-    ((Elf32_Phdr *) elf_info->interp_proghdr)->p_vaddr  = elf_info->size - old_section_header_size + 1;
-    ((Elf32_Phdr *) elf_info->interp_proghdr)->p_filesz = sizeof(CREW_GLIBC_INTERPRETER);
-    ((Elf32_Phdr *) elf_info->interp_proghdr)->p_memsz  = sizeof(CREW_GLIBC_INTERPRETER);
+  if (num_assigns == num_words || words[num_assigns][0] == '-') return false;
 
-    ((Elf32_Shdr *) elf_info->interp_sechdr)->sh_addr   = elf_info->size - old_section_header_size + 1;
-    ((Elf32_Shdr *) elf_info->interp_sechdr)->sh_offset = elf_info->size - old_section_header_size + 1;
-    ((Elf32_Shdr *) elf_info->interp_sechdr)->sh_size   = sizeof(CREW_GLIBC_INTERPRETER);
+  if (strchr(words[num_assigns], '/')) {
+    snprintf(exec_path, PATH_MAX, "%s", words[num_assigns]);
+  } else if (search_in_path(words[num_assigns], exec_path) != 0) {
+    return false;
   }
 
-  if (verbose) fprintf(stderr, "[PID %-7i] %s: New PT_INTERP for %s: %s\n", pid, PROMPT_NAME, exec_path, CREW_GLIBC_INTERPRETER);
-  if (verbose) fprintf(stderr, "[PID %-7i] %s: Writing modified executable into memfd %i...\n", pid, PROMPT_NAME, memfd);
+  new_argv = arena_alloc(arena, (num_words + count_array(argv_rest) + 2) * sizeof(char *));
+  new_envp = arena_alloc(arena, (count_array(envp) + num_assigns + 1) * sizeof(char *));
+
+  if (new_argv == NULL || new_envp == NULL) return false;
+
+  // env executes <command> [args...] <script> <original arguments>
+  for (argc = 0; argc < num_words - num_assigns; argc++) new_argv[argc] = words[num_assigns + argc];
+
+  new_argv[argc++] = script_path;
+  copy2array(argv_rest, new_argv, argc);
 
-  // write modified executable with updated PT_INTERP segment to memfd
-  write(memfd, exec_in_mem, elf_info->size - old_section_header_size);
-  write(memfd, "\0" CREW_GLIBC_INTERPRETER, sizeof(CREW_GLIBC_INTERPRETER) + 1);
-  write(memfd, old_section_header, old_section_header_size);
+  envc = copy2array(envp, new_envp, 0);
+
+  for (int i = 0; i < num_assigns; i++) {
+    char *name = arena_printf(arena, "%.*s", (int) (strchr(words[i], '=') - words[i]), words[i]);
+
+    if (name == NULL) return false;
+
+    envc             = unsetenvfp(new_envp, name);
+    new_envp[envc++] = words[i];
+    new_envp[envc]   = NULL;
+  }
 
-  snprintf(exec_path, PATH_MAX, "/proc/self/fd/%i", memfd);
-  if (verbose) fprintf(stderr, "[PID %-7i] %s: New executable path: %s\n", pid, PROMPT_NAME, exec_path);
+  *argv_out = new_argv;
+  *envp_out = new_envp;
+  return true;
 }
 
-int unsetenvfp(char **envp, char *name) {
-  // unsetenvfp: Remove specific environment variable from given environ pointer
-  int i, name_len = strlen(name);
+static int open_elf_executable(const char *exec_path, struct OpenedExec *exec, struct ElfInfo *elf_info) {
+  // open_elf_executable(): open the executable for rewriting if the decision came from the decision cache,
+  //                        returns 0 if exec and elf_info are usable, -1 otherwise
+  struct stat file_info;
 
-  for (i = 0; envp[i]; i++) {
-    if (strncmp(envp[i], name, name_len) == 0) {
-      int j;
+  if (exec->fd == -1 && open_executable(exec_path, exec, &file_info) == 0 &&
+      get_elf_information(exec_path, exec->fd, exec->head, exec->head_len, file_info.st_size, elf_info) == -1) {
+    close_executable(exec);
+  }
 
-      for (j = i; envp[j + 1]; j++) envp[j] = envp[j + 1];
-      envp[j] = NULL;
+  return (exec->fd != -1) ? 0 : -1;
+}
 
-      return j;
-    }
+static int memfd_executable(const char *exec_path, struct OpenedExec *exec, struct ElfInfo *elf_info,
+                            int *memfd, char *final_exec) {
+  // memfd_executable(): write a private copy of the executable that uses Chromebrew's dynamic linker into a memfd,
+  //                     final_exec will be replaced with its path
+  //
+  //                     returns 0 on success, -1 if memfd_create() is not supported or the copy failed
+  off_t memfd_size;
+
+  if (open_elf_executable(exec_path, exec, elf_info) == -1) return -1;
+
+  if ((*memfd = syscall(SYS_memfd_create, exec_path, 1)) == -1) return -1;
+
+  if ((memfd_size = change_elf_interpreter(exec_path, *memfd, exec->fd, elf_info)) == -1) {
+    close(*memfd);
+    *memfd = -1;
+    return -1;
   }
 
-  return i;
+  snprintf(final_exec, PATH_MAX, "/proc/self/fd/%i", *memfd);
+  stats_add(STAT_MEMFD_EXECS, 1);
+  stats_add(STAT_MEMFD_BYTES, memfd_size);
+
+  return 0;
 }
 
-int exec_wrapper(const char *path_or_name, char *const *argv, char *const *envp,
-                 bool perform_path_search, void *pid_p, const void *file_actions, const void *attrp) {
-  bool    is_a_path    = false,
-          is_linker    = false,
-          is_system    = false;
-  char    **new_argv   = alloca(4096 * sizeof(char *)),
-          **new_envp   = alloca(4096 * sizeof(char *)),
-          *filename    = basename(path_or_name),
-          *final_exec  = alloca(PATH_MAX),
-          *exec_in_mem = NULL;
-  int     argc         = copy2array(argv, new_argv, 0),
-          envc         = copy2array(envp, new_envp, 0),
-          exec_fd;
-
-  struct ElfInfo elf_info;
-  struct stat    file_info;
-
-  memset(&elf_info, 0, sizeof(elf_info));
+static bool is_preloaded(char **envp) {
+  // is_preloaded(): whether envp still loads this wrapper (crew-preload.so, or a build of it for the benchmarks)
+  const char *preload = getenvfp(envp, "LD_PRELOAD");
+
+  return preload && strstr(preload, "crew-preload");
+}
+
+static int exec_final(const char *final_exec, char *const *argv, char *const *envp,
+                      void *pid_p, const void *file_actions, const void *attrp, int link_slot) {
+  // exec_final(): hand the command to the real execve()/posix_spawn(), a linker inherits its link slot (which is
+  //               close-on-exec until then, so that no other child spawned meanwhile does, see link-jobs.c)
+  if (pid_p == NULL) {
+    if (link_slot != -1) fcntl(link_slot, F_SETFD, 0);
+    return orig_execve(final_exec, argv, envp);
+  } else if (link_slot != -1) {
+    return link_jobs_spawn(link_slot, (pid_t *) pid_p, final_exec, (const posix_spawn_file_actions_t *) file_actions,
+                           (const posix_spawnattr_t *) attrp, argv, envp);
+  } else {
+    return orig_posix_spawn((pid_t *) pid_p, final_exec, (const posix_spawn_file_actions_t *) file_actions,
+                            (const posix_spawnattr_t *) attrp, argv, envp);
+  }
+}
+
+static int exec_error(const void *pid_p, int error) {
+  // exec_error(): exec*() report errors via errno, posix_spawn*() return them
+  if (pid_p) return error;
+
+  errno = error;
+  return -1;
+}
+
+// returned by exec_wrapper_impl() when the executable is a script, exec_wrapper() continues with the command in next
+#define EXEC_NEXT -2
+
+struct ExecNext {
+  const char  *path;
+  char *const *argv,
+              *const *envp;
+};
+
+static int exec_next(struct ExecArena *arena, const void *pid_p, const char *path, char *const *argv, char *const *envp,
+                     struct ExecNext *next) {
+  // exec_next(): hand the command a script is run with back to exec_wrapper(), path is copied into arena as it
+  //              might be on the stack of exec_wrapper_impl()
+  if ((next->path = arena_printf(arena, "%s", path)) == NULL) return exec_error(pid_p, ENOMEM);
+
+  next->argv = argv;
+  next->envp = envp;
+  return EXEC_NEXT;
+}
+
+static int exec_wrapper_impl(const char *path_or_name, char *const *argv, char *const *envp,
+                             bool perform_path_search, void *pid_p, const void *file_actions, const void *attrp,
+                             struct ExecArena *arena, struct OpenedExec *exec, int *memfd, int *link_slot,
+                             struct ExecNext *next) {
+  bool  is_a_path    = false,
+        is_linker    = false,
+        is_cached    = false;
+  char  **new_argv,
+        **new_envp,
+        *flags_env,
+        *filename    = basename(path_or_name),
+        *final_exec  = arena->path, // the only path buffer, see struct ExecArena
+        *mold_exec   = NULL;        // replaces a linker if set
+  int   argc         = count_array(argv),
+        envc         = count_array(envp),
+        link_threads = 0,
+        argv0_probe,
+        exec_ret;
+
+  char *const *argv_rest = (argc > 0) ? &argv[1] : NULL; // all arguments except argv[0]
+
+  const char *exec_path    = path_or_name, // executable as found, resolved into final_exec by the decision
+             *decision_key = NULL,
+             *target_path  = NULL;         // resolved executable once final_exec points to a rewritten copy of it
+
+  struct ElfInfo      elf_info;
+  struct ExecDecision decision;
+  struct FileId       key_id;
+  uint32_t            flags;
 
   if (verbose) {
     if (pid_p == NULL) {
       if (perform_path_search) {
-        fprintf(stderr, "[PID %-7i] %s: exec*p() called: %s\n", pid, PROMPT_NAME, path_or_name);
+        fprintf(stderr, "[PID %-7i] %s: exec*p() called: %s\n", getpid(), PROMPT_NAME, path_or_name);
       } else {
-        fprintf(stderr, "[PID %-7i] %s: exec*() called: %s\n", pid, PROMPT_NAME, path_or_name);
+        fprintf(stderr, "[PID %-7i] %s: exec*() called: %s\n", getpid(), PROMPT_NAME, path_or_name);
       }
     } else {
       if (perform_path_search) {
-        fprintf(stderr, "[PID %-7i] %s: posix_spawn() called: %s\n", pid, PROMPT_NAME, path_or_name);
+        fprintf(stderr, "[PID %-7i] %s: posix_spawnp() called: %s\n", getpid(), PROMPT_NAME, path_or_name);
       } else {
-        fprintf(stderr, "[PID %-7i] %s: posix_spawnp() called: %s\n", pid, PROMPT_NAME, path_or_name);
+        fprintf(stderr, "[PID %-7i] %s: posix_spawn() called: %s\n", getpid(), PROMPT_NAME, path_or_name);
       }
     }
   }
@@ -396,199 +788,295 @@ int exec_wrapper(const char *path_or_name, char *const *argv, char *const *envp,
     is_a_path = true;
   }
 
-  // search in path if perform_path_search == true and path_or_name is not a relative or absolute path
-  if (is_a_path) {
-    strncpy(final_exec, path_or_name, PATH_MAX);
-  } else {
+  // search in path if perform_path_search == true and path_or_name is not a relative or absolute path, the result
+  // is moved out of final_exec, which receives the resolved path below
+  if (!is_a_path) {
     int ret = search_in_path(path_or_name, final_exec);
-    if (ret != 0) return ret;
+    if (ret != 0) return exec_error(pid_p, ret);
+
+    if ((exec_path = arena_printf(arena, "%s", final_exec)) == NULL) return exec_error(pid_p, ENOMEM);
   }
 
   // don't do anything when CREW_PRELOAD_DISABLED=1
   if (disabled) {
-    if (pid_p == NULL) {
-      return orig_execve(final_exec, argv, envp);
-    } else {
-      return orig_posix_spawn((pid_t *) pid_p, final_exec, (const posix_spawn_file_actions_t *) file_actions,
-                              (const posix_spawnattr_t *) attrp, argv, envp);
-    }
-  }
+    stats_exec_ready();
+    trace_exec_ready();
+    account_exec_ready();
 
-  // fully resolve the executable path first before we do anything
-  if (realpath(strdup(final_exec), final_exec) == NULL) {
-    if (verbose) fprintf(stderr, "[PID %-7i] %s: realpath() failed (%s)\n", pid, PROMPT_NAME, strerror(errno));
-    return errno;
+    return exec_final(exec_path, argv, envp, pid_p, file_actions, attrp, -1);
   }
 
-  if (stat(final_exec, &file_info) == -1) fprintf(stderr, "[PID %-7i] %s: stat() failed for %s (%s)\n", pid, PROMPT_NAME, final_exec, strerror(errno));
+  // argv/envp are copied as borrowed pointers (with room for the ones added below), only strings that
+  // need to be modified get new storage from arena
+  new_argv = arena_alloc(arena, (argc + EXEC_EXTRA_ARGS + 1) * sizeof(char *));
+  new_envp = arena_alloc(arena, (envc + EXEC_EXTRA_ENVS + 1) * sizeof(char *));
 
-  // check if path is directory
-  if (S_ISDIR(file_info.st_mode)) return EISDIR;
+  if (new_argv == NULL || new_envp == NULL) return exec_error(pid_p, ENOMEM);
 
-  // check for permission first, raise an error if the executable isn't executable
-  // EACCES: Permission denied
-  if (access(final_exec, X_OK) != 0) return EACCES;
-
-  // for commands listed in cmd_override_list, always use Chromebrew provided one if available
-  for (int i = 0; i < (int) (sizeof(cmd_override_list) / sizeof(char *)); i++) {
-    if (strcmp(final_exec, cmd_override_list[i]) == 0) {
-      char *new_path;
-
-      if (no_crew_cmd) {
-        if (verbose) fprintf(stderr, "[PID %-7i] %s: CREW_PRELOAD_NO_CREW_CMD set, will NOT modify command path\n", pid, PROMPT_NAME);
-      } else if (asprintf(&new_path, "%s%s", CREW_PREFIX, final_exec) > 0 && access(new_path, X_OK) == 0) {
-        if (verbose) fprintf(stderr, "[PID %-7i] %s: Will use Chromebrew version of %s instead...\n", pid, PROMPT_NAME, basename(final_exec));
-        strncpy(final_exec, new_path, PATH_MAX);
-      }
+  argc = copy2array(argv, new_argv, 0);
+  envc = copy2array(envp, new_envp, 0);
 
-      break;
-    }
+  // options are handed down in CREW_PRELOAD_FLAGS right before executing (see below), a stale value is never passed on
+  envc      = unsetenvfp(new_envp, "CREW_PRELOAD_FLAGS");
+  flags     = options_from_env(new_envp);
+
+  // probe the dynamic linker here if it will be needed, so that no process below us has to do it again
+  if (flags & (1 << OPTION_EXEC_MODE_LOADER)) loader_supports_argv0();
+
+  // decisions are shared between processes, so they need to be keyed by absolute path (the working directory is read
+  // into final_exec, which is overwritten by the decision anyway)
+  if (exec_path[0] == '/') {
+    decision_key = exec_path;
+  } else if (getcwd(final_exec, PATH_MAX) != NULL) {
+    decision_key = arena_printf(arena, "%s/%s", final_exec, exec_path);
   }
 
-  // unset LD_PRELOAD/LD_LIBRARY_PATH when executable is libc.so.6, as it will cause segfaults
-  if (strcmp(filename, "libc.so.6") == 0) {
-    if (verbose) fprintf(stderr, "[PID %-7i] %s: libc.so.6 detected, will execute with LD_* unset...\n", pid, PROMPT_NAME);
+  // the decision resolves the executable into final_exec
+  decision.target = final_exec;
 
-    envc = unsetenvfp(new_envp, "LD_LIBRARY_PATH");
-    envc = unsetenvfp(new_envp, "LD_PRELOAD");
-  } else {
-    // check if executable is a system command or not
-    for (int i = 0; i < (int) (sizeof(system_exe_path) / sizeof(char *)); i++) {
-      if (strncmp(final_exec, system_exe_path[i], strlen(system_exe_path[i])) == 0) {
-        is_system = true;
-        break;
-      }
-    }
+  // reuse decision made by previous exec*() calls if the executable was not modified since then
+  if (no_decision_cache || decision_key == NULL || decision_cache_lookup(decision_key, &decision) == -1) {
+    int ret = make_exec_decision(exec_path, &decision, &key_id, exec, &elf_info);
+    if (ret != 0) return exec_error(pid_p, ret);
+
+    if (!no_decision_cache && decision_key != NULL) decision_cache_store(decision_key, &key_id, &decision);
+  }
 
-    // try searching in CREW_PREFIX if the executable is prefixed with system path and cannot be found
-    if (is_system && access(final_exec, F_OK) != 0) {
-      if (asprintf(&final_exec, "%s/bin/%s", CREW_PREFIX, filename) > 0 && access(final_exec, F_OK) == 0) {
-        if (verbose) fprintf(stderr, "[PID %-7i] %s: %s => %s\n", pid, PROMPT_NAME, path_or_name, final_exec);
-        is_system = false;
+  account_exec_target(final_exec);
+
+  // check if current executable is a linker before anything is rewritten for it, as mold replaces it as a whole
+  if (compile_hacks && !decision.is_libc && decision.type != EXEC_TYPE_SCRIPT) {
+    is_linker = (rule_match_name(filename) & RULE_LINKER);
+
+    if (is_linker) {
+      *link_slot = link_jobs_acquire(argv, new_envp, &link_threads);
+
+      if (no_mold) {
+        if (verbose) fprintf(stderr, "[PID %-7i] %s: CREW_PRELOAD_NO_MOLD is set, will NOT modify linker path\n", getpid(), PROMPT_NAME);
       } else {
-        // return an error if we cannot find any matching executables
-        // ENOENT: No such file or directory
-        return ENOENT;
+        if (verbose) fprintf(stderr, "[PID %-7i] %s: Linker detected (%s), will use mold linker\n", getpid(), PROMPT_NAME, filename);
+
+        char *mold_path = arena_alloc(arena, PATH_MAX);
+        int  ret        = mold_path ? search_in_path("mold", mold_path) : ENOMEM;
+
+        if (ret == 0) {
+          mold_exec = mold_path;
+        } else {
+          fprintf(stderr, "[PID %-7i] %s: Mold linker is not executable (%s), will NOT modify linker path\n", getpid(), PROMPT_NAME, strerror(ret));
+        }
       }
     }
+  }
 
-    if ((exec_fd = open(final_exec, O_RDONLY | O_CLOEXEC)) == -1) {
-      if (verbose) fprintf(stderr, "[PID %-7i] %s: Failed to open %s for reading (%s)\n", pid, PROMPT_NAME, final_exec, strerror(errno));
-    } else {
-      if (fstat(exec_fd, &file_info) == -1) fprintf(stderr, "[PID %-7i] %s: fstat() failed for %s (%s)\n", pid, PROMPT_NAME, final_exec, strerror(errno));
+  if (decision.is_libc) {
+    // unset LD_PRELOAD/LD_LIBRARY_PATH when executable is libc.so.6, as it will cause segfaults
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: libc.so.6 detected, will execute with LD_* unset...\n", getpid(), PROMPT_NAME);
 
-      // map the executable into memory region for convenience
-      exec_in_mem = mmap(NULL, file_info.st_size + PATH_MAX, PROT_READ | PROT_WRITE, MAP_PRIVATE, exec_fd, 0);
+    envc = unsetenvfp(new_envp, "LD_LIBRARY_PATH");
+    envc = unsetenvfp(new_envp, "LD_PRELOAD");
+  } else {
+    if (decision.type == EXEC_TYPE_ELF) {
+      // unset LD_LIBRARY_PATH for system commands, original value will be copied into CREW_PRELOAD_LIBRARY_PATH environment variable
+      // (see https://github.com/chromebrew/chromebrew/issues/5777 for more information)
+      if (decision.is_system && decision.is_dyn_exec) {
+        const char *library_path = getenvfp(new_envp, "LD_LIBRARY_PATH");
 
-      if (memcmp(exec_in_mem, "\x7f""ELF", 4) == 0) {
-        elf_info.size = file_info.st_size;
-        get_elf_information(exec_in_mem, file_info.st_size, &elf_info);
+        if (verbose) fprintf(stderr, "[PID %-7i] %s: System command detected, will execute with LD_LIBRARY_PATH unset...\n", getpid(), PROMPT_NAME);
 
-        // unset LD_LIBRARY_PATH for system commands, original value will be copied into CREW_PRELOAD_LIBRARY_PATH environment variable
-        // (see https://github.com/chromebrew/chromebrew/issues/5777 for more information)
-        if (is_system && elf_info.is_dyn_exec) {
-          if (verbose) fprintf(stderr, "[PID %-7i] %s: System command detected, will execute with LD_LIBRARY_PATH unset...\n", pid, PROMPT_NAME);
+        envc = unsetenvfp(new_envp, "LD_LIBRARY_PATH");
+        stats_add(STAT_LIBRARY_PATH_STASHES, 1);
 
-          envc = unsetenvfp(new_envp, "LD_LIBRARY_PATH");
-          asprintf(&new_envp[envc++], "CREW_PRELOAD_LIBRARY_PATH=%s", getenv("LD_LIBRARY_PATH"));
+        if (library_path) {
+          if ((new_envp[envc++] = arena_printf(arena, "CREW_PRELOAD_LIBRARY_PATH=%s", library_path)) == NULL) return exec_error(pid_p, ENOMEM);
           new_envp[envc] = NULL;
         }
+      }
+
+      // modify ELF interpreter path (in-memory only) to Chromebrew's glibc before executing if needed
+      if (decision.rewrite_interp && mold_exec == NULL) {
+        if (verbose) fprintf(stderr, "[PID %-7i] %s: Will execute %s with Chromebrew's dynamic linker\n", getpid(), PROMPT_NAME, final_exec);
+        stats_add(STAT_INTERP_REWRITES, 1);
+
+        if ((target_path = arena_printf(arena, "%s", final_exec)) == NULL) return exec_error(pid_p, ENOMEM);
 
-        // modify ELF interpreter path (in-memory only) to Chromebrew's glibc before executing if needed
-        if (!no_crew_glibc && exec_in_mem && elf_info.is_dyn_exec &&
-            elf_info.is_64bit == CREW_GLIBC_IS_64BIT &&
-            strcmp(elf_info.interpreter, CREW_GLIBC_INTERPRETER) != 0 &&
-            access(CREW_GLIBC_INTERPRETER, X_OK) == 0) {
+        // CREW_PRELOAD_EXEC_MODE=loader: no copy at all, but /proc/self/exe points to the dynamic linker
+        if (loader_exec && loader_supports_argv0()) {
+          if ((argc = loader_argv(target_path, argv, new_argv, arena)) == -1) return exec_error(pid_p, ENOMEM);
 
-          int memfd = syscall(SYS_memfd_create, final_exec, 1);
+          strncpy(final_exec, CREW_GLIBC_INTERPRETER, PATH_MAX);
+          stats_add(STAT_LOADER_EXECS, 1);
 
-          if (verbose) fprintf(stderr, "[PID %-7i] %s: Will execute %s with Chromebrew's dynamic linker\n", pid, PROMPT_NAME, final_exec);
+          if (verbose) fprintf(stderr, "[PID %-7i] %s: Will execute as: %s --argv0 %s %s...\n", getpid(), PROMPT_NAME, new_argv[0], new_argv[2], new_argv[3]);
+        } else if (no_exec_cache || exec_cache_lookup(final_exec, &decision.target_id) == -1) {
+          // prefer a shared copy from the exec cache, use a private copy in memfd otherwise
+          // (executable is not opened yet if the decision came from decision cache)
+          if (!no_exec_cache && open_elf_executable(final_exec, exec, &elf_info) == 0 &&
+              exec_cache_store(final_exec, exec->fd, &decision.target_id, &elf_info) == 0) {
+            is_cached = true;
 
-          if (memfd > 0) {
-            change_elf_interpreter(final_exec, memfd, exec_in_mem, &elf_info);
+            if (verbose) fprintf(stderr, "[PID %-7i] %s: New executable path: %s\n", getpid(), PROMPT_NAME, final_exec);
+          } else if (memfd_executable(final_exec, exec, &elf_info, memfd, final_exec) == 0) {
+            if (verbose) fprintf(stderr, "[PID %-7i] %s: New executable path: %s\n", getpid(), PROMPT_NAME, final_exec);
           } else {
             // fallback to legacy ld-linux.so way for systems that don't support memfd_create()
             // load and run executable using Chromebrew's dynamic linker
-            new_argv[0] = CREW_GLIBC_INTERPRETER;
-            new_argv[1] = strdup(final_exec);
+            if ((argc = loader_argv(target_path, argv, new_argv, arena)) == -1) return exec_error(pid_p, ENOMEM);
 
-            copy2array(&argv[1], new_argv, 2);
             strncpy(final_exec, CREW_GLIBC_INTERPRETER, PATH_MAX);
+            stats_add(STAT_LOADER_EXECS, 1);
 
-            if (verbose) fprintf(stderr, "[PID %-7i] %s: Will execute as: %s %s %.20s...\n", pid, PROMPT_NAME, new_argv[0], new_argv[1], new_argv[2]);
+            if (verbose) fprintf(stderr, "[PID %-7i] %s: Will execute as: %s %s %.20s...\n", getpid(), PROMPT_NAME, new_argv[0], new_argv[1], new_argv[2]);
           }
+        } else {
+          is_cached = true;
+
+          if (verbose) fprintf(stderr, "[PID %-7i] %s: New executable path: %s\n", getpid(), PROMPT_NAME, final_exec);
         }
-      } else if (memcmp(exec_in_mem, "#!", 2) == 0) {
-        // parse shebang and re-execute with specified interpreter if the executable is a script
-        char shebang[PATH_MAX], *script_path, *interpreter_opt;
+      }
+    } else if (decision.type == EXEC_TYPE_SCRIPT) {
+      // parse shebang and re-execute with specified interpreter if the executable is a script
+      // everything handed to exec_next() has to live in arena
+      char *shebang, *script_path, *interpreter, *interpreter_opt, *saveptr, **env_argv, **env_envp;
+
+      if ((shebang = arena_printf(arena, "%s", decision.shebang)) == NULL ||
+          (script_path = arena_printf(arena, "%s", final_exec)) == NULL) {
+        return exec_error(pid_p, ENOMEM);
+      }
 
-        strncpy(shebang, exec_in_mem + 2, (strcspn(exec_in_mem + 2, "\n") < PATH_MAX) ? strcspn(exec_in_mem + 2, "\n") : PATH_MAX);
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: %s is a script with shebang: '#!%s'\n", getpid(), PROMPT_NAME, script_path, shebang);
 
-        script_path                             = strdup(final_exec);
-        shebang[strcspn(exec_in_mem + 2, "\n")] = '\0';
+      // get shebang value (split in place, so that the interpreter stays in arena: final_exec is overwritten by
+      // the next iteration, while new_argv[0] is still used)
+      interpreter     = strtok_r(shebang, " ", &saveptr) ?: "";
+      interpreter_opt = strtok_r(NULL, "\n", &saveptr);
 
-        if (verbose) fprintf(stderr, "[PID %-7i] %s: %s is a script with shebang: '#!%s'\n", pid, PROMPT_NAME, script_path, shebang);
+      // "#!/usr/bin/env <command>": execute the command right away instead of env
+      if (collapse_env_shebang(interpreter, interpreter_opt, script_path, argv_rest, new_envp, arena, final_exec, &env_argv, &env_envp)) {
+        if (verbose) fprintf(stderr, "[PID %-7i] %s: Will execute %s instead of %s\n", getpid(), PROMPT_NAME, final_exec, interpreter);
 
-        // get shebang value
-        strncpy(final_exec, strtok(shebang, " "), PATH_MAX);
+        close_executable(exec);
+        stats_add(STAT_ENV_COLLAPSES, 1);
+        return exec_next(arena, pid_p, final_exec, env_argv, env_envp, next);
+      }
 
-        // extract interpreter path and interpreter argument (if any)
-        if ((interpreter_opt = strtok(NULL, "\n"))) {
-          new_argv[0] = final_exec;
-          new_argv[1] = interpreter_opt;
-          new_argv[2] = script_path;
-          argc        = copy2array(&argv[1], new_argv, 3); // copy all arguments except argv[0]
-        } else {
-          new_argv[0] = final_exec;
-          new_argv[1] = script_path;
-          argc        = copy2array(&argv[1], new_argv, 2); // copy all arguments except argv[0]
-        }
+      // extract interpreter path and interpreter argument (if any)
+      if (interpreter_opt) {
+        new_argv[0] = interpreter;
+        new_argv[1] = interpreter_opt;
+        new_argv[2] = script_path;
+        argc        = copy2array(argv_rest, new_argv, 3);
+      } else {
+        new_argv[0] = interpreter;
+        new_argv[1] = script_path;
+        argc        = copy2array(argv_rest, new_argv, 2);
+      }
 
-        if (verbose) fprintf(stderr, "[PID %-7i] %s: Will re-execute as: %s %s %.20s ...\n", pid, PROMPT_NAME, new_argv[0], new_argv[1], new_argv[2]);
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: Will re-execute as: %s %s %.20s ...\n", getpid(), PROMPT_NAME, new_argv[0], new_argv[1], new_argv[2]);
 
-        return exec_wrapper(final_exec, new_argv, new_envp, false, pid_p, file_actions, attrp);
-      }
+      // new_argv/new_envp stay valid until exec_wrapper() returns, the executable itself is not needed anymore
+      close_executable(exec);
+      stats_add(STAT_SHEBANG_REEXECS, 1);
+      return exec_next(arena, pid_p, interpreter, new_argv, new_envp, next);
     }
 
-    if (compile_hacks) {
-      char mold_exec[PATH_MAX];
+    if (is_linker) {
+      // argv is still the one of the linker, mold takes the same arguments
+      if (mold_exec) {
+        final_exec = mold_exec;
+        stats_add(STAT_MOLD_SUBSTITUTIONS, 1);
 
-      // check if current executable is a linker
-      for (int i = 0; i < (int) (sizeof(linkers) / sizeof(char *)); i++) {
-        if (strcmp(filename, linkers[i]) == 0) {
-          is_linker = true;
-          break;
+        if (link_threads > 0 && (new_argv[argc++] = arena_printf(arena, "--threads=%i", link_threads)) == NULL) {
+          return exec_error(pid_p, ENOMEM);
         }
       }
 
-      if (is_linker) {
-        if (no_mold) {
-          if (verbose) fprintf(stderr, "[PID %-7i] %s: CREW_PRELOAD_NO_MOLD is set, will NOT modify linker path\n", pid, PROMPT_NAME);
-        } else {
-          if (verbose) fprintf(stderr, "[PID %-7i] %s: Linker detected (%s), will use mold linker\n", pid, PROMPT_NAME, filename);
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: Appending --dynamic-linker flag to the linker...\n", getpid(), PROMPT_NAME);
 
-          int ret = search_in_path("mold", mold_exec);
+      new_argv[argc++] = "--dynamic-linker";
+      new_argv[argc++] = CREW_GLIBC_INTERPRETER;
+      new_argv[argc]   = NULL;
+    }
+  }
 
-          if (ret == 0) {
-            strncpy(final_exec, mold_exec, PATH_MAX);
-          } else {
-            fprintf(stderr, "[PID %-7i] %s: Mold linker is not executable (%s), will NOT modify linker path\n", pid, PROMPT_NAME, strerror(ret));
-          };
-        }
+  // hand our options down to preloaded children in a single variable, so that they do not need to parse all of them
+  // again (not to children that will not load this wrapper: env -i, libc.so.6)
+  if (is_preloaded(new_envp)) {
+    if ((argv0_probe = __atomic_load_n(&loader_argv0, __ATOMIC_RELAXED)) != -1) flags |= FLAG_LOADER_PROBED | (argv0_probe ? FLAG_LOADER_ARGV0 : 0);
 
-        if (verbose) fprintf(stderr, "[PID %-7i] %s: Appending --dynamic-linker flag to the linker...\n", pid, PROMPT_NAME);
+    if ((flags_env = arena_printf(arena, "CREW_PRELOAD_FLAGS=%x", flags)) == NULL) return exec_error(pid_p, ENOMEM);
 
-        new_argv[argc++] = "--dynamic-linker";
-        new_argv[argc++] = CREW_GLIBC_INTERPRETER;
-        new_argv[argc]   = NULL;
-      }
-    }
+    new_envp[envc++] = flags_env;
+    new_envp[envc]   = NULL;
   }
 
-  if (pid_p == NULL) {
-    return orig_execve(final_exec, new_argv, new_envp);
-  } else {
-    return orig_posix_spawn((pid_t *) pid_p, final_exec, (const posix_spawn_file_actions_t *) file_actions,
-                            (const posix_spawnattr_t *) attrp, new_argv, new_envp);
+  stats_exec_ready();
+  trace_exec_ready();
+  account_exec_ready();
+
+  exec_ret = exec_final(final_exec, new_argv, new_envp, pid_p, file_actions, attrp, *link_slot);
+
+  // the cached image might have been evicted by another process since it was looked up, use a private copy then
+  if (is_cached && (pid_p ? exec_ret : errno) == ENOENT &&
+      memfd_executable(target_path, exec, &elf_info, memfd, final_exec) == 0) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Cached image is gone, new executable path: %s\n", getpid(), PROMPT_NAME, final_exec);
+
+    exec_ret = exec_final(final_exec, new_argv, new_envp, pid_p, file_actions, attrp, *link_slot);
   }
+
+  return exec_ret;
+}
+
+int exec_wrapper(const char *path_or_name, char *const *argv, char *const *envp,
+                 bool perform_path_search, void *pid_p, const void *file_actions, const void *attrp) {
+  // exec_wrapper(): everything allocated for this call is released before returning, as posix_spawn*() callers
+  //                 (make, ninja...) keep running and might spawn hundreds of thousands of processes
+  //
+  //                 scripts are run by looping with the command of their shebang rather than by recursion, so that
+  //                 the stack needed stays the same for any script (threads of the JVM or cargo have small stacks)
+  //                 and all state of the call stays in this frame or the thread-local state of the hooks
+  struct ExecArena  arena;
+  struct OpenedExec exec;
+  struct ExecNext   next  = { 0 };
+  int               memfd = -1, link_slot = -1, reexecs = 0, ret, saved_errno;
+
+  arena.used    = 0;
+  arena.chunks  = NULL;
+  exec.fd       = -1;
+  exec.head_len = 0;
+
+  stats_exec_begin(pid_p != NULL);
+  trace_exec_begin(path_or_name, pid_p != NULL);
+  account_exec_begin(path_or_name, pid_p != NULL);
+
+  while ((ret = exec_wrapper_impl(path_or_name, argv, envp, perform_path_search, pid_p, file_actions, attrp,
+                                  &arena, &exec, &memfd, &link_slot, &next)) == EXEC_NEXT) {
+    if (++reexecs > EXEC_MAX_REEXECS) {
+      ret = exec_error(pid_p, ELOOP);
+      break;
+    }
+
+    path_or_name        = next.path;
+    argv                = next.argv;
+    envp                = next.envp;
+    perform_path_search = false;
+  }
+
+  saved_errno = errno;
+
+  // posix_spawn() only returns after the child has called execve() (or has its own copy of the fd table),
+  // the memfd can be closed safely here
+  if (memfd > 0) close(memfd);
+
+  // the spawned linker holds its link slot through its own copy of the descriptor (see link-jobs.c)
+  if (link_slot != -1) close(link_slot);
+  close_executable(&exec);
+  arena_release(&arena);
+
+  // exec*() only return on failure
+  stats_exec_end(pid_p == NULL || ret != 0);
+  trace_exec_end(pid_p == NULL || ret != 0);
+  account_exec_end(pid_p, pid_p == NULL || ret != 0);
+
+  errno = saved_errno;
+  return ret;
 }
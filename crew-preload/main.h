@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include <dirent.h>
 #include <dlfcn.h>
+#include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
@@ -25,12 +26,21 @@
 #include <unistd.h>
 #include <gnu/libc-version.h>
 #include <linux/limits.h>
+#include <time.h>
 #include <sys/auxv.h>
+#include <sys/file.h>
 #include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/syscall.h>
 #include <sys/utsname.h>
+#include <sys/wait.h>
 
+#include "account.h"
 #include "legacy-stat.h"
+#include "manifest.h"
+#include "rules.h"
+#include "stats.h"
+#include "trace.h"
 
 #ifndef SYS_memfd_create
 #if defined(__arm__)
@@ -44,6 +54,18 @@
 #endif
 #endif
 
+#ifndef SYS_copy_file_range
+#if defined(__arm__)
+#define SYS_copy_file_range 391
+#elif defined(__i386__)
+#define SYS_copy_file_range 377
+#elif defined(__aarch64__)
+#define SYS_copy_file_range 285
+#elif defined(__x86_64__)
+#define SYS_copy_file_range 326
+#endif
+#endif
+
 #ifndef CREW_PREFIX
 #define CREW_PREFIX "/usr/local"
 #endif
@@ -74,19 +96,140 @@
 #endif
 #endif
 
+// longest interpreter path kept by get_elf_information(), longer ones are truncated (they can never be
+// CREW_GLIBC_INTERPRETER, which is all they are compared to)
+#define ELF_INTERP_MAX 256
+
 struct ElfInfo {
-  bool is_64bit;
-  bool is_dyn_exec;
-  int  size;
-  char *interpreter,
-       *string_table;
-  void *interp_proghdr, // offset of PT_INTERP section in program header
-       *interp_sechdr;  // offset of .interp section in section header
+  bool  is_64bit,
+        is_dyn_exec;
+  off_t size,
+        interp_proghdr_offset; // file offset of the PT_INTERP program header, 0 if none
+
+  // copies of the headers that are modified by change_elf_interpreter()
+  union {
+    Elf32_Ehdr elf32;
+    Elf64_Ehdr elf64;
+  } elf_header;
+
+  union {
+    Elf32_Phdr elf32;
+    Elf64_Phdr elf64;
+  } interp_proghdr;
+
+  char  interpreter[ELF_INTERP_MAX];
+};
+
+#define DECISION_PATH_MAX 256
+
+enum ExecType {
+  EXEC_TYPE_OTHER,
+  EXEC_TYPE_ELF,
+  EXEC_TYPE_SCRIPT
+};
+
+// identity of a file's content, used to validate cached data
+struct FileId {
+  uint64_t dev,
+           ino,
+           size,
+           mode;
+  int64_t  mtime_sec,
+           mtime_nsec;
 };
 
+// everything exec_wrapper() needs to know about an executable, see decision-cache.c
+struct ExecDecision {
+  uint8_t       type;
+  bool          is_dyn_exec,
+                is_system,
+                is_libc,
+                rewrite_interp; // executable needs to be executed with Chromebrew's dynamic linker
+  char          *target,                    // fully resolved executable path, in the caller's path buffer (PATH_MAX bytes)
+                shebang[DECISION_PATH_MAX]; // shebang line of scripts (without "#!"), the kernel reads no more either
+  struct FileId target_id;
+};
+
+// per-call allocator of exec_wrapper(), see arena_alloc()
+struct ExecArena {
+  char   buf[4096] __attribute__ ((aligned(16)));
+  char   path[PATH_MAX]; // the one path buffer of exec_wrapper_impl(): found in PATH, resolved, then what is executed
+  size_t used;
+  void   *chunks; // heap allocated chunks (for anything that does not fit into buf), linked through their first pointer
+};
+
+// number of bytes read from the beginning of every executable (ELF header, program headers, interpreter or shebang)
+#define EXEC_HEAD_SIZE 4096
+
+// executable opened by exec_wrapper(), released by close_executable()
+struct OpenedExec {
+  int    fd;
+  size_t head_len;
+  char   head[EXEC_HEAD_SIZE] __attribute__ ((aligned(16)));
+};
+
+// rules matching a path, see rule_match()
+struct RuleMatch {
+  uint16_t          flags;        // combined flags of all matching rules (enum PreloadRuleFlag)
+  const char        *path;
+  const struct Rule *redirect,    // rules providing the replacement for redirect/fallback, NULL if none
+                    *fallback;
+  size_t            redirect_len, // length of the pattern they matched
+                    fallback_len;
+};
+
+// number of arguments/environment variables exec_wrapper() might add
+#define EXEC_EXTRA_ARGS 8
+#define EXEC_EXTRA_ENVS 2
+
+// scripts re-executed with their interpreter (or the command of #!/usr/bin/env) by one exec_wrapper() call before it
+// fails with ELOOP, far more than the kernel follows (see exec_wrapper())
+#define EXEC_MAX_REEXECS 16
+
+// per-thread state, crew-preload.so is always loaded at startup so its TLS can be part of the static TLS block
+#define THREAD_LOCAL __thread __attribute__ ((tls_model("initial-exec")))
+
+static inline void file_id_from_stat(const struct stat *file_info, struct FileId *id) {
+  id->dev        = file_info->st_dev;
+  id->ino        = file_info->st_ino;
+  id->size       = file_info->st_size;
+  id->mode       = file_info->st_mode;
+  id->mtime_sec  = file_info->st_mtim.tv_sec;
+  id->mtime_nsec = file_info->st_mtim.tv_nsec;
+}
+
+// count calls that enter the kernel for statistics (see stats.c), must come after all system headers
+extern THREAD_LOCAL uint32_t syscall_count;
+
+#define COUNT_SYSCALL(call) (syscall_count++, call)
+#define __fxstat(...)       COUNT_SYSCALL(__fxstat(__VA_ARGS__))
+#define __fxstatat(...)     COUNT_SYSCALL(__fxstatat(__VA_ARGS__))
+#define __xstat(...)        COUNT_SYSCALL(__xstat(__VA_ARGS__))
+#define access(...)         COUNT_SYSCALL(access(__VA_ARGS__))
+#define close(...)          COUNT_SYSCALL(close(__VA_ARGS__))
+#define closedir(...)       COUNT_SYSCALL(closedir(__VA_ARGS__))
+#define flock(...)          COUNT_SYSCALL(flock(__VA_ARGS__))
+#define ftruncate(...)      COUNT_SYSCALL(ftruncate(__VA_ARGS__))
+#define getcwd(...)         COUNT_SYSCALL(getcwd(__VA_ARGS__))
+#define lseek(...)          COUNT_SYSCALL(lseek(__VA_ARGS__))
+#define mkdir(...)          COUNT_SYSCALL(mkdir(__VA_ARGS__))
+#define mmap(...)           COUNT_SYSCALL(mmap(__VA_ARGS__))
+#define munmap(...)         COUNT_SYSCALL(munmap(__VA_ARGS__))
+#define open(...)           COUNT_SYSCALL(open(__VA_ARGS__))
+#define opendir(...)        COUNT_SYSCALL(opendir(__VA_ARGS__))
+#define pread(...)          COUNT_SYSCALL(pread(__VA_ARGS__))
+#define pwrite(...)         COUNT_SYSCALL(pwrite(__VA_ARGS__))
+#define realpath(...)       COUNT_SYSCALL(realpath(__VA_ARGS__))
+#define rename(...)         COUNT_SYSCALL(rename(__VA_ARGS__))
+#define sendfile(...)       COUNT_SYSCALL(sendfile(__VA_ARGS__))
+#define syscall(...)        COUNT_SYSCALL(syscall(__VA_ARGS__))
+#define unlink(...)         COUNT_SYSCALL(unlink(__VA_ARGS__))
+#define unlinkat(...)       COUNT_SYSCALL(unlinkat(__VA_ARGS__))
+#define utimensat(...)      COUNT_SYSCALL(utimensat(__VA_ARGS__))
+
 extern char **environ;
 
-extern bool disabled, initialized;
+extern bool  disabled, initialized, no_crew_cmd, no_crew_glibc, no_shell_bypass, verbose;
 
 extern int (*orig_execl)(const char *path, const char *arg, ...);
 extern int (*orig_execle)(const char *path, const char *arg, ...);
@@ -103,12 +246,64 @@ extern int (*orig_posix_spawnp)(pid_t *pid, const char *file,
                                 const posix_spawn_file_actions_t *file_actions,
                                 const posix_spawnattr_t *attrp,
                                 char *const *argv, char *const *envp);
+extern int   (*orig_system)(const char *command);
+extern FILE *(*orig_popen)(const char *command, const char *mode);
+extern int   (*orig_pclose)(FILE *stream);
+extern pid_t (*orig_waitpid)(pid_t pid, int *status, int options);
+extern pid_t (*orig_wait4)(pid_t pid, int *status, int options, struct rusage *usage);
+extern int   (*orig_waitid)(idtype_t idtype, id_t id, siginfo_t *info, int options);
 
 void preload_init(void) __attribute__ ((constructor));
+void exec_init(void);
 int  count_args(va_list argp);
 void va2array(va_list argp, int argc, char **argv);
+int  count_array(char * const* array);
 int  copy2array(char * const* src, char **dest, int offset);
+const char *getenvfp(char **envp, const char *name);
+int  unsetenvfp(char **envp, const char *name);
+int  search_in_path(const char *file, char *result);
+int   get_elf_information(const char *exec_path, int exec_fd, const char *head, size_t head_len, off_t size, struct ElfInfo *output);
+off_t change_elf_interpreter(const char *exec_path, int output_fd, int exec_fd, const struct ElfInfo *elf_info);
+int   exec_cache_lookup(char *exec_path, const struct FileId *id);
+int   exec_cache_store(char *exec_path, int exec_fd, const struct FileId *id, const struct ElfInfo *elf_info);
+int   decision_cache_lookup(const char *key, struct ExecDecision *decision);
+void  decision_cache_store(const char *key, const struct FileId *key_id, const struct ExecDecision *decision);
+void  stats_add(enum PreloadStat stat, uint64_t value);
+void  stats_init_begin(struct timespec *start);
+void  stats_init_end(const struct timespec *start);
+void  stats_exec_begin(bool is_spawn);
+void  stats_exec_ready(void);
+void  stats_exec_end(bool failed);
+uint64_t trace_now(void);
+void  trace_event(enum PreloadTraceEvent event, const char *path, uint64_t start, uint16_t flags);
+void  trace_init_begin(void);
+void  trace_init_end(void);
+void  trace_exec_begin(const char *path, bool is_spawn);
+void  trace_exec_ready(void);
+void  trace_exec_end(bool failed);
+void  account_exec_begin(const char *path, bool is_spawn);
+void  account_exec_target(const char *path);
+void  account_exec_ready(void);
+void  account_exec_end(const void *pid_p, bool failed);
+pid_t account_wait4(pid_t child, int *status, int options, struct rusage *usage);
+int   account_waitid(idtype_t idtype, id_t id, siginfo_t *info, int options);
+int   link_jobs_acquire(char *const *argv, char *const *envp, int *threads);
+int   link_jobs_spawn(int slot_fd, pid_t *pid, const char *path, const posix_spawn_file_actions_t *file_actions,
+                      const posix_spawnattr_t *attrp, char *const *argv, char *const *envp);
+bool  manifest_lookup(const struct FileId *id);
+uint16_t rule_match(const char *path, struct RuleMatch *match);
+uint16_t rule_match_name(const char *name);
+int   rule_replacement(const struct RuleMatch *match, uint16_t kind, char *new_path);
+uint32_t rules_checksum(void);
 int  exec_wrapper(const char *path_or_name, char *const *argv, char *const *envp,
                   bool perform_path_search, void *pid, const void *file_actions, const void *attrp);
+int  system_wrapper(const char *command);
+FILE *popen_wrapper(const char *command, const char *mode);
+int  pclose_wrapper(FILE *stream);
+
+static inline void exec_init_once(void) {
+  // exec_init_once(): called first by every hook, only the first call of a process gets into exec_init()
+  if (!__atomic_load_n(&initialized, __ATOMIC_ACQUIRE)) exec_init();
+}
 
 #endif
@@ -0,0 +1,99 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  manifest.c: Executables known to use Chromebrew's dynamic linker already
+
+  tools/crew-preload-patch rewrites the interpreter of executables under CREW_PREFIX on disk (e.g. when a package
+  is installed) and records all executables that need no rewrite in a sorted manifest (see manifest.h), located at
+  CREW_PRELOAD_MANIFEST (default: ${CREW_PREFIX}/var/lib/crew-preload/native.manifest).
+
+  On a decision cache miss, make_exec_decision() looks up the executable with one binary search and skips opening
+  and parsing it if found. Entries are keyed by (st_ino, st_dev, st_size, st_mtim), so modified executables
+  are never matched.
+*/
+
+#include "./main.h"
+
+static const struct ManifestHeader *manifest       = NULL;
+static bool                        manifest_mapped = false;
+
+static const struct ManifestHeader *map_manifest(void) {
+  // map_manifest(): mapped by the first thread that needs it, the manifest is only published once validated (other
+  //                 threads see none until then)
+  const char                  *manifest_path = getenv("CREW_PRELOAD_MANIFEST") ?: CREW_PREFIX PRELOAD_MANIFEST_PATH;
+  const struct ManifestHeader *header;
+  struct stat                 manifest_info;
+  void                        *mem;
+  int                         fd;
+
+  if (__atomic_exchange_n(&manifest_mapped, true, __ATOMIC_ACQ_REL)) return __atomic_load_n(&manifest, __ATOMIC_ACQUIRE);
+
+  if (manifest_path[0] == '\0' || (fd = open(manifest_path, O_RDONLY | O_CLOEXEC)) == -1) return NULL;
+
+  if (fstat(fd, &manifest_info) == -1 || manifest_info.st_size < (off_t) sizeof(struct ManifestHeader)) {
+    close(fd);
+    return NULL;
+  }
+
+  mem = mmap(NULL, manifest_info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED) return NULL;
+
+  header = mem;
+
+  // a manifest made for another dynamic linker tells nothing about whether executables need to be rewritten
+  if (header->magic != PRELOAD_MANIFEST_MAGIC || header->version != PRELOAD_MANIFEST_VERSION ||
+      header->num_entries > (manifest_info.st_size - sizeof(struct ManifestHeader)) / sizeof(struct ManifestEntry) ||
+      strncmp(header->interpreter, CREW_GLIBC_INTERPRETER, sizeof(header->interpreter)) != 0) {
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: Native manifest %s is invalid or outdated, ignoring\n", getpid(), PROMPT_NAME, manifest_path);
+
+    munmap(mem, manifest_info.st_size);
+    return NULL;
+  }
+
+  __atomic_store_n(&manifest, header, __ATOMIC_RELEASE);
+  return header;
+}
+
+bool manifest_lookup(const struct FileId *id) {
+  // manifest_lookup(): check if the given executable already uses Chromebrew's dynamic linker
+  const struct ManifestHeader *header = map_manifest();
+  const struct ManifestEntry  *entries;
+  struct ManifestEntry        key;
+  uint32_t                    low = 0, high;
+
+  if (header == NULL) return false;
+
+  entries      = (const struct ManifestEntry *) (header + 1);
+  high         = header->num_entries;
+  key.ino      = id->ino;
+  key.dev      = id->dev;
+  key.size     = id->size;
+  key.mtime_ns = id->mtime_sec * 1000000000ll + id->mtime_nsec;
+
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    int      cmp = manifest_compare(&entries[mid], &key);
+
+    if (cmp == 0) {
+      stats_add(STAT_MANIFEST_HITS, 1);
+      return true;
+    }
+
+    if (cmp < 0) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,55 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  manifest.h: Layout of the native manifest (see manifest.c), written by tools/crew-preload-patch.c
+
+  The manifest lists executables that already use Chromebrew's dynamic linker, identified by inode, device, size
+  and modification time, so crew-preload.so can skip reading them. Entries are sorted (see manifest_compare()).
+
+    | struct ManifestHeader | struct ManifestEntry[num_entries] |
+*/
+
+#ifndef MANIFEST_H_INCLUDED
+#define MANIFEST_H_INCLUDED
+
+#include <stdint.h>
+
+#define PRELOAD_MANIFEST_MAGIC   0x4352504d // "CRPM"
+#define PRELOAD_MANIFEST_VERSION 1
+
+// default location, relative to CREW_PREFIX
+#define PRELOAD_MANIFEST_PATH    "/var/lib/crew-preload/native.manifest"
+
+// all fields have fixed size as the manifest is shared between 32-bit and 64-bit processes
+struct ManifestHeader {
+  uint32_t magic,
+           version,
+           num_entries,
+           padding;
+  char     interpreter[240]; // CREW_GLIBC_INTERPRETER the manifest was created for
+};
+
+struct ManifestEntry {
+  uint64_t ino,
+           dev,
+           size;
+  int64_t  mtime_ns;
+};
+
+static inline int manifest_compare(const struct ManifestEntry *a, const struct ManifestEntry *b) {
+  if (a->ino != b->ino)           return (a->ino > b->ino) ? 1 : -1;
+  if (a->dev != b->dev)           return (a->dev > b->dev) ? 1 : -1;
+  if (a->size != b->size)         return (a->size > b->size) ? 1 : -1;
+  if (a->mtime_ns != b->mtime_ns) return (a->mtime_ns > b->mtime_ns) ? 1 : -1;
+
+  return 0;
+}
+
+#endif
@@ -0,0 +1,481 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  path-index.c: PATH resolution for exec*p()/posix_spawnp()
+
+  make and libtool spawn commands by bare name all the time, resolving each of them with access() calls would cost
+  up to two syscalls per PATH entry. Instead, starting from the second lookup in a process, the entries of every
+  (absolute) PATH directory are read once into a hash set, so a lookup costs a few hash probes plus one access()
+  call for the matching file. Directories that can be searched but not read are searched with access() instead.
+
+  Names that cannot be found in any directory are kept in a small negative cache, repeated lookups of them cost a
+  hash probe plus one stat() per indexed directory (see below).
+
+  Invalidation:
+    - All indexes are dropped when $PATH changes
+    - Directories are stat()-ed again at most once per second, a directory is re-read if its mtime has changed
+      (and the negative cache is cleared)
+    - Before a name is reported missing (by the index or the negative cache), all directories are stat()-ed again
+      regardless of the last time, so that a command installed a moment ago is found right away
+
+  The index belongs to the calling process only. Threads share it through a reader/writer lock that is only ever
+  tried, never waited for: lookups read the index concurrently, loading a new PATH, revalidating or indexing a
+  directory needs it exclusively. A thread that cannot get the lock it needs searches with plain access() calls
+  instead (so does a child forked while another thread was using the index, until it executes something). Negative
+  cache entries are written under the read lock, each of them is guarded by its own sequence counter.
+*/
+
+#include "./main.h"
+
+#define PATH_INDEX_THRESHOLD    2   // build indexes starting from the n-th lookup in a process
+#define PATH_INDEX_REVALIDATE   1   // seconds between two stat() calls on the same directory
+#define PATH_NEGATIVE_ENTRIES   128
+#define PATH_NEGATIVE_NAME_MAX  64
+
+struct PathDirEntry {
+  uint32_t hash,
+           name_offset;
+};
+
+struct PathDir {
+  char                *path;
+  size_t              path_len;
+  bool                indexed,
+                      missing,      // does not exist
+                      unreadable;   // exists but cannot be listed (search permission only), searched with access()
+  struct timespec     mtime;
+  struct PathDirEntry *table;       // open addressing hash set, table_mask + 1 slots
+  uint32_t            table_mask;
+  char                *names;       // NUL-separated entry names
+};
+
+struct PathNegativeEntry {
+  uint32_t seq,        // odd while the entry is being written
+           hash,
+           generation;
+  char     name[PATH_NEGATIVE_NAME_MAX];
+};
+
+static struct PathDir           *dirs          = NULL;
+static int                      num_dirs       = 0;
+static char                     *indexed_path  = NULL;
+static uint32_t                 generation     = 1,
+                                lookups        = 0;
+static time_t                   last_validated = 0;
+static int32_t                  index_users    = 0; // number of readers, -1 while a thread has it exclusively
+static struct PathNegativeEntry negative_cache[PATH_NEGATIVE_ENTRIES];
+
+static uint32_t hash_name(const char *name) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+
+  while (*name) hash = (hash ^ (uint8_t) *name++) * 16777619u;
+
+  // hash 0 marks an empty slot
+  return hash ?: 1;
+}
+
+static bool index_read_lock(void) {
+  int32_t users = __atomic_load_n(&index_users, __ATOMIC_RELAXED);
+
+  while (users >= 0) {
+    if (__atomic_compare_exchange_n(&index_users, &users, users + 1, true, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) return true;
+  }
+
+  return false;
+}
+
+static bool index_write_lock(void) {
+  int32_t unused = 0;
+
+  return __atomic_compare_exchange_n(&index_users, &unused, -1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED);
+}
+
+static void index_read_unlock(void) { __atomic_sub_fetch(&index_users, 1, __ATOMIC_RELEASE); }
+static void index_write_unlock(void) { __atomic_store_n(&index_users, 0, __ATOMIC_RELEASE); }
+
+static const char *default_search_path(void) {
+  // default_search_path(): value used by glibc when PATH is not set
+  static char cs_path[256];
+  size_t      len;
+
+  if (cs_path[0] == '\0' && ((len = confstr(_CS_PATH, cs_path, sizeof(cs_path))) == 0 || len > sizeof(cs_path))) {
+    strcpy(cs_path, "/bin:/usr/bin");
+  }
+
+  return cs_path;
+}
+
+static void drop_dir_index(struct PathDir *dir) {
+  free(dir->table);
+  free(dir->names);
+
+  dir->table   = NULL;
+  dir->names   = NULL;
+  dir->indexed = false;
+}
+
+static void build_dir_index(struct PathDir *dir) {
+  // build_dir_index(): read all entries of dir into a hash set
+  struct dirent *entry    = NULL;
+  struct stat   dir_info;
+  size_t        names_len = 0, names_size = 4096, num_entries = 0, max_entries = 256;
+  uint32_t      *offsets;
+  DIR           *dir_stream;
+
+  drop_dir_index(dir);
+  dir->indexed    = true;
+  dir->missing    = false;
+  dir->unreadable = false;
+
+  if ((dir_stream = opendir(dir->path)) == NULL) {
+    // a directory that exists but cannot be read is searched with access(), its mtime still tells when it changed
+    if (errno == ENOENT || errno == ENOTDIR || stat(dir->path, &dir_info) == -1) {
+      dir->missing = true;
+    } else {
+      dir->unreadable = true;
+      dir->mtime      = dir_info.st_mtim;
+    }
+
+    return;
+  }
+
+  // take mtime before reading, so that files created while reading will cause a rebuild later
+  if (fstat(dirfd(dir_stream), &dir_info) == -1) {
+    closedir(dir_stream);
+    dir->missing = true;
+    return;
+  }
+
+  dir->mtime = dir_info.st_mtim;
+  dir->names = malloc(names_size);
+  offsets    = malloc(max_entries * sizeof(uint32_t));
+
+  while (dir->names && offsets && (entry = readdir(dir_stream))) {
+    size_t len = strlen(entry->d_name) + 1;
+
+    if (entry->d_name[0] == '.' && (entry->d_name[1] == '\0' || (entry->d_name[1] == '.' && entry->d_name[2] == '\0'))) continue;
+
+    if (names_len + len > names_size) {
+      char *new_names = realloc(dir->names, names_size *= 2);
+
+      if (new_names == NULL) break;
+      dir->names = new_names;
+    }
+
+    if (num_entries == max_entries) {
+      uint32_t *new_offsets = realloc(offsets, (max_entries *= 2) * sizeof(uint32_t));
+
+      if (new_offsets == NULL) break;
+      offsets = new_offsets;
+    }
+
+    memcpy(dir->names + names_len, entry->d_name, len);
+    offsets[num_entries++] = names_len;
+    names_len             += len;
+  }
+
+  closedir(dir_stream);
+
+  // keep load factor <= 0.5
+  dir->table_mask = 15;
+  while (dir->table_mask + 1 < num_entries * 2) dir->table_mask = dir->table_mask * 2 + 1;
+
+  if (entry != NULL || dir->names == NULL || offsets == NULL ||
+      (dir->table = calloc(dir->table_mask + 1, sizeof(struct PathDirEntry))) == NULL) {
+    // out of memory, use access() for this directory
+    free(offsets);
+    drop_dir_index(dir);
+    return;
+  }
+
+  for (size_t i = 0; i < num_entries; i++) {
+    uint32_t hash = hash_name(dir->names + offsets[i]), slot = hash & dir->table_mask;
+
+    while (dir->table[slot].hash != 0) slot = (slot + 1) & dir->table_mask;
+
+    dir->table[slot].hash        = hash;
+    dir->table[slot].name_offset = offsets[i];
+  }
+
+  free(offsets);
+
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: Indexed %zu entries in %s\n", getpid(), PROMPT_NAME, num_entries, dir->path);
+}
+
+static bool dir_index_contains(const struct PathDir *dir, const char *name, uint32_t hash) {
+  if (dir->missing || dir->unreadable) return false;
+
+  for (uint32_t slot = hash & dir->table_mask; dir->table[slot].hash != 0; slot = (slot + 1) & dir->table_mask) {
+    if (dir->table[slot].hash == hash && strcmp(dir->names + dir->table[slot].name_offset, name) == 0) return true;
+  }
+
+  return false;
+}
+
+static void load_search_path(const char *path_env) {
+  // load_search_path(): split path_env into directories, previous indexes are dropped
+  char *search_path, *saveptr;
+  int  max_dirs = 1;
+
+  for (int i = 0; i < num_dirs; i++) {
+    drop_dir_index(&dirs[i]);
+    free(dirs[i].path);
+  }
+
+  free(dirs);
+  free(indexed_path);
+
+  dirs         = NULL;
+  num_dirs     = 0;
+  indexed_path = strdup(path_env);
+  generation++;
+
+  if (indexed_path == NULL || (search_path = strdup(path_env)) == NULL) return;
+
+  // PATH cannot have more directories than separators + 1
+  for (const char *p = path_env; *p; p++) if (*p == ':') max_dirs++;
+
+  if ((dirs = calloc(max_dirs, sizeof(struct PathDir))) == NULL) {
+    free(search_path);
+    return;
+  }
+
+  for (char *dir = strtok_r(search_path, ":", &saveptr); dir; dir = strtok_r(NULL, ":", &saveptr)) {
+    if ((dirs[num_dirs].path = strdup(dir)) == NULL) break;
+
+    dirs[num_dirs++].path_len = strlen(dir);
+  }
+
+  free(search_path);
+}
+
+static void revalidate_dirs(time_t now, bool force) {
+  // revalidate_dirs(): drop the indexes of directories that were modified since they were indexed
+  if (!force && now - last_validated < PATH_INDEX_REVALIDATE) return;
+  last_validated = now;
+
+  for (int i = 0; i < num_dirs; i++) {
+    struct stat dir_info;
+    bool        exists;
+
+    if (!dirs[i].indexed) continue;
+
+    exists = (stat(dirs[i].path, &dir_info) == 0);
+
+    if (exists == !dirs[i].missing && (!exists || (dir_info.st_mtim.tv_sec == dirs[i].mtime.tv_sec &&
+                                                   dir_info.st_mtim.tv_nsec == dirs[i].mtime.tv_nsec))) continue;
+
+    if (verbose) fprintf(stderr, "[PID %-7i] %s: %s was modified, dropping its index\n", getpid(), PROMPT_NAME, dirs[i].path);
+
+    drop_dir_index(&dirs[i]);
+    generation++;
+  }
+}
+
+static int search_with_access(const char *dir, const char *file, char *result, int *return_value) {
+  // search_with_access(): check if dir/file is an executable by access(), returns 0 if it is
+  if (snprintf(result, PATH_MAX, "%s/%s", dir, file) >= PATH_MAX) return -1;
+
+  if (access(result, X_OK) == 0) {
+    // file found in path and it is executable
+    return 0;
+  } else if (access(result, F_OK) == 0) {
+    // file found in path but it is not executable
+    *return_value = EACCES;
+  }
+
+  return -1;
+}
+
+static int search_uncached(const char *path_env, const char *file, char *result) {
+  // search_uncached(): search without touching the index, used when the index cannot be locked
+  char *search_path = strdup(path_env), *saveptr;
+  int  return_value = ENOENT;
+
+  if (search_path == NULL) return ENOMEM;
+
+  for (char *dir = strtok_r(search_path, ":", &saveptr); dir; dir = strtok_r(NULL, ":", &saveptr)) {
+    if (search_with_access(dir, file, result, &return_value) == 0) {
+      return_value = 0;
+      break;
+    }
+  }
+
+  free(search_path);
+  return return_value;
+}
+
+static bool negative_cache_contains(const struct PathNegativeEntry *negative, const char *file, uint32_t hash) {
+  // negative_cache_contains(): name was not found in any directory, and none of them was modified since then
+  char     name[PATH_NEGATIVE_NAME_MAX];
+  uint32_t seq = __atomic_load_n(&negative->seq, __ATOMIC_ACQUIRE), entry_hash, entry_generation;
+
+  if (seq & 1) return false;
+
+  entry_hash       = __atomic_load_n(&negative->hash, __ATOMIC_RELAXED);
+  entry_generation = __atomic_load_n(&negative->generation, __ATOMIC_RELAXED);
+  memcpy(name, negative->name, sizeof(name));
+
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&negative->seq, __ATOMIC_RELAXED) != seq) return false;
+
+  return entry_hash == hash && entry_generation == generation && strncmp(name, file, sizeof(name)) == 0;
+}
+
+static void negative_cache_add(struct PathNegativeEntry *negative, const char *file, uint32_t hash) {
+  // negative_cache_add(): skipped if another thread is writing the same entry
+  uint32_t seq = __atomic_load_n(&negative->seq, __ATOMIC_RELAXED);
+
+  if ((seq & 1) || !__atomic_compare_exchange_n(&negative->seq, &seq, seq + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) return;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  __atomic_store_n(&negative->hash, hash, __ATOMIC_RELAXED);
+  __atomic_store_n(&negative->generation, generation, __ATOMIC_RELAXED);
+  strcpy(negative->name, file);
+
+  __atomic_store_n(&negative->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+static int update_index(const char *path_env, time_t now, int dir_num, bool force) {
+  // update_index(): exchange the read lock for the write lock to load path_env, revalidate directories (now if force)
+  //                 and index dirs[dir_num] (if >= 0), then read-lock it again; returns 0 if the index is as before,
+  //                 1 if it has changed, -1 if it is not locked anymore (it could not be locked again, or a forced
+  //                 revalidation could not be done)
+  uint32_t seen    = generation;
+  bool     updated = false;
+
+  index_read_unlock();
+
+  if (index_write_lock()) {
+    if (indexed_path == NULL || strcmp(indexed_path, path_env) != 0) load_search_path(path_env);
+    revalidate_dirs(now, force);
+
+    if (dir_num >= 0 && generation == seen && !dirs[dir_num].indexed) build_dir_index(&dirs[dir_num]);
+
+    index_write_unlock();
+    updated = true;
+  }
+
+  if (!index_read_lock()) return -1;
+
+  if (force && !updated) {
+    index_read_unlock();
+    return -1;
+  }
+
+  return generation != seen;
+}
+
+static int search_indexed(const char *file, char *result) {
+  const char               *path_env = getenv("PATH") ?: default_search_path();
+  uint32_t                 hash      = hash_name(file), count;
+  struct PathNegativeEntry *negative = &negative_cache[hash % PATH_NEGATIVE_ENTRIES];
+  time_t                   now       = time(NULL);
+  bool                     all_indexed, revalidated = false;
+  int                      return_value;
+
+  stats_add(STAT_PATH_LOOKUPS, 1);
+
+  if ((count = __atomic_load_n(&lookups, __ATOMIC_RELAXED)) < PATH_INDEX_THRESHOLD) {
+    count = __atomic_add_fetch(&lookups, 1, __ATOMIC_RELAXED);
+  }
+
+  if (!index_read_lock()) return search_uncached(path_env, file, result);
+
+  // a new PATH or a due revalidation cannot wait: if the write lock cannot be taken, the index might be outdated
+  if (indexed_path == NULL || strcmp(indexed_path, path_env) != 0 || now - last_validated >= PATH_INDEX_REVALIDATE) {
+    if (update_index(path_env, now, -1, false) == -1) return search_uncached(path_env, file, result);
+
+    if (indexed_path == NULL || strcmp(indexed_path, path_env) != 0 || now - last_validated >= PATH_INDEX_REVALIDATE) {
+      index_read_unlock();
+      return search_uncached(path_env, file, result);
+    }
+  }
+
+restart:
+  all_indexed  = true;
+  return_value = ENOENT;
+
+  // names that were not found might have been installed since the last revalidation, only hits take the cheap path
+  if (negative_cache_contains(negative, file, hash)) {
+    switch (update_index(path_env, now, -1, true)) {
+      case -1: return search_uncached(path_env, file, result);
+      case 1:  revalidated = true; goto restart;
+    }
+
+    index_read_unlock();
+    stats_add(STAT_PATH_NEGATIVE_HITS, 1);
+    return ENOENT;
+  }
+
+  for (int i = 0; i < num_dirs; i++) {
+    struct PathDir *dir = &dirs[i];
+
+    // relative directories depend on the working directory, never index them
+    if (!dir->indexed && dir->path[0] == '/' && count >= PATH_INDEX_THRESHOLD) {
+      switch (update_index(path_env, now, i, false)) {
+        case -1: return search_uncached(path_env, file, result);
+        case 1:  goto restart;
+      }
+    }
+
+    if (!dir->indexed || dir->unreadable) {
+      all_indexed = false;
+
+      if (search_with_access(dir->path, file, result, &return_value) == 0) {
+        return_value = 0;
+        break;
+      }
+    } else if (dir_index_contains(dir, file, hash)) {
+      if (dir->path_len + strlen(file) + 2 > PATH_MAX) continue;
+
+      memcpy(result, dir->path, dir->path_len);
+      result[dir->path_len] = '/';
+      strcpy(result + dir->path_len + 1, file);
+
+      if (access(result, X_OK) == 0) {
+        return_value = 0;
+        break;
+      }
+
+      // file found in path but it is not executable
+      return_value = EACCES;
+    }
+  }
+
+  if (return_value == ENOENT && !revalidated) {
+    revalidated = true;
+
+    switch (update_index(path_env, now, -1, true)) {
+      case -1: return search_uncached(path_env, file, result);
+      case 1:  goto restart;
+    }
+  }
+
+  if (return_value == ENOENT && all_indexed && strlen(file) < PATH_NEGATIVE_NAME_MAX) negative_cache_add(negative, file, hash);
+
+  index_read_unlock();
+
+  if (verbose && return_value == 0) fprintf(stderr, "[PID %-7i] %s: %s => %s\n", getpid(), PROMPT_NAME, file, result);
+  return return_value;
+}
+
+int search_in_path(const char *file, char *result) {
+  // search_in_path: search given filename in PATH environment variable,
+  //                 full path will be written to the memory address that is pointed by the `result` pointer
+  //
+  //                 returns 0 on success, an errno value otherwise
+  uint64_t trace_start = trace_now();
+  int      ret         = search_indexed(file, result);
+
+  trace_event(TRACE_PATH_LOOKUP, file, trace_start, ret ? TRACE_FLAG_FAILED : 0);
+  return ret;
+}
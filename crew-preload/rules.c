@@ -0,0 +1,183 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  rules.c: Path rewrite rules (redirections of system commands, system/linker detection)
+
+  Rules are written in the format described in default.rules and compiled by tools/crew-preload-rules into a trie
+  (see rules.h). default.rules is compiled into this library, a different rule set can be used by compiling it
+  and pointing CREW_PRELOAD_RULES to the output, which is mapped into memory as-is.
+
+  Matching walks the trie once per path (one binary search among the children of each node), without parsing or
+  allocating anything, so the cost depends on the length of the path rather than the number of rules.
+*/
+
+#include "./main.h"
+#include "./builtin-rules.h"
+
+static const struct RuleTable *rule_table  = NULL;
+static bool                   rules_loaded = false;
+
+static bool valid_rule_table(const struct RuleTable *table, size_t size) {
+  // valid_rule_table(): check that all regions lie within the table, everything else is checked during lookups
+  const char *strings = (const char *) table + table->strings_offset;
+
+  return size >= sizeof(struct RuleTable) &&
+         table->magic == PRELOAD_RULES_MAGIC && table->version == PRELOAD_RULES_VERSION && table->size == size &&
+         table->nodes_offset >= sizeof(struct RuleTable) && table->nodes_offset % 4 == 0 && table->rules_offset % 4 == 0 &&
+         table->num_nodes <= (size - table->nodes_offset) / sizeof(struct RuleNode) &&
+         table->rules_offset >= table->nodes_offset + table->num_nodes * sizeof(struct RuleNode) &&
+         table->num_rules <= (size - table->rules_offset) / sizeof(struct Rule) &&
+         table->strings_offset >= table->rules_offset + table->num_rules * sizeof(struct Rule) &&
+         table->strings_offset < size && table->strings_size == size - table->strings_offset &&
+         strings[table->strings_size - 1] == '\0' &&
+         table->path_root < table->num_nodes && table->name_root < table->num_nodes;
+}
+
+static const struct RuleTable *load_rules(void) {
+  // load_rules(): map the rule table given by CREW_PRELOAD_RULES, fall back to the builtin one
+  const char  *rules_path = getenv("CREW_PRELOAD_RULES");
+  struct stat rules_info;
+  void        *mem;
+  int         fd;
+
+  if (rules_loaded) return rule_table;
+  rules_loaded = true;
+  rule_table   = (const struct RuleTable *) builtin_rules;
+
+  if (rules_path == NULL || rules_path[0] == '\0') return rule_table;
+
+  if ((fd = open(rules_path, O_RDONLY | O_CLOEXEC)) == -1) {
+    fprintf(stderr, "[PID %-7i] %s: Failed to open rule file %s (%s), using builtin rules\n", getpid(), PROMPT_NAME, rules_path, strerror(errno));
+    return rule_table;
+  }
+
+  if (fstat(fd, &rules_info) == -1 || rules_info.st_size < (off_t) sizeof(struct RuleTable)) {
+    close(fd);
+    fprintf(stderr, "[PID %-7i] %s: Rule file %s is invalid, using builtin rules\n", getpid(), PROMPT_NAME, rules_path);
+    return rule_table;
+  }
+
+  mem = mmap(NULL, rules_info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED) return rule_table;
+
+  if (!valid_rule_table(mem, rules_info.st_size)) {
+    fprintf(stderr, "[PID %-7i] %s: Rule file %s is invalid, using builtin rules\n", getpid(), PROMPT_NAME, rules_path);
+    munmap(mem, rules_info.st_size);
+    return rule_table;
+  }
+
+  if (verbose) fprintf(stderr, "[PID %-7i] %s: Using rules from %s\n", getpid(), PROMPT_NAME, rules_path);
+
+  rule_table = mem;
+  return rule_table;
+}
+
+static inline const struct RuleNode *rule_node(const struct RuleTable *table, uint32_t index) {
+  return (const struct RuleNode *) ((const char *) table + table->nodes_offset) + index;
+}
+
+static inline const struct Rule *rule_at(const struct RuleTable *table, uint16_t index) {
+  if (index == 0 || index >= table->num_rules) return NULL;
+  return (const struct Rule *) ((const char *) table + table->rules_offset) + index;
+}
+
+static const struct RuleNode *rule_child(const struct RuleTable *table, const struct RuleNode *node, uint8_t label) {
+  // rule_child(): binary search among the (sorted) children of node
+  uint32_t low = node->first_child, high = node->first_child + node->num_children;
+
+  if (high > table->num_nodes) return NULL;
+
+  while (low < high) {
+    uint32_t              mid   = low + (high - low) / 2;
+    const struct RuleNode *child = rule_node(table, mid);
+
+    if (child->label == label) return child;
+
+    if (child->label < label) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+
+  return NULL;
+}
+
+static void apply_rule(struct RuleMatch *match, const struct Rule *rule, size_t matched_len) {
+  // apply_rule(): combine flags, longer patterns take precedence for redirect/fallback replacements
+  if (rule == NULL) return;
+
+  match->flags |= rule->flags;
+
+  if (rule->flags & RULE_REDIRECT) {
+    match->redirect     = rule;
+    match->redirect_len = matched_len;
+  }
+
+  if (rule->flags & RULE_FALLBACK) {
+    match->fallback     = rule;
+    match->fallback_len = matched_len;
+  }
+}
+
+uint16_t rule_match(const char *path, struct RuleMatch *match) {
+  // rule_match(): find all rules matching an absolute path, returns the combined flags
+  const struct RuleTable *table = load_rules();
+  const struct RuleNode  *node  = rule_node(table, table->path_root);
+  size_t                 i;
+
+  memset(match, 0, sizeof(*match));
+  match->path = path;
+
+  for (i = 0; path[i]; i++) {
+    apply_rule(match, rule_at(table, node->prefix_rule), i);
+    if ((node = rule_child(table, node, path[i])) == NULL) return match->flags;
+  }
+
+  apply_rule(match, rule_at(table, node->prefix_rule), i);
+  apply_rule(match, rule_at(table, node->exact_rule), i);
+
+  return match->flags;
+}
+
+uint16_t rule_match_name(const char *name) {
+  // rule_match_name(): flags of the rule matching an executable name (e.g. linker)
+  const struct RuleTable *table = load_rules();
+  const struct RuleNode  *node  = rule_node(table, table->name_root);
+  const struct Rule      *rule;
+
+  for (size_t i = 0; name[i]; i++) {
+    if ((node = rule_child(table, node, name[i])) == NULL) return 0;
+  }
+
+  return (rule = rule_at(table, node->exact_rule)) ? rule->flags : 0;
+}
+
+int rule_replacement(const struct RuleMatch *match, uint16_t kind, char *new_path) {
+  // rule_replacement(): build the replacement path of the redirect/fallback rule (kind) of match into new_path,
+  //                     returns -1 if there is none or it does not fit into PATH_MAX
+  const struct RuleTable *table       = load_rules();
+  const struct Rule      *rule        = (kind == RULE_REDIRECT) ? match->redirect : match->fallback;
+  size_t                 matched_len  = (kind == RULE_REDIRECT) ? match->redirect_len : match->fallback_len;
+  const char             *replacement;
+
+  if (rule == NULL || rule->replacement >= table->strings_size) return -1;
+
+  replacement = (const char *) table + table->strings_offset + rule->replacement;
+
+  return (snprintf(new_path, PATH_MAX, "%s%s%s", (rule->flags & RULE_CREW_PREFIX) ? CREW_PREFIX : "", replacement,
+                   (rule->flags & RULE_PREFIX_MATCH) ? match->path + matched_len : "") < PATH_MAX) ? 0 : -1;
+}
+
+uint32_t rules_checksum(void) {
+  return load_rules()->checksum;
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  rules.h: Layout of compiled path rewrite rules (see rules.c), written by tools/crew-preload-rules.c
+
+  A compiled rule table is a trie of all rule patterns: every node holds the children of a pattern prefix
+  (contiguous and sorted by label, so a lookup costs one binary search per character) and the rules whose pattern
+  ends at that node. Path patterns and executable name patterns have separate roots.
+
+    | struct RuleTable | struct RuleNode[num_nodes] | struct Rule[num_rules] | strings (replacements) |
+*/
+
+#ifndef RULES_H_INCLUDED
+#define RULES_H_INCLUDED
+
+#include <stdint.h>
+
+#define PRELOAD_RULES_MAGIC   0x43525052 // "CRPR"
+#define PRELOAD_RULES_VERSION 1
+
+// X(name, bit, keyword in rule files, description)
+#define PRELOAD_RULE_FLAG_LIST(X) \
+  X(REDIRECT,      0, "redirect",      "execute the replacement instead, if it is executable (disabled by CREW_PRELOAD_NO_CREW_CMD)") \
+  X(FALLBACK,      1, "fallback",      "execute the replacement if the path does not exist") \
+  X(SYSTEM,        2, "system",        "system command, execute with LD_LIBRARY_PATH unset") \
+  X(NO_CREW_GLIBC, 3, "no-crew-glibc", "never execute with Chromebrew's dynamic linker") \
+  X(LINKER,        4, "linker",        "linker, see CREW_PRELOAD_ENABLE_COMPILE_HACKS")
+
+enum PreloadRuleFlag {
+#define X(name, bit, keyword, description) RULE_##name = (1 << bit),
+  PRELOAD_RULE_FLAG_LIST(X)
+#undef X
+
+  // set by the compiler
+  RULE_CREW_PREFIX  = (1 << 14), // replacement starts with CREW_PREFIX (substituted at runtime)
+  RULE_PREFIX_MATCH = (1 << 15)  // pattern matches every path starting with it, the rest is appended to the replacement
+};
+
+// all fields have fixed size as the table is shared between 32-bit and 64-bit processes
+struct RuleNode {
+  uint32_t first_child;  // index of the first child node
+  uint16_t num_children,
+           exact_rule,   // index of the rule matching exactly this pattern, 0 if none
+           prefix_rule;  // index of the rule matching everything starting with this pattern, 0 if none
+  uint8_t  label,        // last character of the pattern
+           padding;
+};
+
+struct Rule {
+  uint32_t replacement;  // offset into strings, UINT32_MAX if none
+  uint16_t flags,
+           padding;
+};
+
+struct RuleTable {
+  uint32_t magic,
+           version,
+           checksum,     // FNV-1a of everything after the header, identifies the table in the decision cache
+           size,         // total size of the table in bytes
+           num_nodes,
+           num_rules,    // rule 0 is unused
+           strings_size,
+           path_root,    // root node of path patterns
+           name_root,    // root node of executable name patterns
+           nodes_offset,
+           rules_offset,
+           strings_offset;
+};
+
+#endif
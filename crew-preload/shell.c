@@ -0,0 +1,306 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  shell.c: system()/popen()/pclose() without a shell for simple commands
+
+  glibc runs every system()/popen() command as `/bin/sh -c <command>` (through its internal posix_spawn(), which
+  is not hooked), so a build tool calling `uname -m` pays for starting a shell (redirected to Chromebrew's bash,
+  rewritten like any other executable) before the command itself is executed. Commands that consist of plain words
+  only (no quoting, expansion, redirection, pipes, lists, assignments or shell keywords/builtins) and can be found
+  in PATH are split at blanks and spawned directly through exec_wrapper() instead, everything else still goes to
+  the shell (also through exec_wrapper(), so that the shell is redirected by the same rules as for exec*()).
+
+  Signal handling and return values follow glibc's system()/popen()/pclose():
+    - system() ignores SIGINT/SIGQUIT and blocks SIGCHLD while waiting, the child starts with the caller's signal
+      mask and SIGINT/SIGQUIT reset to default (unless they were ignored), returns the wait status of the command
+      (of the shell if it was used), or 127 << 8 if nothing could be spawned
+    - popen() accepts "r"/"w" plus "e" (close-on-exec), children do not inherit streams of earlier popen() calls
+    - pclose() waits for the child (retrying on EINTR) and returns its wait status
+
+  A shell started with `-c` executes a single simple command with exec() (bash, dash), the process waited for is
+  the command itself in both cases. The shell would add SHLVL/_/PWD to the environment of the command, the direct
+  path passes the environment unchanged. Set CREW_PRELOAD_NO_SHELL_BYPASS=1 to always use the shell.
+*/
+
+#include "./main.h"
+#include <paths.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#define SHELL_BYPASS_MAX_WORDS 256 // longer commands go to the shell, keeps argv small on threads with small stacks
+
+// popen() stream and its child, see popen_wrapper()
+struct PopenEntry {
+  FILE              *stream;
+  pid_t             child;
+  struct PopenEntry *next;
+};
+
+static struct PopenEntry *popen_list = NULL;
+static pthread_mutex_t   popen_lock  = PTHREAD_MUTEX_INITIALIZER;
+
+// SIGINT/SIGQUIT dispositions saved by the first of concurrent system() calls, restored by the last one
+static struct sigaction  saved_intr, saved_quit;
+static int               system_callers = 0;
+static pthread_mutex_t   system_lock    = PTHREAD_MUTEX_INITIALIZER;
+
+// shell keywords and builtins that exist (or might exist) as executables in PATH but behave differently there
+static const char shell_words[][10] = {
+  "!", ".", "[", "[[", "alias", "bg", "break", "builtin", "case", "cd", "command", "continue", "coproc", "declare",
+  "do", "done", "elif", "else", "esac", "eval", "exec", "exit", "export", "fc", "fg", "fi", "for", "function",
+  "getopts", "hash", "if", "in", "jobs", "kill", "local", "printf", "pwd", "read", "readonly", "return", "select",
+  "set", "shift", "source", "then", "time", "times", "trap", "type", "typeset", "ulimit", "umask", "unalias",
+  "unset", "until", "wait", "while"
+};
+
+static bool is_plain_char(char c) {
+  // is_plain_char(): characters that have no special meaning to the shell anywhere in a word
+  return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || strchr("%+,-./:=@_", c);
+}
+
+static int split_command(char *command, char **argv, int max_args) {
+  // split_command(): split command (modified in place) at blanks into argv,
+  //                  returns the number of words or -1 if the command needs a shell
+  int argc = 0;
+
+  for (char *p = command; *p;) {
+    if (*p == ' ' || *p == '\t') {
+      *p++ = '\0';
+      continue;
+    }
+
+    if (argc == max_args) return -1;
+    argv[argc++] = p;
+
+    while (*p && *p != ' ' && *p != '\t') {
+      if (!is_plain_char(*p)) return -1;
+      p++;
+    }
+  }
+
+  argv[argc] = NULL;
+
+  // variable assignments (FOO=bar cmd) change the environment of the command
+  if (argc == 0 || strchr(argv[0], '=')) return -1;
+
+  for (size_t i = 0; i < sizeof(shell_words) / sizeof(shell_words[0]); i++) {
+    if (strcmp(argv[0], shell_words[i]) == 0) return -1;
+  }
+
+  return argc;
+}
+
+static int spawn_command(pid_t *child, const char *command, const posix_spawn_file_actions_t *file_actions,
+                         const posix_spawnattr_t *attrp) {
+  // spawn_command(): spawn command directly if possible, as `sh -c <command>` otherwise,
+  //                  returns 0 on success, an errno value otherwise
+  char *sh_argv[] = { "sh", "-c", (char *) command, NULL };
+
+  if (!no_shell_bypass && strlen(command) < PATH_MAX) {
+    char buf[PATH_MAX], exec_path[PATH_MAX], *argv[SHELL_BYPASS_MAX_WORDS + 1];
+    int  argc;
+
+    strcpy(buf, command);
+    argc = split_command(buf, argv, SHELL_BYPASS_MAX_WORDS);
+
+    if (argc > 0 && strchr(argv[0], '/')) strcpy(exec_path, argv[0]);
+
+    // commands that cannot be found or executed are left to the shell, so that it reports them (and returns 127)
+    // or runs them as scripts as usual
+    if (argc > 0 && (strchr(argv[0], '/') || search_in_path(argv[0], exec_path) == 0) &&
+        exec_wrapper(exec_path, argv, environ, false, child, file_actions, attrp) == 0) {
+      if (verbose) fprintf(stderr, "[PID %-7i] %s: Executed without shell: %s\n", getpid(), PROMPT_NAME, command);
+
+      stats_add(STAT_SHELL_BYPASSES, 1);
+      return 0;
+    }
+  }
+
+  return exec_wrapper(_PATH_BSHELL, sh_argv, environ, false, child, file_actions, attrp);
+}
+
+int system_wrapper(const char *command) {
+  // system_wrapper(): system() with the signal handling of glibc's implementation
+  struct sigaction  ignore;
+  sigset_t          child_mask, old_mask, reset;
+  posix_spawnattr_t attr;
+  pid_t             child;
+  int               status = -1, ret;
+
+  // only checks whether a shell is available
+  if (command == NULL || disabled) return orig_system(command);
+
+  ignore.sa_handler = SIG_IGN;
+  ignore.sa_flags   = 0;
+  sigemptyset(&ignore.sa_mask);
+
+  pthread_mutex_lock(&system_lock);
+
+  if (system_callers++ == 0) {
+    sigaction(SIGINT, &ignore, &saved_intr);
+    sigaction(SIGQUIT, &ignore, &saved_quit);
+  }
+
+  pthread_mutex_unlock(&system_lock);
+
+  sigemptyset(&child_mask);
+  sigaddset(&child_mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &child_mask, &old_mask);
+
+  sigemptyset(&reset);
+  if (saved_intr.sa_handler != SIG_IGN) sigaddset(&reset, SIGINT);
+  if (saved_quit.sa_handler != SIG_IGN) sigaddset(&reset, SIGQUIT);
+
+  posix_spawnattr_init(&attr);
+  posix_spawnattr_setsigmask(&attr, &old_mask);
+  posix_spawnattr_setsigdefault(&attr, &reset);
+  posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK);
+
+  if ((ret = spawn_command(&child, command, NULL, &attr)) == 0) {
+    while (waitpid(child, &status, 0) == -1) {
+      if (errno != EINTR) {
+        status = -1;
+        break;
+      }
+    }
+  } else {
+    // same as a shell that could not be executed
+    status = 127 << 8;
+  }
+
+  posix_spawnattr_destroy(&attr);
+  pthread_mutex_lock(&system_lock);
+
+  if (--system_callers == 0) {
+    sigaction(SIGINT, &saved_intr, NULL);
+    sigaction(SIGQUIT, &saved_quit, NULL);
+  }
+
+  pthread_mutex_unlock(&system_lock);
+  sigprocmask(SIG_SETMASK, &old_mask, NULL);
+
+  if (ret != 0) errno = ret;
+  return status;
+}
+
+FILE *popen_wrapper(const char *command, const char *mode) {
+  // popen_wrapper(): popen() with the stream handling of glibc's implementation
+  posix_spawn_file_actions_t file_actions;
+  struct PopenEntry          *entry;
+  bool                       do_read = false, do_write = false, do_cloexec = false;
+  int                        pipe_fds[2], parent_end, child_end, child_std_end, ret;
+
+  if (disabled) return orig_popen(command, mode);
+
+  for (const char *m = mode; *m; m++) {
+    switch (*m) {
+      case 'r': do_read    = true; break;
+      case 'w': do_write   = true; break;
+      case 'e': do_cloexec = true; break;
+      default:  errno = EINVAL; return NULL;
+    }
+  }
+
+  if (do_read == do_write) {
+    errno = EINVAL;
+    return NULL;
+  }
+
+  if ((entry = malloc(sizeof(*entry))) == NULL) return NULL;
+
+  if (pipe2(pipe_fds, O_CLOEXEC) == -1) {
+    free(entry);
+    return NULL;
+  }
+
+  parent_end    = do_read ? pipe_fds[0] : pipe_fds[1];
+  child_end     = do_read ? pipe_fds[1] : pipe_fds[0];
+  child_std_end = do_read ? STDOUT_FILENO : STDIN_FILENO;
+
+  // stdin/stdout were closed: dup2() onto the same descriptor would keep its close-on-exec flag
+  if (child_end == child_std_end) {
+    int new_end = fcntl(child_end, F_DUPFD_CLOEXEC, 3);
+
+    close(child_end);
+    child_end = new_end;
+  }
+
+  posix_spawn_file_actions_init(&file_actions);
+  posix_spawn_file_actions_adddup2(&file_actions, child_end, child_std_end);
+
+  pthread_mutex_lock(&popen_lock);
+
+  // streams of earlier popen() calls stay open in the caller only (POSIX), child_std_end was replaced by dup2() already
+  for (struct PopenEntry *e = popen_list; e; e = e->next) {
+    if (fileno(e->stream) != child_std_end) posix_spawn_file_actions_addclose(&file_actions, fileno(e->stream));
+  }
+
+  ret = (child_end == -1) ? errno : spawn_command(&entry->child, command, &file_actions, NULL);
+
+  posix_spawn_file_actions_destroy(&file_actions);
+  if (child_end != -1) close(child_end);
+
+  if (ret == 0) {
+    if (!do_cloexec) fcntl(parent_end, F_SETFD, 0);
+
+    if ((entry->stream = fdopen(parent_end, do_read ? "r" : "w")) != NULL) {
+      entry->next = popen_list;
+      popen_list  = entry;
+      pthread_mutex_unlock(&popen_lock);
+
+      return entry->stream;
+    }
+
+    // the child sees EOF/EPIPE, it is waited for here as nobody else can do so
+    ret = errno;
+    close(parent_end);
+    while (waitpid(entry->child, NULL, 0) == -1 && errno == EINTR);
+  } else {
+    close(parent_end);
+  }
+
+  pthread_mutex_unlock(&popen_lock);
+  free(entry);
+
+  errno = ret;
+  return NULL;
+}
+
+int pclose_wrapper(FILE *stream) {
+  // pclose_wrapper(): streams not opened by popen_wrapper() (e.g. by glibc internally) are left to glibc
+  struct PopenEntry **link, *entry = NULL;
+  pid_t             child;
+  int               status;
+
+  pthread_mutex_lock(&popen_lock);
+
+  for (link = &popen_list; *link; link = &(*link)->next) {
+    if ((*link)->stream == stream) {
+      entry = *link;
+      *link = entry->next;
+      break;
+    }
+  }
+
+  pthread_mutex_unlock(&popen_lock);
+
+  if (entry == NULL) return orig_pclose(stream);
+
+  child = entry->child;
+  free(entry);
+  fclose(stream);
+
+  while (waitpid(child, &status, 0) == -1) {
+    if (errno != EINTR) return -1;
+  }
+
+  return status;
+}
@@ -0,0 +1,158 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  stats.c: Performance counters
+
+  If CREW_PRELOAD_STATS is set to a file path, every process using crew-preload.so maps that file (see stats.h
+  for its layout) and adds its counters to it atomically, so a whole build (e.g. `crew build`) can be measured by
+  setting CREW_PRELOAD_STATS once. Use tools/crew-preload-stat to print the result.
+
+  Time spent in exec_wrapper() covers everything between entering the hook and calling the real
+  exec*()/posix_spawn*(), including scripts re-executed with their interpreter. The state of the current call is
+  kept per thread, so threads spawning at the same time do not mix up their measurements.
+
+  Syscalls are counted by the wrappers in main.h, so they are approximate: libc functions that might issue
+  several of them (e.g. realpath()) are counted as one, readdir() is not counted at all.
+*/
+
+#include "./main.h"
+
+THREAD_LOCAL uint32_t syscall_count = 0;
+
+static struct PreloadStats *preload_stats = NULL;
+static bool                stats_mapped   = false;
+
+// state of the current exec_wrapper() call of this thread
+static THREAD_LOCAL bool            exec_recorded        = false;
+static THREAD_LOCAL struct timespec exec_start;
+static THREAD_LOCAL uint32_t        exec_syscalls_before = 0;
+
+static struct PreloadStats *map_stats(void) {
+  const char  *stats_path = getenv("CREW_PRELOAD_STATS");
+  struct stat stats_info;
+  void        *mem;
+  int         fd;
+
+  if (stats_mapped) return preload_stats;
+  stats_mapped = true;
+
+  if (stats_path == NULL || stats_path[0] == '\0') return NULL;
+
+  if ((fd = open(stats_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644)) == -1) {
+    fprintf(stderr, "[PID %-7i] %s: Failed to open statistics file %s (%s)\n", getpid(), PROMPT_NAME, stats_path, strerror(errno));
+    return NULL;
+  }
+
+  // a newly created (empty) file
+  if (fstat(fd, &stats_info) == -1 ||
+      (stats_info.st_size < (off_t) sizeof(struct PreloadStats) && ftruncate(fd, sizeof(struct PreloadStats)) == -1)) {
+    close(fd);
+    return NULL;
+  }
+
+  mem = mmap(NULL, sizeof(struct PreloadStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED) return NULL;
+
+  preload_stats = mem;
+
+  if (__atomic_load_n(&preload_stats->magic, __ATOMIC_ACQUIRE) == 0) {
+    preload_stats->version      = PRELOAD_STATS_VERSION;
+    preload_stats->num_counters = STAT_MAX;
+    preload_stats->num_buckets  = PRELOAD_STATS_BUCKETS;
+    __atomic_store_n(&preload_stats->magic, PRELOAD_STATS_MAGIC, __ATOMIC_RELEASE);
+  }
+
+  if (preload_stats->magic != PRELOAD_STATS_MAGIC || preload_stats->version != PRELOAD_STATS_VERSION ||
+      preload_stats->num_counters != STAT_MAX || preload_stats->num_buckets != PRELOAD_STATS_BUCKETS) {
+    fprintf(stderr, "[PID %-7i] %s: Statistics file %s has incompatible format, ignoring\n", getpid(), PROMPT_NAME, stats_path);
+
+    munmap(mem, sizeof(struct PreloadStats));
+    preload_stats = NULL;
+  }
+
+  return preload_stats;
+}
+
+static uint64_t elapsed_ns(const struct timespec *start) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - start->tv_sec) * 1000000000ull + now.tv_nsec - start->tv_nsec;
+}
+
+static void update_max(uint64_t *max, uint64_t value) {
+  uint64_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+
+  while (value > current && !__atomic_compare_exchange_n(max, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void stats_add(enum PreloadStat stat, uint64_t value) {
+  // stats_add(): add value to one of the counters, does nothing unless CREW_PRELOAD_STATS is set
+  struct PreloadStats *stats = map_stats();
+
+  if (stats) __atomic_fetch_add(&stats->counters[stat], value, __ATOMIC_RELAXED);
+}
+
+void stats_init_begin(struct timespec *start) {
+  if (map_stats()) clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+void stats_init_end(const struct timespec *start) {
+  // stats_init_end(): count process started with crew-preload.so and time spent in preload_init()
+  if (map_stats() == NULL) return;
+
+  stats_add(STAT_PROCESSES, 1);
+  stats_add(STAT_INIT_NS, elapsed_ns(start));
+}
+
+void stats_exec_begin(bool is_spawn) {
+  // stats_exec_begin(): called when exec_wrapper() is entered
+  if (map_stats() == NULL) return;
+
+  exec_recorded        = false;
+  exec_syscalls_before = syscall_count;
+
+  stats_add(is_spawn ? STAT_SPAWN_CALLS : STAT_EXEC_CALLS, 1);
+  clock_gettime(CLOCK_MONOTONIC, &exec_start);
+}
+
+void stats_exec_ready(void) {
+  // stats_exec_ready(): called right before the real exec*()/posix_spawn*(), records time and syscalls
+  //                     spent in exec_wrapper()
+  struct PreloadStats *stats = map_stats();
+  uint64_t            ns, syscalls;
+
+  if (stats == NULL || exec_recorded) return;
+
+  ns            = elapsed_ns(&exec_start);
+  syscalls      = syscall_count - exec_syscalls_before;
+  exec_recorded = true;
+
+  stats_add(STAT_WRAPPER_NS, ns);
+  stats_add(STAT_SYSCALLS, syscalls);
+
+  __atomic_fetch_add(&stats->wrapper_ns_hist[stats_bucket(ns)], 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&stats->syscalls_hist[stats_bucket(syscalls)], 1, __ATOMIC_RELAXED);
+
+  update_max(&stats->wrapper_ns_max, ns);
+  update_max(&stats->syscalls_max, syscalls);
+}
+
+void stats_exec_end(bool failed) {
+  // stats_exec_end(): called when exec_wrapper() returns (exec*() failed or posix_spawn*() finished)
+  if (map_stats() == NULL) return;
+
+  // returned before reaching the real exec*()/posix_spawn*()
+  stats_exec_ready();
+
+  if (failed) stats_add(STAT_FAILED_CALLS, 1);
+}
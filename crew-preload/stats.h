@@ -0,0 +1,94 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  stats.h: Layout of the statistics file written by crew-preload.so (see stats.c), also used by
+           tools/crew-preload-stat.c to read it
+*/
+
+#ifndef STATS_H_INCLUDED
+#define STATS_H_INCLUDED
+
+#include <stdint.h>
+
+#define PRELOAD_STATS_MAGIC   0x43525053 // "CRPS"
+#define PRELOAD_STATS_VERSION 1
+#define PRELOAD_STATS_BUCKETS 256
+
+// X(name, description)
+#define PRELOAD_STAT_LIST(X) \
+  X(PROCESSES,             "processes started with crew-preload.so") \
+  X(INIT_NS,               "time spent in preload_init() (ns)") \
+  X(EXEC_CALLS,            "exec*() calls") \
+  X(SPAWN_CALLS,           "posix_spawn*() calls") \
+  X(FAILED_CALLS,          "failed exec*()/posix_spawn*() calls") \
+  X(WRAPPER_NS,            "time spent in exec_wrapper() (ns)") \
+  X(SYSCALLS,              "syscalls issued by exec_wrapper()") \
+  X(PATH_LOOKUPS,          "PATH lookups") \
+  X(PATH_NEGATIVE_HITS,    "PATH lookups answered by the negative cache") \
+  X(DECISION_CACHE_HITS,   "decision cache hits") \
+  X(DECISION_CACHE_MISSES, "decision cache misses") \
+  X(MANIFEST_HITS,         "executables found in the native manifest (not read)") \
+  X(INTERP_REWRITES,       "executables run with Chromebrew's dynamic linker") \
+  X(EXEC_CACHE_HITS,       "exec cache hits") \
+  X(EXEC_CACHE_STORES,     "executables written into the exec cache") \
+  X(EXEC_CACHE_BYTES,      "bytes written into the exec cache") \
+  X(MEMFD_EXECS,           "executables copied into a memfd") \
+  X(MEMFD_BYTES,           "bytes copied into memfds") \
+  X(LOADER_EXECS,          "executables run as arguments of the dynamic linker") \
+  X(SHEBANG_REEXECS,       "scripts re-executed with their interpreter") \
+  X(ENV_COLLAPSES,         "#!/usr/bin/env scripts executed without env") \
+  X(LIBRARY_PATH_STASHES,  "system commands executed with LD_LIBRARY_PATH unset") \
+  X(MOLD_SUBSTITUTIONS,    "linkers replaced with mold") \
+  X(LINK_SLOT_WAITS,       "linkers that waited for a free link slot") \
+  X(LINK_SLOT_WAIT_NS,     "time spent waiting for link slots (ns)") \
+  X(SHELL_BYPASSES,        "system()/popen() commands executed without a shell")
+
+enum PreloadStat {
+#define X(name, description) STAT_##name,
+  PRELOAD_STAT_LIST(X)
+#undef X
+  STAT_MAX
+};
+
+// all fields have fixed size as the file is shared between 32-bit and 64-bit processes
+struct PreloadStats {
+  uint32_t magic,
+           version,
+           num_counters,
+           num_buckets;
+  uint64_t counters[STAT_MAX],
+           wrapper_ns_max,
+           syscalls_max,
+           wrapper_ns_hist[PRELOAD_STATS_BUCKETS], // per exec_wrapper() call, see stats_bucket()
+           syscalls_hist[PRELOAD_STATS_BUCKETS];
+};
+
+static inline int stats_bucket(uint64_t value) {
+  // stats_bucket(): logarithmic histogram bucket of value, every power of two is split into 4 buckets
+  //                 (at most 25% error)
+  int log2;
+
+  if (value < 4) return value;
+
+  log2 = 63 - __builtin_clzll(value);
+  return log2 * 4 + ((value >> (log2 - 2)) & 3);
+}
+
+static inline uint64_t stats_bucket_max(int bucket) {
+  // stats_bucket_max(): largest value that falls into bucket
+  int log2 = bucket / 4;
+
+  // buckets 4-7 are never used
+  if (bucket < 8) return bucket;
+
+  return ((1ull << log2) | ((uint64_t) (bucket % 4) << (log2 - 2))) + (1ull << (log2 - 2)) - 1;
+}
+
+#endif
@@ -0,0 +1,358 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  crew-preload-account: Fold the process accounting log written by crew-preload.so (see account.c) into totals
+                        per command and per package
+
+  Every child that was waited for is matched with the posix_spawn*()/exec*() records of its pid (the last exec*()
+  names the process, a shell that exec*()s a command counts as that command). The CPU time reported by wait4()
+  includes everything the child waited for itself, so the CPU time of the children found in the log is subtracted
+  from their parent: every process only counts its own CPU time, and the totals add up to the CPU time of the
+  whole build. Children that were never exec*()-ed (forks of make, shells...) are listed as "[fork]".
+
+  Packages are found through the file lists of installed packages (<CREW_PREFIX>/etc/crew/meta/<package>.filelist),
+  commands that are not part of any package (system commands, scripts of the package being built) are listed as
+  "[none]".
+
+  Usage:
+
+    make tools
+
+    CREW_PRELOAD_ACCOUNT=/tmp/build.account crew build <package>
+    crew-preload-account [--all] [--meta <dir>] /tmp/build.account
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "../account.h"
+
+#ifndef CREW_PREFIX
+#define CREW_PREFIX "/usr/local"
+#endif
+
+#define TOP_ENTRIES 20 // number of entries printed per table without --all
+
+struct AccountProcess {
+  uint32_t pid,
+           waiter;
+  uint64_t start_ns,    // first posix_spawn*()/exec*() record, 0 if none (forks)
+           exec_ns,     // last exec*() record, names the process
+           end_ns,
+           cpu_us,      // from wait4(), includes the children it waited for
+           children_us; // CPU time of the children found in the log
+  uint32_t maxrss_kb;
+  char     command[sizeof(((struct AccountRecord *) 0)->command)],
+           prev_command[sizeof(((struct AccountRecord *) 0)->command)];
+};
+
+struct AccountTotal {
+  const char *name;
+  uint64_t   count,
+             cpu_us,
+             wall_ns;
+  uint32_t   maxrss_kb;
+};
+
+struct PackageFile {
+  char *path,
+       *package;
+};
+
+static struct AccountProcess *live          = NULL, // processes not waited for yet
+                             *done          = NULL;
+static int                   num_live       = 0,
+                             num_done       = 0;
+static struct PackageFile    *package_files = NULL; // open addressing hash table, package_mask + 1 slots
+static uint32_t              package_mask   = 0,
+                             num_package_files = 0;
+
+static void *grow(void *array, int count, size_t size) {
+  // grow(): make room for one more element in an array that grows in powers of two
+  if ((count & (count - 1)) == 0 && (array = realloc(array, (count ? count * 2 : 16) * size)) == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+
+  return array;
+}
+
+static uint32_t hash_string(const char *str) {
+  uint32_t hash = 2166136261u;
+
+  for (; *str; str++) hash = (hash ^ (uint8_t) *str) * 16777619u;
+  return hash;
+}
+
+static struct PackageFile *package_slot(const char *path) {
+  uint32_t i = hash_string(path) & package_mask;
+
+  while (package_files[i].path && strcmp(package_files[i].path, path) != 0) i = (i + 1) & package_mask;
+  return &package_files[i];
+}
+
+static void add_package_file(const char *path, char *package) {
+  struct PackageFile *slot;
+
+  // keep the table at most half full
+  if (num_package_files * 2 >= package_mask) {
+    struct PackageFile *old = package_files;
+    uint32_t           old_size = package_mask + 1;
+
+    package_mask  = package_mask ? package_mask * 2 + 1 : 65535;
+    package_files = calloc(package_mask + 1, sizeof(struct PackageFile));
+
+    for (uint32_t i = 0; old && i < old_size; i++) {
+      if (old[i].path) *package_slot(old[i].path) = old[i];
+    }
+
+    free(old);
+  }
+
+  if ((slot = package_slot(path))->path) return;
+
+  slot->path    = strdup(path);
+  slot->package = package;
+  num_package_files++;
+}
+
+static void load_file_lists(const char *meta_dir) {
+  // load_file_lists(): map every installed file (and what it resolves to) to its package
+  struct dirent *entry;
+  DIR           *dir = opendir(meta_dir);
+  char          path[PATH_MAX], line[PATH_MAX], resolved[PATH_MAX];
+
+  if (dir == NULL) {
+    fprintf(stderr, "warning: %s: no file lists, packages will not be listed\n", meta_dir);
+    return;
+  }
+
+  while ((entry = readdir(dir))) {
+    size_t len = strlen(entry->d_name);
+    char   *package;
+    FILE   *fp;
+
+    if (len <= 9 || strcmp(entry->d_name + len - 9, ".filelist") != 0) continue;
+
+    package = strndup(entry->d_name, len - 9);
+    snprintf(path, sizeof(path), "%s/%s", meta_dir, entry->d_name);
+
+    if ((fp = fopen(path, "r")) == NULL) continue;
+
+    while (fgets(line, sizeof(line), fp)) {
+      line[strcspn(line, "\n")] = '\0';
+      if (line[0] != '/') continue;
+
+      add_package_file(line, package);
+
+      // executables are recorded by their resolved path
+      if (realpath(line, resolved) && strcmp(resolved, line) != 0) add_package_file(resolved, package);
+    }
+
+    fclose(fp);
+  }
+
+  closedir(dir);
+}
+
+static const char *package_of(const char *command) {
+  struct PackageFile *slot;
+
+  if (command[0] != '/') return "[fork]";
+  if (package_files == NULL || (slot = package_slot(command))->path == NULL) return "[none]";
+
+  return slot->package;
+}
+
+static struct AccountProcess *find_live(uint32_t pid) {
+  for (int i = 0; i < num_live; i++) {
+    if (live[i].pid == pid) return &live[i];
+  }
+
+  return NULL;
+}
+
+static struct AccountProcess *add_live(uint32_t pid) {
+  struct AccountProcess *process;
+
+  live    = grow(live, num_live, sizeof(struct AccountProcess));
+  process = &live[num_live++];
+
+  memset(process, 0, sizeof(*process));
+  process->pid = pid;
+  strcpy(process->command, "[fork]");
+
+  return process;
+}
+
+static void process_record(const struct AccountRecord *record) {
+  struct AccountProcess *process = find_live(record->pid), *waiter;
+
+  switch (record->type) {
+    case ACCOUNT_SPAWN:
+    case ACCOUNT_EXEC:
+      // a posix_spawn*() record is written when the call returns, the child might have exec*()-ed already
+      if (process && record->type == ACCOUNT_SPAWN && process->start_ns && process->start_ns < record->time_ns) {
+        // the pid was reused, the previous process was reaped by someone without crew-preload.so
+        *process = live[--num_live];
+        process  = NULL;
+      }
+
+      if (process == NULL) process = add_live(record->pid);
+
+      if (process->start_ns == 0 || record->time_ns < process->start_ns) process->start_ns = record->time_ns;
+
+      if (record->time_ns >= process->exec_ns) {
+        strcpy(process->prev_command, process->command);
+        memcpy(process->command, record->command, sizeof(process->command));
+        process->command[sizeof(process->command) - 1] = '\0';
+        process->exec_ns = record->time_ns;
+      }
+
+      break;
+
+    case ACCOUNT_EXEC_FAILED:
+      if (process && process->prev_command[0]) strcpy(process->command, process->prev_command);
+      break;
+
+    case ACCOUNT_EXIT:
+      if (process == NULL) process = add_live(record->pid);
+
+      process->waiter    = record->ppid;
+      process->end_ns    = record->time_ns;
+      process->cpu_us    = record->utime_us + record->stime_us;
+      process->maxrss_kb = record->maxrss_kb;
+
+      // the waiter is still running, its CPU time will include this child
+      if ((waiter = find_live(record->ppid)) == NULL) {
+        waiter = add_live(record->ppid);
+        process = find_live(record->pid);
+      }
+
+      waiter->children_us += process->cpu_us;
+
+      done              = grow(done, num_done, sizeof(struct AccountProcess));
+      done[num_done++]  = *process;
+      *process          = live[--num_live];
+      break;
+  }
+}
+
+static struct AccountTotal *add_total(struct AccountTotal **totals, int *num_totals, const char *name) {
+  for (int i = 0; i < *num_totals; i++) {
+    if (strcmp((*totals)[i].name, name) == 0) return &(*totals)[i];
+  }
+
+  *totals = grow(*totals, *num_totals, sizeof(struct AccountTotal));
+  memset(&(*totals)[*num_totals], 0, sizeof(struct AccountTotal));
+  (*totals)[*num_totals].name = name;
+
+  return &(*totals)[(*num_totals)++];
+}
+
+static int compare_total(const void *a, const void *b) {
+  const struct AccountTotal *x = a, *y = b;
+
+  return (x->cpu_us < y->cpu_us) - (x->cpu_us > y->cpu_us);
+}
+
+static void print_totals(const char *title, struct AccountTotal *totals, int num_totals, uint64_t total_cpu_us, bool all) {
+  qsort(totals, num_totals, sizeof(struct AccountTotal), compare_total);
+
+  printf("\n%-32s %8s %12s %7s %12s %10s\n", title, "count", "cpu (s)", "cpu %", "wall (s)", "rss (MiB)");
+
+  for (int i = 0; i < num_totals && (all || i < TOP_ENTRIES); i++) {
+    printf("%-32.32s %8llu %12.2f %6.1f%% %12.2f %10.1f\n", totals[i].name, (unsigned long long) totals[i].count,
+           totals[i].cpu_us / 1e6, total_cpu_us ? totals[i].cpu_us * 100.0 / total_cpu_us : 0,
+           totals[i].wall_ns / 1e9, totals[i].maxrss_kb / 1024.0);
+  }
+
+  if (!all && num_totals > TOP_ENTRIES) printf("(%i more, use --all to list them)\n", num_totals - TOP_ENTRIES);
+}
+
+int main(int argc, char **argv) {
+  struct AccountRecord record;
+  struct AccountTotal  *commands = NULL, *packages = NULL;
+  const char           *meta_dir = CREW_PREFIX "/etc/crew/meta";
+  uint64_t             total_cpu_us = 0, first_ns = UINT64_MAX, last_ns = 0;
+  bool                 all = false;
+  int                  argi = 1, fd, num_commands = 0, num_packages = 0, num_skipped = 0;
+
+  for (; argi < argc - 1; argi++) {
+    if (strcmp(argv[argi], "--all") == 0) {
+      all = true;
+    } else if (strcmp(argv[argi], "--meta") == 0 && argi + 2 < argc) {
+      meta_dir = argv[++argi];
+    } else {
+      break;
+    }
+  }
+
+  if (argi != argc - 1) {
+    fprintf(stderr, "Usage: %s [--all] [--meta <dir with *.filelist>] <accounting log>\n", argv[0]);
+    return 1;
+  }
+
+  if ((fd = open(argv[argi], O_RDONLY)) == -1) {
+    perror(argv[argi]);
+    return 1;
+  }
+
+  while (read(fd, &record, sizeof(record)) == sizeof(record)) {
+    if (record.magic != PRELOAD_ACCOUNT_MAGIC || record.version != PRELOAD_ACCOUNT_VERSION) {
+      num_skipped++;
+      continue;
+    }
+
+    if (record.time_ns < first_ns) first_ns = record.time_ns;
+    if (record.time_ns > last_ns) last_ns = record.time_ns;
+
+    process_record(&record);
+  }
+
+  close(fd);
+  load_file_lists(meta_dir);
+
+  for (int i = 0; i < num_done; i++) {
+    struct AccountProcess *process = &done[i];
+    const char            *name    = strrchr(process->command, '/') ? strrchr(process->command, '/') + 1 : process->command;
+    uint64_t              cpu_us   = (process->cpu_us > process->children_us) ? process->cpu_us - process->children_us : 0;
+    uint64_t              wall_ns  = (process->start_ns && process->end_ns > process->start_ns) ? process->end_ns - process->start_ns : 0;
+    struct AccountTotal   *totals[2];
+
+    totals[0] = add_total(&commands, &num_commands, name);
+    totals[1] = add_total(&packages, &num_packages, package_of(process->command));
+
+    for (int t = 0; t < 2; t++) {
+      totals[t]->count++;
+      totals[t]->cpu_us  += cpu_us;
+      totals[t]->wall_ns += wall_ns;
+      if (process->maxrss_kb > totals[t]->maxrss_kb) totals[t]->maxrss_kb = process->maxrss_kb;
+    }
+
+    total_cpu_us += cpu_us;
+  }
+
+  printf("%i processes waited for, %.2f s CPU (user + system), %.2f s between first and last record\n", num_done,
+         total_cpu_us / 1e6, num_done ? (last_ns - first_ns) / 1e9 : 0);
+  if (num_skipped) printf("%i records with a different version skipped\n", num_skipped);
+
+  print_totals("command", commands, num_commands, total_cpu_us, all);
+  print_totals("package", packages, num_packages, total_cpu_us, all);
+
+  return 0;
+}
@@ -0,0 +1,281 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  crew-preload-ldconfig: Write the crew library cache (see lib-cache.h) for Chromebrew's dynamic linker
+
+  Records the files of the given library directories (${CREW_PREFIX}/lib* by default), so that the dynamic linker
+  does not need to try opening a library in directories that do not have it. Directories with a glibc-hwcaps
+  subdirectory are left out (the dynamic linker searches them with different names), as are more than 32 directories.
+
+  Like ldconfig, this needs to run after libraries were installed or removed, but an outdated cache is harmless:
+  directories modified after the cache was written are searched as usual.
+
+  Usage:
+
+    make tools
+
+    crew-preload-ldconfig [--verbose] [--output <file>] [directory...]
+    crew-preload-ldconfig --print [<file>]
+*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../lib-cache.h"
+
+#ifndef CREW_PREFIX
+#define CREW_PREFIX "/usr/local"
+#endif
+
+struct Library {
+  char     *name;
+  uint32_t dirs;
+};
+
+static struct LibCacheDir dirs[LIB_CACHE_MAX_DIRS];
+static char               *dir_names[LIB_CACHE_MAX_DIRS];
+static uint32_t           num_dirs      = 0;
+static struct Library     *libraries    = NULL;
+static uint32_t           num_libraries = 0,
+                          max_libraries = 0;
+static bool               print_files   = false;
+
+static int add_dir(const char *path) {
+  // add_dir(): record all non-directory entries of path, returns -1 if the directory cannot be cached
+  char          name[PATH_MAX], hwcaps[PATH_MAX + 16];
+  struct stat   dir_info, entry_info;
+  struct dirent *entry;
+  DIR           *dir;
+  size_t        len = strlen(path);
+
+  if (len == 0 || len + 2 > sizeof(name)) return -1;
+
+  // the dynamic linker's search path elements always end with a slash
+  snprintf(name, sizeof(name), "%s%s", path, (path[len - 1] == '/') ? "" : "/");
+  snprintf(hwcaps, sizeof(hwcaps), "%sglibc-hwcaps", name);
+
+  for (uint32_t i = 0; i < num_dirs; i++) {
+    if (strcmp(dir_names[i], name) == 0) return 0;
+  }
+
+  if (num_dirs == LIB_CACHE_MAX_DIRS) {
+    fprintf(stderr, "%s: more than %i directories, not cached\n", path, LIB_CACHE_MAX_DIRS);
+    return -1;
+  }
+
+  if (access(hwcaps, F_OK) == 0) {
+    fprintf(stderr, "%s: has a glibc-hwcaps subdirectory, not cached\n", path);
+    return -1;
+  }
+
+  // take the modification time before reading the directory, so that files added meanwhile invalidate the entry
+  if (stat(name, &dir_info) == -1) {
+    if (print_files || errno != ENOENT) perror(path);
+    return -1;
+  }
+
+  if (!S_ISDIR(dir_info.st_mode)) {
+    fprintf(stderr, "%s: not a directory\n", path);
+    return -1;
+  }
+
+  if ((dir = opendir(name)) == NULL) {
+    perror(path);
+    return -1;
+  }
+
+  dirs[num_dirs].mtime_sec  = dir_info.st_mtim.tv_sec;
+  dirs[num_dirs].mtime_nsec = dir_info.st_mtim.tv_nsec;
+  dir_names[num_dirs]       = strdup(name);
+
+  while ((entry = readdir(dir)) != NULL) {
+    bool is_dir = (entry->d_type == DT_DIR);
+
+    if (entry->d_type == DT_UNKNOWN) is_dir = (fstatat(dirfd(dir), entry->d_name, &entry_info, AT_SYMLINK_NOFOLLOW) == 0 && S_ISDIR(entry_info.st_mode));
+    if (is_dir) continue;
+
+    if (num_libraries == max_libraries) {
+      max_libraries = max_libraries ? max_libraries * 2 : 4096;
+      libraries     = realloc(libraries, max_libraries * sizeof(struct Library));
+    }
+
+    libraries[num_libraries].name   = strdup(entry->d_name);
+    libraries[num_libraries++].dirs = 1u << num_dirs;
+  }
+
+  closedir(dir);
+
+  if (print_files) fprintf(stderr, "%s: cached as directory %u\n", name, num_dirs);
+
+  num_dirs++;
+  return 0;
+}
+
+static int compare_library(const void *a, const void *b) {
+  return strcmp(((const struct Library *) a)->name, ((const struct Library *) b)->name);
+}
+
+static int write_cache(const char *cache_path) {
+  // write_cache(): merge libraries with the same name, write everything into a temporary file, then rename it
+  struct LibCacheHeader header = { .magic = LIB_CACHE_MAGIC, .version = LIB_CACHE_VERSION };
+  struct LibCacheEntry  *entries;
+  char                  tmp_path[PATH_MAX], *strings;
+  uint32_t              unique = 0, strings_size = 0;
+  FILE                  *fp;
+  int                   fd;
+
+  qsort(libraries, num_libraries, sizeof(struct Library), compare_library);
+
+  for (uint32_t i = 0; i < num_libraries; i++) {
+    if (unique > 0 && strcmp(libraries[unique - 1].name, libraries[i].name) == 0) {
+      libraries[unique - 1].dirs |= libraries[i].dirs;
+    } else {
+      libraries[unique++] = libraries[i];
+    }
+  }
+
+  for (uint32_t i = 0; i < num_dirs; i++) strings_size += strlen(dir_names[i]) + 1;
+  for (uint32_t i = 0; i < unique; i++) strings_size += strlen(libraries[i].name) + 1;
+
+  entries = calloc(unique, sizeof(struct LibCacheEntry));
+  strings = malloc(strings_size);
+
+  header.num_dirs       = num_dirs;
+  header.num_entries    = unique;
+  header.strings_offset = sizeof(header) + num_dirs * sizeof(struct LibCacheDir) + unique * sizeof(struct LibCacheEntry);
+  header.strings_size   = strings_size;
+  strings_size          = 0;
+
+  for (uint32_t i = 0; i < num_dirs; i++) {
+    dirs[i].name_offset = strings_size;
+    dirs[i].name_len    = strlen(dir_names[i]);
+
+    memcpy(strings + strings_size, dir_names[i], dirs[i].name_len + 1);
+    strings_size += dirs[i].name_len + 1;
+  }
+
+  for (uint32_t i = 0; i < unique; i++) {
+    entries[i].name_offset = strings_size;
+    entries[i].dirs        = libraries[i].dirs;
+
+    strcpy(strings + strings_size, libraries[i].name);
+    strings_size += strlen(libraries[i].name) + 1;
+  }
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", cache_path);
+
+  if ((fd = mkstemp(tmp_path)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+    perror(tmp_path);
+    return -1;
+  }
+
+  if (fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(dirs, sizeof(struct LibCacheDir), num_dirs, fp) != num_dirs ||
+      fwrite(entries, sizeof(struct LibCacheEntry), unique, fp) != unique || fwrite(strings, 1, strings_size, fp) != strings_size ||
+      fchmod(fd, 0644) == -1 || fclose(fp) != 0 || rename(tmp_path, cache_path) == -1) {
+    perror(cache_path);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  printf("%u libraries in %u directories written to %s\n", unique, num_dirs, cache_path);
+  return 0;
+}
+
+static int print_cache(const char *cache_path) {
+  // print_cache(): dump an existing cache, marking directories modified since the cache was written
+  const struct LibCacheHeader *header;
+  const struct LibCacheDir    *cache_dirs;
+  const struct LibCacheEntry  *entries;
+  const char                  *strings;
+  struct stat                 cache_info, dir_info;
+  int                         fd = open(cache_path, O_RDONLY);
+
+  if (fd == -1 || fstat(fd, &cache_info) == -1 || cache_info.st_size < (off_t) sizeof(*header) ||
+      (header = mmap(NULL, cache_info.st_size, PROT_READ, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+    perror(cache_path);
+    return 1;
+  }
+
+  if (header->magic != LIB_CACHE_MAGIC || header->version != LIB_CACHE_VERSION || header->num_dirs > LIB_CACHE_MAX_DIRS ||
+      (uint64_t) header->strings_offset + header->strings_size > (uint64_t) cache_info.st_size) {
+    fprintf(stderr, "%s: not a crew library cache (or wrong version)\n", cache_path);
+    return 1;
+  }
+
+  cache_dirs = (const struct LibCacheDir *) (header + 1);
+  entries    = (const struct LibCacheEntry *) (cache_dirs + header->num_dirs);
+  strings    = (const char *) header + header->strings_offset;
+
+  for (uint32_t i = 0; i < header->num_dirs; i++) {
+    const char *name  = strings + cache_dirs[i].name_offset;
+    bool       stale  = (stat(name, &dir_info) == -1 || dir_info.st_mtim.tv_sec != cache_dirs[i].mtime_sec ||
+                         dir_info.st_mtim.tv_nsec != cache_dirs[i].mtime_nsec);
+
+    printf("directory %2u: %s%s\n", i, name, stale ? " (modified, ignored)" : "");
+  }
+
+  for (uint32_t i = 0; i < header->num_entries; i++) {
+    printf("%-48s", strings + entries[i].name_offset);
+
+    for (uint32_t dir = 0; dir < header->num_dirs; dir++) {
+      if (entries[i].dirs & (1u << dir)) printf(" %u", dir);
+    }
+
+    printf("\n");
+  }
+
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char *cache_path = CREW_PREFIX LIB_CACHE_PATH;
+  int        argi;
+
+  for (argi = 1; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+    if (strcmp(argv[argi], "--verbose") == 0) {
+      print_files = true;
+    } else if (strcmp(argv[argi], "--output") == 0 && argi + 1 < argc) {
+      cache_path = argv[++argi];
+    } else if (strcmp(argv[argi], "--print") == 0) {
+      return print_cache((argi + 1 < argc) ? argv[argi + 1] : cache_path);
+    } else {
+      fprintf(stderr, "Usage: %s [--verbose] [--output <file>] [directory (default: %s/lib*)...]\n"
+                      "       %s --print [<file>]\n", argv[0], CREW_PREFIX, argv[0]);
+      return 1;
+    }
+  }
+
+  if (argi == argc) {
+    glob_t lib_dirs;
+
+    // lib, lib32, lib64... but not libexec
+    if (glob(CREW_PREFIX "/lib*/", 0, NULL, &lib_dirs) == 0) {
+      for (size_t i = 0; i < lib_dirs.gl_pathc; i++) {
+        if (strstr(lib_dirs.gl_pathv[i], "/libexec/") == NULL) add_dir(lib_dirs.gl_pathv[i]);
+      }
+
+      globfree(&lib_dirs);
+    }
+  } else {
+    for (; argi < argc; argi++) add_dir(argv[argi]);
+  }
+
+  return (write_cache(cache_path) == 0) ? 0 : 1;
+}
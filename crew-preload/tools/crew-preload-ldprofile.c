@@ -0,0 +1,257 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  crew-preload-ldprofile: Fold the load profile written by Chromebrew's dynamic linker (LD_CREW_LOAD_PROFILE, see
+                          ../patches/0008-*.patch) into totals per library
+
+  Every line of the profile is one object loaded by one process: time spent searching it (and files tried), mapping
+  it, relocating it (symbol lookups included) and running its constructors, and the relocations it has. Lines are
+  folded by path (names that were not found by name, as "[not found] <name>"), sorted by the total time spent on
+  them, and printed with the mean per load:
+
+    loads      number of processes that loaded it
+    search     time spent finding it (us)
+    tries      files tried to find it (failed open() calls included)
+    map        time spent mapping it (us)
+    reloc      time spent relocating it (us)
+    lookups    symbols looked up to relocate it (lazily bound PLT entries only with LD_BIND_NOW=1)
+    init       time spent in its constructors (us)
+    total      search + map + reloc + init of all loads (ms)
+
+  followed by hints for the libraries listed: searched in several directories, unpacked relative relocations, many
+  symbol lookups, slow constructors.
+
+  Usage:
+
+    make tools
+
+    LD_CREW_LOAD_PROFILE=/tmp/build.ldprofile crew build <package>
+    crew-preload-ldprofile [--all] /tmp/build.ldprofile
+*/
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define TOP_ENTRIES      20      // number of libraries printed without --all
+#define PROFILE_FIELDS   17      // fields of a line, see elf/dl-crew-profile.h in the patch
+#define HINT_TRIES       1.5     // files tried per load
+#define HINT_RELATIVE    1000    // relative relocations not packed with DT_RELR
+#define HINT_LOOKUPS     1000    // symbol lookups per load
+#define HINT_INIT_NS     1000000 // constructor time per load
+
+// fields of a line
+enum {
+  FIELD_PID, FIELD_PROGRAM, FIELD_NAME, FIELD_PATH, FIELD_FLAGS, FIELD_TRIES, FIELD_SEARCH, FIELD_OPEN, FIELD_MAP,
+  FIELD_RELOC, FIELD_REL, FIELD_RELATIVE, FIELD_RELR, FIELD_PLT, FIELD_LOOKUPS, FIELD_CACHED, FIELD_INIT
+};
+
+struct LibraryTotal {
+  char     *path;
+  bool     glibc,     // found through the CREW_GLIBC_PREFIX fast path
+           not_found;
+  uint64_t loads,
+           tries,
+           search_ns,
+           map_ns,
+           reloc_ns,
+           lookups,
+           init_ns,
+           relative,  // of the last load
+           relr;
+};
+
+static struct LibraryTotal *libraries     = NULL;
+static int                 num_libraries  = 0;
+
+static void *grow(void *array, int count, size_t size) {
+  // grow(): make room for one more element in an array that grows in powers of two
+  if ((count & (count - 1)) == 0 && (array = realloc(array, (count ? count * 2 : 16) * size)) == NULL) {
+    perror("realloc");
+    exit(1);
+  }
+
+  return array;
+}
+
+static struct LibraryTotal *add_library(const char *path) {
+  for (int i = 0; i < num_libraries; i++) {
+    if (strcmp(libraries[i].path, path) == 0) return &libraries[i];
+  }
+
+  libraries = grow(libraries, num_libraries, sizeof(struct LibraryTotal));
+  memset(&libraries[num_libraries], 0, sizeof(struct LibraryTotal));
+  libraries[num_libraries].path = strdup(path);
+
+  return &libraries[num_libraries++];
+}
+
+static int split_line(char *line, char **fields) {
+  // split_line(): split a profile line at tabs, returns the number of fields
+  int num_fields = 0;
+
+  line[strcspn(line, "\n")] = '\0';
+
+  for (char *field = line; field && num_fields < PROFILE_FIELDS; num_fields++) {
+    fields[num_fields] = field;
+    if ((field = strchr(field, '\t'))) *field++ = '\0';
+  }
+
+  return num_fields;
+}
+
+static uint64_t total_ns(const struct LibraryTotal *library) {
+  return library->search_ns + library->map_ns + library->reloc_ns + library->init_ns;
+}
+
+static int compare_library(const void *a, const void *b) {
+  uint64_t x = total_ns(a), y = total_ns(b);
+
+  return (x < y) - (x > y);
+}
+
+static void print_hints(int num_listed) {
+  // print_hints(): what could make the libraries listed faster to load
+  int num_hints = 0;
+
+  printf("\nHints:\n");
+
+  for (int i = 0; i < num_listed; i++) {
+    struct LibraryTotal *library = &libraries[i];
+    double              loads    = library->loads;
+
+    if (library->not_found) {
+      printf("  %s: searched by %llu processes, remove the dependency or fix RUNPATH\n", library->path,
+             (unsigned long long) library->loads);
+      num_hints++;
+      continue;
+    }
+
+    if (!library->glibc && library->tries / loads >= HINT_TRIES) {
+      printf("  %s: %.1f files tried per load, run crew-preload-ldconfig (library cache) or put its directory first "
+             "in RUNPATH\n", library->path, library->tries / loads);
+      num_hints++;
+    }
+
+    if (library->relative >= HINT_RELATIVE && library->relr == 0) {
+      printf("  %s: %llu relative relocations, link with -Wl,-z,pack-relative-relocs (see crew-preload-relr)\n",
+             library->path, (unsigned long long) library->relative);
+      num_hints++;
+    }
+
+    if (library->lookups / loads >= HINT_LOOKUPS) {
+      printf("  %s: %.0f symbol lookups per load, hide internal symbols (-fvisibility=hidden) or bind them locally "
+             "(-Wl,-Bsymbolic-functions)\n", library->path, library->lookups / loads);
+      num_hints++;
+    }
+
+    if (library->init_ns / loads >= HINT_INIT_NS) {
+      printf("  %s: %.2f ms in constructors per load\n", library->path, library->init_ns / loads / 1e6);
+      num_hints++;
+    }
+  }
+
+  if (num_hints == 0) printf("  none\n");
+}
+
+int main(int argc, char **argv) {
+  char     line[8192], *fields[PROFILE_FIELDS], *pid_end;
+  uint64_t phase_ns[4] = { 0 }, num_processes = 0;
+  bool     all = false;
+  int      argi = 1, num_lines = 0, num_skipped = 0, num_listed;
+  FILE     *fp;
+
+  if (argi < argc - 1 && strcmp(argv[argi], "--all") == 0) {
+    all = true;
+    argi++;
+  }
+
+  if (argi != argc - 1) {
+    fprintf(stderr, "Usage: %s [--all] <load profile>\n", argv[0]);
+    return 1;
+  }
+
+  if ((fp = fopen(argv[argi], "r")) == NULL) {
+    perror(argv[argi]);
+    return 1;
+  }
+
+  while (fgets(line, sizeof(line), fp)) {
+    struct LibraryTotal *library;
+    char                not_found_path[sizeof(line) + 16];
+
+    if (split_line(line, fields) != PROFILE_FIELDS || strtol(fields[FIELD_PID], &pid_end, 10) <= 0 || *pid_end) {
+      num_skipped++;
+      continue;
+    }
+
+    num_lines++;
+
+    // every process writes one line for its main program, once its libraries are initialized
+    if (strcmp(fields[FIELD_FLAGS], "main") == 0) num_processes++;
+
+    if (strstr(fields[FIELD_FLAGS], "notfound")) {
+      snprintf(not_found_path, sizeof(not_found_path), "[not found] %s", fields[FIELD_NAME]);
+      library            = add_library(not_found_path);
+      library->not_found = true;
+    } else if (strcmp(fields[FIELD_FLAGS], "main") == 0 && strcmp(fields[FIELD_PATH], "-") == 0) {
+      library = add_library(fields[FIELD_PROGRAM]);
+    } else {
+      library = add_library(fields[FIELD_PATH]);
+    }
+
+    if (strstr(fields[FIELD_FLAGS], "glibc")) library->glibc = true;
+
+    library->loads++;
+    library->tries     += strtoull(fields[FIELD_TRIES], NULL, 10);
+    library->search_ns += strtoull(fields[FIELD_SEARCH], NULL, 10);
+    library->map_ns    += strtoull(fields[FIELD_MAP], NULL, 10);
+    library->reloc_ns  += strtoull(fields[FIELD_RELOC], NULL, 10);
+    library->lookups   += strtoull(fields[FIELD_LOOKUPS], NULL, 10);
+    library->init_ns   += strtoull(fields[FIELD_INIT], NULL, 10);
+    library->relative   = strtoull(fields[FIELD_RELATIVE], NULL, 10);
+    library->relr       = strtoull(fields[FIELD_RELR], NULL, 10);
+
+    phase_ns[0] += strtoull(fields[FIELD_SEARCH], NULL, 10);
+    phase_ns[1] += strtoull(fields[FIELD_MAP], NULL, 10);
+    phase_ns[2] += strtoull(fields[FIELD_RELOC], NULL, 10);
+    phase_ns[3] += strtoull(fields[FIELD_INIT], NULL, 10);
+  }
+
+  fclose(fp);
+
+  printf("%i objects loaded by %llu processes, %.1f ms (search %.1f, map %.1f, relocation %.1f, constructors %.1f)\n",
+         num_lines, (unsigned long long) num_processes, (phase_ns[0] + phase_ns[1] + phase_ns[2] + phase_ns[3]) / 1e6,
+         phase_ns[0] / 1e6, phase_ns[1] / 1e6, phase_ns[2] / 1e6, phase_ns[3] / 1e6);
+  if (num_skipped) printf("%i malformed lines skipped\n", num_skipped);
+
+  qsort(libraries, num_libraries, sizeof(struct LibraryTotal), compare_library);
+  num_listed = (all || num_libraries < TOP_ENTRIES) ? num_libraries : TOP_ENTRIES;
+
+  printf("\n%8s %10s %6s %8s %9s %8s %9s %9s  %s\n", "loads", "search us", "tries", "map us", "reloc us", "lookups",
+         "init us", "total ms", "path");
+
+  for (int i = 0; i < num_listed; i++) {
+    struct LibraryTotal *library = &libraries[i];
+    double              loads    = library->loads;
+
+    printf("%8llu %10.1f %6.1f %8.1f %9.1f %8.0f %9.1f %9.2f  %s\n", (unsigned long long) library->loads,
+           library->search_ns / loads / 1e3, library->tries / loads, library->map_ns / loads / 1e3,
+           library->reloc_ns / loads / 1e3, library->lookups / loads, library->init_ns / loads / 1e3,
+           total_ns(library) / 1e6, library->path);
+  }
+
+  if (num_listed < num_libraries) printf("(%i more, use --all to list them)\n", num_libraries - num_listed);
+
+  print_hints(num_listed);
+  return 0;
+}
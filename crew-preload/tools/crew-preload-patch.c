@@ -0,0 +1,344 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  crew-preload-patch: Rewrite the interpreter of installed executables to Chromebrew's dynamic linker ahead of time,
+                      so that crew-preload.so does not need to do it on every exec*()
+
+  Scans the given directories (CREW_PREFIX by default) with a pool of worker threads. Dynamically linked executables
+  are patched on disk with the same code crew-preload.so uses at runtime (see elf.c): the patched copy is written
+  next to the original and renamed over it, so running processes keep the old file. Executables that are skipped:
+
+    - shared libraries (*.so, *.so.*), setuid/setgid executables and executables with more than one hard link
+    - executables for the other bitness, or with a no-crew-glibc rule (see default.rules)
+    - anything under the exec cache (CREW_PRELOAD_EXEC_CACHE_DIR, default: ${CREW_PREFIX}/var/cache/crew-preload,
+      the same as crew-preload.so uses)
+
+  All executables using Chromebrew's dynamic linker afterwards are recorded in the native manifest (see manifest.h),
+  which lets crew-preload.so skip reading them. The manifest is replaced unless --update is given, in which case new
+  entries are merged into it (use that when scanning a single package).
+
+  Must be built with the same CREW_PREFIX/CREW_GLIBC_INTERPRETER as crew-preload.so (see Makefile).
+
+  Usage:
+
+    make tools
+
+    crew-preload-patch [--dry-run] [--update] [--verbose] [--jobs <n>] [--manifest <file>] [directory...]
+*/
+
+#include "../main.h"
+
+#include <ftw.h>
+#include <pthread.h>
+
+enum PatchResult {
+  RESULT_NOT_ELF,
+  RESULT_STATIC,
+  RESULT_FOREIGN,
+  RESULT_NATIVE,
+  RESULT_CONVERTED,
+  RESULT_SKIPPED,
+  RESULT_FAILED,
+  RESULT_MAX
+};
+
+static const char result_names[RESULT_MAX][40] = {
+  "not ELF",
+  "statically linked",
+  "other bitness",
+  "already native",
+  "converted",
+  "skipped",
+  "failed"
+};
+
+struct Worker {
+  pthread_t            thread;
+  struct ManifestEntry *entries;
+  uint32_t             num_entries,
+                       max_entries;
+};
+
+// referenced by elf.c and rules.c
+bool                  verbose       = false;
+THREAD_LOCAL uint32_t syscall_count = 0;
+
+static char     **files      = NULL;
+static uint32_t num_files    = 0,
+                max_files    = 0,
+                next_file    = 0;
+static uint64_t results[RESULT_MAX];
+static bool     dry_run      = false,
+                print_files  = false;
+
+// exec cache directory (see exec-cache.c), matched by device and inode so that any spelling of it is skipped
+static struct stat exec_cache_info;
+static bool        has_exec_cache = false;
+
+uint64_t trace_now(void) {
+  return 0;
+}
+
+void trace_event(enum PreloadTraceEvent event, const char *path, uint64_t start, uint16_t flags) {
+  (void) event, (void) path, (void) start, (void) flags;
+}
+
+static int collect_file(const char *path, const struct stat *file_info, int type, struct FTW *ftw) {
+  // collect_file(): nftw() callback, queue regular files with any execute bit set
+  const char *name = path + ftw->base;
+  size_t     len   = strlen(name);
+
+  if (type == FTW_D && has_exec_cache && file_info->st_dev == exec_cache_info.st_dev &&
+      file_info->st_ino == exec_cache_info.st_ino) {
+    return FTW_SKIP_SUBTREE;
+  }
+
+  if (type != FTW_F || !S_ISREG(file_info->st_mode) || !(file_info->st_mode & 0111)) return FTW_CONTINUE;
+
+  // shared libraries are never executed directly
+  if (strstr(name, ".so.") || (len > 3 && strcmp(name + len - 3, ".so") == 0)) return FTW_CONTINUE;
+
+  if (num_files == max_files) {
+    max_files = max_files ? max_files * 2 : 4096;
+    files     = realloc(files, max_files * sizeof(char *));
+  }
+
+  files[num_files++] = strdup(path);
+  return FTW_CONTINUE;
+}
+
+static void add_entry(struct Worker *worker, const struct ManifestEntry *entry) {
+  if (worker->num_entries == worker->max_entries) {
+    worker->max_entries = worker->max_entries ? worker->max_entries * 2 : 1024;
+    worker->entries     = realloc(worker->entries, worker->max_entries * sizeof(struct ManifestEntry));
+  }
+
+  worker->entries[worker->num_entries++] = *entry;
+}
+
+static void add_file(struct Worker *worker, const struct stat *file_info) {
+  // add_file(): same key as manifest_lookup() builds from struct FileId
+  struct ManifestEntry entry = {
+    .ino      = file_info->st_ino,
+    .dev      = file_info->st_dev,
+    .size     = file_info->st_size,
+    .mtime_ns = file_info->st_mtim.tv_sec * 1000000000ll + file_info->st_mtim.tv_nsec
+  };
+
+  add_entry(worker, &entry);
+}
+
+static enum PatchResult patch_file(struct Worker *worker, const char *path) {
+  // patch_file(): rewrite the interpreter of one executable, see the comment at the top
+  struct ElfInfo   elf_info;
+  struct RuleMatch match;
+  struct stat      file_info;
+  char             head[EXEC_HEAD_SIZE] __attribute__ ((aligned(16))), tmp_path[PATH_MAX];
+  ssize_t          head_len;
+  enum PatchResult result = RESULT_FAILED;
+  int              fd, tmp_fd;
+
+  if ((fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC)) == -1 || fstat(fd, &file_info) == -1) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    if (fd != -1) close(fd);
+    return RESULT_FAILED;
+  }
+
+  // same amount of data open_executable() in main.c reads
+  if ((head_len = pread(fd, head, sizeof(head), 0)) < SELFMAG || memcmp(head, ELFMAG, SELFMAG) != 0) {
+    close(fd);
+    return RESULT_NOT_ELF;
+  }
+
+  if (get_elf_information(path, fd, head, head_len, file_info.st_size, &elf_info) == -1) {
+    fprintf(stderr, "%s: malformed ELF executable\n", path);
+  } else if (!elf_info.is_dyn_exec) {
+    result = RESULT_STATIC;
+  } else if (elf_info.is_64bit != CREW_GLIBC_IS_64BIT) {
+    result = RESULT_FOREIGN;
+  } else if (strcmp(elf_info.interpreter, CREW_GLIBC_INTERPRETER) == 0) {
+    add_file(worker, &file_info);
+    result = RESULT_NATIVE;
+  } else if ((rule_match(path, &match) & RULE_NO_CREW_GLIBC) || file_info.st_nlink > 1 || (file_info.st_mode & (S_ISUID | S_ISGID))) {
+    if (print_files) fprintf(stderr, "%s: skipped\n", path);
+    result = RESULT_SKIPPED;
+  } else if (dry_run) {
+    if (print_files) fprintf(stderr, "%s: would be converted (%s)\n", path, elf_info.interpreter);
+    result = RESULT_CONVERTED;
+  } else if (snprintf(tmp_path, sizeof(tmp_path), "%s.crew-preload-patch.XXXXXX", path) >= (int) sizeof(tmp_path) ||
+             (tmp_fd = mkstemp(tmp_path)) == -1) {
+    fprintf(stderr, "%s: failed to create temporary file (%s)\n", path, strerror(errno));
+  } else {
+    // keep owner and permissions, the new file replaces the old one atomically
+    if (change_elf_interpreter(path, tmp_fd, fd, &elf_info) == -1 ||
+        fchown(tmp_fd, file_info.st_uid, file_info.st_gid) == -1 || fchmod(tmp_fd, file_info.st_mode & 07777) == -1 ||
+        fdatasync(tmp_fd) == -1 || fstat(tmp_fd, &file_info) == -1 || rename(tmp_path, path) == -1) {
+      fprintf(stderr, "%s: failed to write patched executable (%s)\n", path, strerror(errno));
+      unlink(tmp_path);
+    } else {
+      if (print_files) fprintf(stderr, "%s: converted (was %s)\n", path, elf_info.interpreter);
+
+      add_file(worker, &file_info);
+      result = RESULT_CONVERTED;
+    }
+
+    close(tmp_fd);
+  }
+
+  close(fd);
+  return result;
+}
+
+static void *worker_main(void *arg) {
+  struct Worker *worker = arg;
+  uint32_t      i;
+
+  while ((i = __atomic_fetch_add(&next_file, 1, __ATOMIC_RELAXED)) < num_files) {
+    __atomic_fetch_add(&results[patch_file(worker, files[i])], 1, __ATOMIC_RELAXED);
+  }
+
+  return NULL;
+}
+
+static int compare_entry(const void *a, const void *b) {
+  return manifest_compare(a, b);
+}
+
+static uint32_t read_manifest(const char *manifest_path, struct Worker *worker) {
+  // read_manifest(): add all entries of an existing manifest to worker (for --update)
+  struct ManifestHeader header;
+  struct ManifestEntry  entry;
+  uint32_t              count = 0;
+  FILE                  *fp   = fopen(manifest_path, "r");
+
+  if (fp == NULL) return 0;
+
+  if (fread(&header, sizeof(header), 1, fp) == 1 && header.magic == PRELOAD_MANIFEST_MAGIC &&
+      header.version == PRELOAD_MANIFEST_VERSION && strcmp(header.interpreter, CREW_GLIBC_INTERPRETER) == 0) {
+    for (; count < header.num_entries && fread(&entry, sizeof(entry), 1, fp) == 1; count++) add_entry(worker, &entry);
+  }
+
+  fclose(fp);
+  return count;
+}
+
+static int write_manifest(const char *manifest_path, struct ManifestEntry *entries, uint32_t num_entries) {
+  // write_manifest(): write sorted entries (without duplicates) into a temporary file, then rename it
+  struct ManifestHeader header = { .magic = PRELOAD_MANIFEST_MAGIC, .version = PRELOAD_MANIFEST_VERSION };
+  char                  tmp_path[PATH_MAX], dir[PATH_MAX];
+  uint32_t              unique = 0;
+  FILE                  *fp;
+  int                   fd;
+
+  qsort(entries, num_entries, sizeof(struct ManifestEntry), compare_entry);
+
+  for (uint32_t i = 0; i < num_entries; i++) {
+    if (unique == 0 || manifest_compare(&entries[unique - 1], &entries[i]) != 0) entries[unique++] = entries[i];
+  }
+
+  header.num_entries = unique;
+  snprintf(header.interpreter, sizeof(header.interpreter), "%s", CREW_GLIBC_INTERPRETER);
+
+  // create parent directories
+  snprintf(dir, sizeof(dir), "%s", manifest_path);
+
+  for (char *slash = strchr(dir + 1, '/'); slash; slash = strchr(slash + 1, '/')) {
+    *slash = '\0';
+    mkdir(dir, 0755);
+    *slash = '/';
+  }
+
+  snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", manifest_path);
+
+  if ((fd = mkstemp(tmp_path)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+    perror(tmp_path);
+    return -1;
+  }
+
+  if (fwrite(&header, sizeof(header), 1, fp) != 1 || fwrite(entries, sizeof(struct ManifestEntry), unique, fp) != unique ||
+      fchmod(fd, 0644) == -1 || fclose(fp) != 0 || rename(tmp_path, manifest_path) == -1) {
+    perror(manifest_path);
+    unlink(tmp_path);
+    return -1;
+  }
+
+  printf("manifest: %u entries written to %s\n", unique, manifest_path);
+  return 0;
+}
+
+int main(int argc, char **argv) {
+  const char      *manifest_path = CREW_PREFIX PRELOAD_MANIFEST_PATH;
+  struct Worker   *workers, merged = { 0 };
+  struct timespec start, end;
+  bool            update         = false;
+  long            num_workers    = sysconf(_SC_NPROCESSORS_ONLN);
+  int             argi;
+  double          elapsed;
+
+  for (argi = 1; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+    if (strcmp(argv[argi], "--dry-run") == 0) {
+      dry_run = true;
+    } else if (strcmp(argv[argi], "--update") == 0) {
+      update = true;
+    } else if (strcmp(argv[argi], "--verbose") == 0) {
+      print_files = true;
+    } else if (strcmp(argv[argi], "--jobs") == 0 && argi + 1 < argc) {
+      num_workers = atol(argv[++argi]);
+    } else if (strcmp(argv[argi], "--manifest") == 0 && argi + 1 < argc) {
+      manifest_path = argv[++argi];
+    } else {
+      fprintf(stderr, "Usage: %s [--dry-run] [--update] [--verbose] [--jobs <n>] [--manifest <file>] [directory (default: %s)...]\n",
+              argv[0], CREW_PREFIX);
+      return 1;
+    }
+  }
+
+  if (num_workers < 1) num_workers = 1;
+
+  has_exec_cache = (stat(getenv("CREW_PRELOAD_EXEC_CACHE_DIR") ?: CREW_PREFIX "/var/cache/crew-preload", &exec_cache_info) == 0);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (argi == argc) {
+    nftw(CREW_PREFIX, collect_file, 64, FTW_PHYS | FTW_ACTIONRETVAL);
+  } else {
+    for (; argi < argc; argi++) {
+      if (nftw(argv[argi], collect_file, 64, FTW_PHYS | FTW_ACTIONRETVAL) == -1) perror(argv[argi]);
+    }
+  }
+
+  // load rules before starting the workers (rule_match() maps them lazily)
+  rules_checksum();
+
+  workers = calloc(num_workers, sizeof(struct Worker));
+
+  for (long i = 0; i < num_workers; i++) pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+
+  for (long i = 0; i < num_workers; i++) {
+    pthread_join(workers[i].thread, NULL);
+
+    for (uint32_t j = 0; j < workers[i].num_entries; j++) add_entry(&merged, &workers[i].entries[j]);
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+  printf("%u executables scanned in %.3f s (%li threads)%s\n", num_files, elapsed, num_workers, dry_run ? ", dry run" : "");
+
+  for (int i = 0; i < RESULT_MAX; i++) printf("  %-20s %10llu\n", result_names[i], (unsigned long long) results[i]);
+
+  if (dry_run || strcmp(manifest_path, "-") == 0) return results[RESULT_FAILED] ? 1 : 0;
+
+  if (update) read_manifest(manifest_path, &merged);
+
+  if (write_manifest(manifest_path, merged.entries, merged.num_entries) == -1) return 1;
+
+  return results[RESULT_FAILED] ? 1 : 0;
+}
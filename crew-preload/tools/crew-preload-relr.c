@@ -0,0 +1,385 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  crew-preload-relr: Audit the dynamic relocations of installed shared libraries and PIE executables, and how much
+                     packing relative relocations with DT_RELR (ld -z pack-relative-relocs) would save
+
+  Chromebrew's dynamic linker runs DT_RELR objects without the GLIBC_ABI_DT_RELR version dependency
+  (../patches/0002-*.patch). For each DSO found under the given directories (CREW_PREFIX by default), this prints:
+
+    relative   relative relocations left in DT_RELA/DT_REL (24 or 8 bytes each, one loop iteration each)
+    relr       relative relocations encoded by DT_RELR
+    symbolic   other relocations, which need a symbol lookup and are not affected by packing
+    plt        DT_JMPREL relocations (lazy binding)
+    pages      pages written by non-PLT relocations (privately dirtied in every process, with or without DT_RELR)
+    size       bytes of DT_RELA/DT_REL/DT_RELR
+    saving     bytes saved if the remaining relative relocations were packed (exact DT_RELR encoding)
+
+  DSOs are sorted by saving (the top 20 unless --all is given), followed by totals.
+
+  Usage:
+
+    make tools
+
+    crew-preload-relr [--all] [directory...]
+*/
+
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifndef CREW_PREFIX
+#define CREW_PREFIX "/usr/local"
+#endif
+
+// older elf.h versions do not know DT_RELR
+#ifndef DT_RELR
+#define DT_RELRSZ 35
+#define DT_RELR   36
+#endif
+
+#define PAGE_SIZE_ 4096
+#define TOP_DSOS   20
+
+// read a field of an ELF structure of either class
+#define ELF_FIELD(is_64, type, ptr, field) \
+  ((is_64) ? (uint64_t) ((const Elf64_##type *) (ptr))->field : (uint64_t) ((const Elf32_##type *) (ptr))->field)
+
+struct DsoInfo {
+  char     *path;
+  uint64_t relative,
+           relr,
+           symbolic,
+           plt,
+           pages,
+           size,
+           saving;
+};
+
+struct Targets {
+  uint64_t *offsets;
+  size_t   count,
+           max;
+};
+
+static struct DsoInfo *dsos     = NULL;
+static uint32_t       num_dsos  = 0,
+                      max_dsos  = 0,
+                      num_files = 0;
+
+static void add_target(struct Targets *targets, uint64_t offset) {
+  if (targets->count == targets->max) {
+    targets->max     = targets->max ? targets->max * 2 : 4096;
+    targets->offsets = realloc(targets->offsets, targets->max * sizeof(uint64_t));
+  }
+
+  targets->offsets[targets->count++] = offset;
+}
+
+static int compare_u64(const void *a, const void *b) {
+  return (*(uint64_t *) a > *(uint64_t *) b) - (*(uint64_t *) a < *(uint64_t *) b);
+}
+
+static uint64_t relr_size(uint64_t *offsets, size_t count, uint64_t word_size, uint64_t *unaligned) {
+  // relr_size(): size of the DT_RELR encoding of the (sorted) relative relocation offsets, same algorithm as lld
+  //              and ld.bfd: an address entry, followed by bitmaps of the next 31/63 words while any of them is used
+  uint64_t bits = word_size * 8 - 1, size = 0;
+  size_t   i    = 0;
+
+  while (i < count) {
+    uint64_t base;
+
+    // offsets that are not word-aligned stay in DT_RELA/DT_REL
+    if (offsets[i] % word_size) {
+      (*unaligned)++;
+      i++;
+      continue;
+    }
+
+    size += word_size;
+    base  = offsets[i++] + word_size;
+
+    for (;;) {
+      size_t next = i;
+
+      while (next < count && offsets[next] - base < bits * word_size && (offsets[next] - base) % word_size == 0) next++;
+      if (next == i) break;
+
+      size += word_size;
+      base += bits * word_size;
+      i     = next;
+    }
+  }
+
+  return size;
+}
+
+static const void *vaddr_to_file(const char *file, size_t file_size, bool is_64, const char *phdrs, uint16_t phnum, uint64_t vaddr, uint64_t size) {
+  // vaddr_to_file(): map a virtual address range of the DSO to the file through its PT_LOAD segments
+  size_t phentsize = is_64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr);
+
+  for (uint16_t i = 0; i < phnum; i++) {
+    const char *phdr = phdrs + i * phentsize;
+    uint64_t   start = ELF_FIELD(is_64, Phdr, phdr, p_vaddr),
+               off   = ELF_FIELD(is_64, Phdr, phdr, p_offset);
+
+    if (ELF_FIELD(is_64, Phdr, phdr, p_type) != PT_LOAD || vaddr < start ||
+        vaddr + size > start + ELF_FIELD(is_64, Phdr, phdr, p_filesz)) {
+      continue;
+    }
+
+    if (off + (vaddr - start) + size > file_size) return NULL;
+    return file + off + (vaddr - start);
+  }
+
+  return NULL;
+}
+
+static bool is_relative(uint16_t machine, uint32_t type) {
+  switch (machine) {
+    case EM_X86_64:  return type == R_X86_64_RELATIVE;
+    case EM_386:     return type == R_386_RELATIVE;
+    case EM_ARM:     return type == R_ARM_RELATIVE;
+    case EM_AARCH64: return type == R_AARCH64_RELATIVE;
+    default:         return false;
+  }
+}
+
+static int audit_dso(const char *path, const char *file, size_t file_size, struct DsoInfo *info) {
+  // audit_dso(): count the relocations of one ELF file, returns -1 if it is not a DSO with a dynamic section
+  const char     *ehdr = file, *phdrs, *dynamic = NULL;
+  bool           is_64;
+  uint16_t       machine, phnum;
+  uint64_t       word_size, dyn_size = 0, unaligned = 0, relative_bytes = 0, tags[DT_RELR + 1] = { 0 };
+  struct Targets relative = { 0 }, written = { 0 };
+
+  if (file_size < sizeof(Elf32_Ehdr) || memcmp(file, ELFMAG, SELFMAG) != 0) return -1;
+
+  is_64     = (file[EI_CLASS] == ELFCLASS64);
+  word_size = is_64 ? 8 : 4;
+  machine   = ELF_FIELD(is_64, Ehdr, ehdr, e_machine);
+  phnum     = ELF_FIELD(is_64, Ehdr, ehdr, e_phnum);
+  phdrs     = file + ELF_FIELD(is_64, Ehdr, ehdr, e_phoff);
+
+  if ((is_64 && file_size < sizeof(Elf64_Ehdr)) || ELF_FIELD(is_64, Ehdr, ehdr, e_type) != ET_DYN ||
+      ELF_FIELD(is_64, Ehdr, ehdr, e_phoff) + phnum * (is_64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr)) > file_size) {
+    return -1;
+  }
+
+  for (uint16_t i = 0; i < phnum; i++) {
+    const char *phdr = phdrs + i * (is_64 ? sizeof(Elf64_Phdr) : sizeof(Elf32_Phdr));
+
+    if (ELF_FIELD(is_64, Phdr, phdr, p_type) != PT_DYNAMIC) continue;
+    if (ELF_FIELD(is_64, Phdr, phdr, p_offset) + ELF_FIELD(is_64, Phdr, phdr, p_filesz) > file_size) return -1;
+
+    dynamic  = file + ELF_FIELD(is_64, Phdr, phdr, p_offset);
+    dyn_size = ELF_FIELD(is_64, Phdr, phdr, p_filesz);
+  }
+
+  if (dynamic == NULL) return -1;
+
+  for (uint64_t off = 0; off + (is_64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn)) <= dyn_size; off += is_64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn)) {
+    int64_t tag = is_64 ? ((const Elf64_Dyn *) (dynamic + off))->d_tag : ((const Elf32_Dyn *) (dynamic + off))->d_tag;
+
+    if (tag == DT_NULL) break;
+    if (tag > 0 && tag <= DT_RELR) tags[tag] = ELF_FIELD(is_64, Dyn, dynamic + off, d_un.d_val);
+  }
+
+  memset(info, 0, sizeof(*info));
+
+  // DT_RELA and DT_REL, without the DT_JMPREL part some linkers include in DT_RELASZ
+  for (int rela = 0; rela < 2; rela++) {
+    uint64_t   addr    = tags[rela ? DT_RELA : DT_REL],
+               size    = tags[rela ? DT_RELASZ : DT_RELSZ],
+               entsize = rela ? (is_64 ? sizeof(Elf64_Rela) : sizeof(Elf32_Rela)) : (is_64 ? sizeof(Elf64_Rel) : sizeof(Elf32_Rel));
+    const char *table  = (addr && size) ? vaddr_to_file(file, file_size, is_64, phdrs, phnum, addr, size) : NULL;
+
+    if (table == NULL) continue;
+
+    if (tags[DT_JMPREL] >= addr && tags[DT_JMPREL] < addr + size) size = tags[DT_JMPREL] - addr;
+
+    info->size += size;
+
+    for (uint64_t off = 0; off + entsize <= size; off += entsize) {
+      uint64_t r_offset = ELF_FIELD(is_64, Rel, table + off, r_offset),
+               r_info   = ELF_FIELD(is_64, Rel, table + off, r_info);
+      uint32_t type     = is_64 ? ELF64_R_TYPE(r_info) : ELF32_R_TYPE(r_info);
+
+      if (is_relative(machine, type)) {
+        info->relative++;
+        relative_bytes += entsize;
+        add_target(&relative, r_offset);
+      } else {
+        info->symbolic++;
+      }
+
+      add_target(&written, r_offset);
+    }
+  }
+
+  // decode DT_RELR: an even entry is an address, an odd entry a bitmap of the following 31/63 words
+  if (tags[DT_RELR] && tags[DT_RELRSZ]) {
+    const char *table = vaddr_to_file(file, file_size, is_64, phdrs, phnum, tags[DT_RELR], tags[DT_RELRSZ]);
+    uint64_t   where  = 0;
+
+    for (uint64_t off = 0; table && off + word_size <= tags[DT_RELRSZ]; off += word_size) {
+      uint64_t entry = is_64 ? *(const uint64_t *) (table + off) : *(const uint32_t *) (table + off);
+
+      if ((entry & 1) == 0) {
+        add_target(&written, entry);
+        info->relr++;
+        where = entry + word_size;
+        continue;
+      }
+
+      for (uint64_t bit = 1; bit < word_size * 8; bit++) {
+        if ((entry >> bit) & 1) {
+          add_target(&written, where + (bit - 1) * word_size);
+          info->relr++;
+        }
+      }
+
+      where += (word_size * 8 - 1) * word_size;
+    }
+
+    info->size += tags[DT_RELRSZ];
+  }
+
+  info->plt = tags[DT_PLTRELSZ] / ((tags[DT_PLTREL] == DT_RELA) ? (is_64 ? sizeof(Elf64_Rela) : sizeof(Elf32_Rela))
+                                                                : (is_64 ? sizeof(Elf64_Rel) : sizeof(Elf32_Rel)));
+
+  // packing replaces the relative entries by their DT_RELR encoding (new bitmaps, existing DT_RELR entries are kept)
+  if (relative.count) {
+    uint64_t packed;
+
+    qsort(relative.offsets, relative.count, sizeof(uint64_t), compare_u64);
+    packed       = relr_size(relative.offsets, relative.count, word_size, &unaligned);
+    info->saving = relative_bytes - unaligned * (relative_bytes / relative.count) - packed;
+  }
+
+  if (written.count) {
+    qsort(written.offsets, written.count, sizeof(uint64_t), compare_u64);
+    info->pages = 1;
+
+    for (size_t i = 1; i < written.count; i++) {
+      if (written.offsets[i] / PAGE_SIZE_ != written.offsets[i - 1] / PAGE_SIZE_) info->pages++;
+    }
+  }
+
+  info->path = strdup(path);
+
+  free(relative.offsets);
+  free(written.offsets);
+  return 0;
+}
+
+static int audit_file(const char *path, const struct stat *file_info, int type, struct FTW *ftw) {
+  // audit_file(): nftw() callback, audit shared libraries (*.so, *.so.*) and executables
+  const char *name = path + ftw->base, *file;
+  size_t     len   = strlen(name);
+  int        fd;
+
+  if (type != FTW_F || !S_ISREG(file_info->st_mode) || file_info->st_size < (off_t) sizeof(Elf32_Ehdr)) return 0;
+  if (!(file_info->st_mode & 0111) && !strstr(name, ".so.") && !(len > 3 && strcmp(name + len - 3, ".so") == 0)) return 0;
+
+  if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) return 0;
+
+  file = mmap(NULL, file_info->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (file == MAP_FAILED) return 0;
+
+  num_files++;
+
+  if (num_dsos == max_dsos) {
+    max_dsos = max_dsos ? max_dsos * 2 : 1024;
+    dsos     = realloc(dsos, max_dsos * sizeof(struct DsoInfo));
+  }
+
+  if (audit_dso(path, file, file_info->st_size, &dsos[num_dsos]) == 0) num_dsos++;
+
+  munmap((void *) file, file_info->st_size);
+  return 0;
+}
+
+static int compare_saving(const void *a, const void *b) {
+  const struct DsoInfo *x = a, *y = b;
+
+  return (x->saving < y->saving) - (x->saving > y->saving);
+}
+
+int main(int argc, char **argv) {
+  struct DsoInfo total   = { 0 };
+  uint32_t       packed  = 0, shown;
+  bool           all     = false;
+  int            argi;
+
+  for (argi = 1; argi < argc && strncmp(argv[argi], "--", 2) == 0; argi++) {
+    if (strcmp(argv[argi], "--all") == 0) {
+      all = true;
+    } else {
+      fprintf(stderr, "Usage: %s [--all] [directory (default: %s)...]\n", argv[0], CREW_PREFIX);
+      return 1;
+    }
+  }
+
+  if (argi == argc) {
+    nftw(CREW_PREFIX, audit_file, 64, FTW_PHYS);
+  } else {
+    for (; argi < argc; argi++) {
+      if (nftw(argv[argi], audit_file, 64, FTW_PHYS) == -1) perror(argv[argi]);
+    }
+  }
+
+  qsort(dsos, num_dsos, sizeof(struct DsoInfo), compare_saving);
+  shown = (all || num_dsos < TOP_DSOS) ? num_dsos : TOP_DSOS;
+
+  printf("%10s %10s %10s %8s %7s %10s %10s  %s\n", "relative", "relr", "symbolic", "plt", "pages", "size kB", "saving kB", "path");
+
+  for (uint32_t i = 0; i < num_dsos; i++) {
+    const struct DsoInfo *dso = &dsos[i];
+
+    if (i < shown) {
+      printf("%10llu %10llu %10llu %8llu %7llu %10.1f %10.1f  %s\n", (unsigned long long) dso->relative, (unsigned long long) dso->relr,
+             (unsigned long long) dso->symbolic, (unsigned long long) dso->plt, (unsigned long long) dso->pages,
+             dso->size / 1024.0, dso->saving / 1024.0, dso->path);
+    }
+
+    if (dso->relr) packed++;
+
+    total.relative += dso->relative;
+    total.relr     += dso->relr;
+    total.symbolic += dso->symbolic;
+    total.plt      += dso->plt;
+    total.pages    += dso->pages;
+    total.size     += dso->size;
+    total.saving   += dso->saving;
+  }
+
+  if (shown < num_dsos) printf("%10s (%u more, use --all)\n", "...", num_dsos - shown);
+
+  printf("%10llu %10llu %10llu %8llu %7llu %10.1f %10.1f  total\n\n", (unsigned long long) total.relative, (unsigned long long) total.relr,
+         (unsigned long long) total.symbolic, (unsigned long long) total.plt, (unsigned long long) total.pages,
+         total.size / 1024.0, total.saving / 1024.0);
+
+  printf("%u files read, %u DSOs, %u using DT_RELR, %.1f%% of relative relocations packed\n", num_files, num_dsos, packed,
+         (total.relative + total.relr) ? 100.0 * total.relr / (total.relative + total.relr) : 0.0);
+
+  return 0;
+}
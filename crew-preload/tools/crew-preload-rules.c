@@ -0,0 +1,310 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  crew-preload-rules: Compile path rewrite rules (see default.rules for the syntax) into the binary format
+                      used by crew-preload.so (see rules.h)
+
+  Usage:
+
+    make tools
+
+    crew-preload-rules <rules file> <output file>                  # for CREW_PRELOAD_RULES
+    crew-preload-rules --c-header <rules file> <output header>     # builtin defaults (see Makefile)
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../rules.h"
+
+#define MAX_LINE 4096
+
+struct BuildNode {
+  int      child[256];
+  uint16_t exact_rule,
+           prefix_rule;
+  uint32_t index;
+};
+
+static const struct {
+  const char *keyword;
+  uint16_t   flag;
+} flag_keywords[] = {
+#define X(name, bit, keyword, description) { keyword, RULE_##name },
+  PRELOAD_RULE_FLAG_LIST(X)
+#undef X
+};
+
+static struct BuildNode *nodes       = NULL;
+static int              num_nodes    = 0;
+static struct Rule      *rules       = NULL;
+static int              num_rules    = 1; // rule 0 is unused
+static char             *strings     = NULL;
+static uint32_t         strings_size = 0;
+
+static int new_node(void) {
+  nodes = realloc(nodes, (num_nodes + 1) * sizeof(struct BuildNode));
+  memset(&nodes[num_nodes], 0, sizeof(struct BuildNode));
+
+  return num_nodes++;
+}
+
+static uint32_t add_string(const char *str) {
+  uint32_t offset = strings_size, len = strlen(str) + 1;
+
+  strings       = realloc(strings, strings_size + len);
+  memcpy(strings + offset, str, len);
+  strings_size += len;
+
+  return offset;
+}
+
+static int parse_rule(char *line, const char *rules_path, int line_num, int path_root, int name_root) {
+  // parse_rule(): add one line of the rules file to the trie, returns -1 on error
+  char     *pattern = strtok(line, " \t\r\n"), *replacement = strtok(NULL, " \t\r\n"), *keyword;
+  size_t   pattern_len, replacement_len;
+  uint16_t flags = 0, *slot;
+  int      node;
+
+  if (pattern == NULL || pattern[0] == '#') return 0;
+
+  if (replacement == NULL) {
+    fprintf(stderr, "%s:%i: missing replacement (use - for none)\n", rules_path, line_num);
+    return -1;
+  }
+
+  while ((keyword = strtok(NULL, " \t\r\n"))) {
+    int i;
+
+    for (i = 0; i < (int) (sizeof(flag_keywords) / sizeof(flag_keywords[0])); i++) {
+      if (strcmp(keyword, flag_keywords[i].keyword) == 0) break;
+    }
+
+    if (i == (int) (sizeof(flag_keywords) / sizeof(flag_keywords[0]))) {
+      fprintf(stderr, "%s:%i: unknown flag '%s'\n", rules_path, line_num, keyword);
+      return -1;
+    }
+
+    flags |= flag_keywords[i].flag;
+  }
+
+  pattern_len = strlen(pattern);
+
+  if (pattern[0] == '/') {
+    if (pattern[pattern_len - 1] == '*') {
+      pattern[--pattern_len] = '\0';
+      flags                 |= RULE_PREFIX_MATCH;
+    }
+  } else if (strchr(pattern, '/')) {
+    fprintf(stderr, "%s:%i: '%s' is neither an absolute path nor an executable name\n", rules_path, line_num, pattern);
+    return -1;
+  }
+
+  if (strchr(pattern, '*')) {
+    fprintf(stderr, "%s:%i: '*' is only allowed at the end of path patterns\n", rules_path, line_num);
+    return -1;
+  }
+
+  if (strcmp(replacement, "-") == 0) {
+    replacement = NULL;
+
+    if (flags & (RULE_REDIRECT | RULE_FALLBACK)) {
+      fprintf(stderr, "%s:%i: redirect/fallback rules need a replacement\n", rules_path, line_num);
+      return -1;
+    }
+  } else {
+    if (strncmp(replacement, "${CREW_PREFIX}", 14) == 0) {
+      replacement += 14;
+      flags       |= RULE_CREW_PREFIX;
+    }
+
+    replacement_len = strlen(replacement);
+
+    // for prefix patterns, * marks where the remainder of the path goes (only supported at the end)
+    if (!!(flags & RULE_PREFIX_MATCH) != (replacement_len > 0 && replacement[replacement_len - 1] == '*')) {
+      fprintf(stderr, "%s:%i: replacement must end with * if (and only if) the pattern does\n", rules_path, line_num);
+      return -1;
+    }
+
+    if (flags & RULE_PREFIX_MATCH) replacement[--replacement_len] = '\0';
+
+    if (strchr(replacement, '*')) {
+      fprintf(stderr, "%s:%i: '*' is only allowed at the end of replacements\n", rules_path, line_num);
+      return -1;
+    }
+  }
+
+  if (num_rules == UINT16_MAX) {
+    fprintf(stderr, "%s:%i: too many rules\n", rules_path, line_num);
+    return -1;
+  }
+
+  // walk down the trie, adding nodes as needed
+  node = (pattern[0] == '/') ? path_root : name_root;
+
+  for (size_t i = 0; i < pattern_len; i++) {
+    uint8_t label = pattern[i];
+
+    if (nodes[node].child[label] == 0) {
+      int child = new_node();
+      nodes[node].child[label] = child;
+    }
+
+    node = nodes[node].child[label];
+  }
+
+  slot = (flags & RULE_PREFIX_MATCH) ? &nodes[node].prefix_rule : &nodes[node].exact_rule;
+
+  if (*slot) {
+    fprintf(stderr, "%s:%i: duplicate pattern '%s%s'\n", rules_path, line_num, pattern, (flags & RULE_PREFIX_MATCH) ? "*" : "");
+    return -1;
+  }
+
+  rules = realloc(rules, (num_rules + 1) * sizeof(struct Rule));
+  rules[num_rules].replacement = replacement ? add_string(replacement) : UINT32_MAX;
+  rules[num_rules].flags       = flags;
+  rules[num_rules].padding     = 0;
+
+  *slot = num_rules++;
+  return 0;
+}
+
+static uint32_t fnv1a(const uint8_t *data, size_t len) {
+  uint32_t hash = 2166136261u;
+
+  for (size_t i = 0; i < len; i++) hash = (hash ^ data[i]) * 16777619u;
+
+  return hash;
+}
+
+static uint8_t *serialize(int path_root, int name_root, uint32_t *size) {
+  // serialize(): lay out the trie breadth-first, so that the children of every node are contiguous
+  struct RuleTable *table;
+  struct RuleNode  *out_nodes;
+  uint8_t          *out;
+  int              *queue = calloc(num_nodes, sizeof(int)), queue_head = 0, queue_tail = 0;
+  uint32_t         nodes_offset   = sizeof(struct RuleTable),
+                   rules_offset   = nodes_offset + num_nodes * sizeof(struct RuleNode),
+                   strings_offset = rules_offset + num_rules * sizeof(struct Rule);
+
+  // strings are NUL-terminated and padded, so that the builtin table can be emitted as an array of uint32_t
+  *size     = (strings_offset + strings_size + 1 + 3) & ~3;
+  out       = calloc(1, *size);
+  table     = (struct RuleTable *) out;
+  out_nodes = (struct RuleNode *) (out + nodes_offset);
+
+  queue[queue_tail++] = path_root;
+  queue[queue_tail++] = name_root;
+  nodes[path_root].index = 0;
+  nodes[name_root].index = 1;
+
+  while (queue_head < queue_tail) {
+    struct BuildNode *node = &nodes[queue[queue_head++]];
+    struct RuleNode  *out_node = &out_nodes[node->index];
+
+    out_node->first_child = queue_tail;
+    out_node->exact_rule  = node->exact_rule;
+    out_node->prefix_rule = node->prefix_rule;
+
+    for (int label = 0; label < 256; label++) {
+      if (node->child[label] == 0) continue;
+
+      nodes[node->child[label]].index = queue_tail;
+      out_nodes[queue_tail].label     = label;
+      queue[queue_tail++]             = node->child[label];
+      out_node->num_children++;
+    }
+  }
+
+  memcpy(out + rules_offset, rules, num_rules * sizeof(struct Rule));
+  if (strings_size) memcpy(out + strings_offset, strings, strings_size);
+
+  table->magic          = PRELOAD_RULES_MAGIC;
+  table->version        = PRELOAD_RULES_VERSION;
+  table->size           = *size;
+  table->num_nodes      = num_nodes;
+  table->num_rules      = num_rules;
+  table->strings_size   = *size - strings_offset;
+  table->path_root      = 0;
+  table->name_root      = 1;
+  table->nodes_offset   = nodes_offset;
+  table->rules_offset   = rules_offset;
+  table->strings_offset = strings_offset;
+  table->checksum       = fnv1a(out + sizeof(struct RuleTable), *size - sizeof(struct RuleTable));
+
+  free(queue);
+  return out;
+}
+
+int main(int argc, char **argv) {
+  bool     c_header    = (argc == 4 && strcmp(argv[1], "--c-header") == 0);
+  char     line[MAX_LINE];
+  int      line_num    = 0, path_root, name_root;
+  uint32_t size;
+  uint8_t  *table;
+  FILE     *in, *out;
+
+  if (argc != 3 && !c_header) {
+    fprintf(stderr, "Usage: %s [--c-header] <rules file> <output file>\n", argv[0]);
+    return 1;
+  }
+
+  const char *rules_path = argv[argc - 2], *out_path = argv[argc - 1];
+
+  if ((in = fopen(rules_path, "r")) == NULL) {
+    perror(rules_path);
+    return 1;
+  }
+
+  // roots are never children of another node, so child[] == 0 means no child
+  path_root = new_node();
+  name_root = new_node();
+  rules     = calloc(1, sizeof(struct Rule));
+
+  while (fgets(line, sizeof(line), in)) {
+    line_num++;
+    if (parse_rule(line, rules_path, line_num, path_root, name_root) == -1) return 1;
+  }
+
+  fclose(in);
+
+  table = serialize(path_root, name_root, &size);
+
+  if ((out = fopen(out_path, "w")) == NULL) {
+    perror(out_path);
+    return 1;
+  }
+
+  if (c_header) {
+    fprintf(out, "// generated from %s by tools/crew-preload-rules, do not edit\n\n", rules_path);
+    fprintf(out, "static const uint32_t builtin_rules[] = {");
+
+    for (uint32_t i = 0; i < size / 4; i++) {
+      uint32_t word;
+
+      memcpy(&word, table + i * 4, 4);
+      fprintf(out, "%s0x%08x,", (i % 8 == 0) ? "\n  " : " ", word);
+    }
+
+    fprintf(out, "\n};\n");
+  } else {
+    fwrite(table, 1, size, out);
+  }
+
+  if (fclose(out) != 0) {
+    perror(out_path);
+    return 1;
+  }
+
+  fprintf(stderr, "%s: %i rules, %i trie nodes, %u bytes\n", out_path, num_rules - 1, num_nodes, size);
+  return 0;
+}
@@ -0,0 +1,123 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  crew-preload-stat: Print statistics collected by crew-preload.so (see stats.c)
+
+  Usage:
+
+    cc -O2 crew-preload-stat.c -o crew-preload-stat
+
+    CREW_PRELOAD_STATS=/tmp/build.stats crew build <package>
+    crew-preload-stat [--reset] /tmp/build.stats
+*/
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../stats.h"
+
+static const char *stat_names[] = {
+#define X(name, description) description,
+  PRELOAD_STAT_LIST(X)
+#undef X
+};
+
+static uint64_t percentile(const uint64_t *hist, uint64_t total, uint64_t max, double p) {
+  // percentile(): upper bound of the bucket that contains the p-th percentile
+  uint64_t seen = 0;
+
+  for (int i = 0; i < PRELOAD_STATS_BUCKETS; i++) {
+    if ((seen += hist[i]) >= total * p && seen > 0) return (stats_bucket_max(i) < max) ? stats_bucket_max(i) : max;
+  }
+
+  return max;
+}
+
+static void print_distribution(const char *label, const uint64_t *hist, uint64_t sum, uint64_t max, double scale, const char *unit) {
+  uint64_t total = 0;
+
+  for (int i = 0; i < PRELOAD_STATS_BUCKETS; i++) total += hist[i];
+  if (total == 0) return;
+
+  printf("%-24s %10.2f %10.2f %10.2f %10.2f %10.2f  (%s)\n", label, sum / scale / total,
+         percentile(hist, total, max, 0.50) / scale, percentile(hist, total, max, 0.90) / scale,
+         percentile(hist, total, max, 0.99) / scale, max / scale, unit);
+}
+
+int main(int argc, char **argv) {
+  struct PreloadStats *stats;
+  struct stat         stats_info;
+  bool                reset = (argc == 3 && strcmp(argv[1], "--reset") == 0);
+  const char          *stats_path = argv[argc - 1];
+  int                 fd;
+
+  if (argc != 2 && !reset) {
+    fprintf(stderr, "Usage: %s [--reset] <statistics file (CREW_PRELOAD_STATS)>\n", argv[0]);
+    return 1;
+  }
+
+  if ((fd = open(stats_path, reset ? O_RDWR : O_RDONLY)) == -1 || fstat(fd, &stats_info) == -1) {
+    perror(stats_path);
+    return 1;
+  }
+
+  if (stats_info.st_size < (off_t) sizeof(struct PreloadStats)) {
+    fprintf(stderr, "%s: file too small, not a crew-preload statistics file?\n", stats_path);
+    return 1;
+  }
+
+  stats = mmap(NULL, sizeof(*stats), reset ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (stats == MAP_FAILED) {
+    perror("mmap");
+    return 1;
+  }
+
+  if (stats->magic != PRELOAD_STATS_MAGIC || stats->version != PRELOAD_STATS_VERSION ||
+      stats->num_counters != STAT_MAX || stats->num_buckets != PRELOAD_STATS_BUCKETS) {
+    fprintf(stderr, "%s: unsupported file format (version %u)\n", stats_path, stats->version);
+    return 1;
+  }
+
+  if (reset) {
+    // keep the header, processes that are still running keep adding to the same file
+    memset(stats->counters, 0, sizeof(*stats) - offsetof(struct PreloadStats, counters));
+    return 0;
+  }
+
+  uint64_t *counters = stats->counters,
+           calls     = counters[STAT_EXEC_CALLS] + counters[STAT_SPAWN_CALLS];
+
+  printf("Counters (%s):\n", stats_path);
+  for (int i = 0; i < STAT_MAX; i++) printf("  %-52s %16llu\n", stat_names[i], (unsigned long long) counters[i]);
+
+  printf("\nTotal time spent in crew-preload.so: %.3f s (%.3f s in preload_init(), %.3f s in exec_wrapper())\n",
+         (counters[STAT_INIT_NS] + counters[STAT_WRAPPER_NS]) / 1e9, counters[STAT_INIT_NS] / 1e9, counters[STAT_WRAPPER_NS] / 1e9);
+  printf("Memory used by private executable copies (memfd): %.1f MiB\n", counters[STAT_MEMFD_BYTES] / 1048576.0);
+
+  if (calls > 0) {
+    printf("\nPer exec_wrapper() call:   %10s %10s %10s %10s %10s\n", "mean", "p50", "p90", "p99", "max");
+    print_distribution("  time", stats->wrapper_ns_hist, counters[STAT_WRAPPER_NS], stats->wrapper_ns_max, 1e3, "us");
+    print_distribution("  syscalls", stats->syscalls_hist, counters[STAT_SYSCALLS], stats->syscalls_max, 1, "count");
+  }
+
+  if (counters[STAT_PROCESSES] > 0) {
+    printf("\nPer process: %.2f us in preload_init()\n", counters[STAT_INIT_NS] / 1e3 / counters[STAT_PROCESSES]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,257 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  crew-preload-trace: Convert trace files written by crew-preload.so (see trace.c) into a Chrome trace (JSON),
+                      which can be opened with https://ui.perfetto.dev or chrome://tracing
+
+  Every process becomes a track named after the executables it ran (`sh -> make` if make was exec*()-ed by sh),
+  tracks are sorted by the process tree (children below their parent) and carry the parent's pid as label.
+
+  Usage:
+
+    make tools
+
+    CREW_PRELOAD_TRACE=/tmp/build.trace crew build <package>
+    crew-preload-trace /tmp/build.trace > build.json
+*/
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "../trace.h"
+
+struct TraceProcess {
+  uint32_t pid,
+           ppid,
+           sort_index;
+  uint64_t start_ns;
+  char     name[256];
+  bool     visited;
+};
+
+static const char *event_names[] = {
+  "none",
+#define X(name, description) description,
+  PRELOAD_TRACE_EVENT_LIST(X)
+#undef X
+};
+
+static struct TraceProcess *processes     = NULL;
+static int                 num_processes  = 0;
+static uint32_t            next_sort_index = 0;
+
+static void print_json_string(const char *str) {
+  putchar('"');
+
+  for (; *str; str++) {
+    if (*str == '"' || *str == '\\') {
+      printf("\\%c", *str);
+    } else if ((unsigned char) *str < 0x20) {
+      printf("\\u%04x", *str);
+    } else {
+      putchar(*str);
+    }
+  }
+
+  putchar('"');
+}
+
+static struct TraceProcess *find_process(uint32_t pid) {
+  for (int i = 0; i < num_processes; i++) {
+    if (processes[i].pid == pid) return &processes[i];
+  }
+
+  return NULL;
+}
+
+static void add_process_image(uint32_t pid, uint32_t ppid, uint64_t start_ns, const char *exe_path) {
+  // add_process_image(): every exec*() creates a new trace file for the same pid, the track is named after all of them
+  struct TraceProcess *process = find_process(pid);
+  const char          *name    = strrchr(exe_path, '/') ? strrchr(exe_path, '/') + 1 : exe_path;
+
+  if (process == NULL) {
+    processes = realloc(processes, (num_processes + 1) * sizeof(struct TraceProcess));
+    process   = &processes[num_processes++];
+
+    memset(process, 0, sizeof(*process));
+    process->pid      = pid;
+    process->ppid     = ppid;
+    process->start_ns = start_ns;
+    snprintf(process->name, sizeof(process->name), "%s", name);
+  } else if (start_ns < process->start_ns) {
+    char later[sizeof(process->name)];
+
+    strcpy(later, process->name);
+    snprintf(process->name, sizeof(process->name), "%s -> %s", name, later);
+    process->ppid     = ppid;
+    process->start_ns = start_ns;
+  } else {
+    size_t len = strlen(process->name);
+    snprintf(process->name + len, sizeof(process->name) - len, " -> %s", name);
+  }
+}
+
+static void assign_sort_index(struct TraceProcess *parent) {
+  // assign_sort_index(): depth-first order of the process tree
+  parent->visited    = true;
+  parent->sort_index = next_sort_index++;
+
+  for (int i = 0; i < num_processes; i++) {
+    if (!processes[i].visited && processes[i].ppid == parent->pid) assign_sort_index(&processes[i]);
+  }
+}
+
+static const struct TraceFile *map_trace_file(const char *trace_path) {
+  const struct TraceFile *trace;
+  struct stat            trace_info;
+  int                    fd;
+
+  if ((fd = open(trace_path, O_RDONLY)) == -1 || fstat(fd, &trace_info) == -1) {
+    perror(trace_path);
+    if (fd != -1) close(fd);
+    return NULL;
+  }
+
+  if (trace_info.st_size < (off_t) sizeof(struct TraceFile)) {
+    close(fd);
+    return NULL;
+  }
+
+  trace = mmap(NULL, sizeof(struct TraceFile), PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (trace == MAP_FAILED) return NULL;
+
+  if (trace->magic != PRELOAD_TRACE_MAGIC || trace->version != PRELOAD_TRACE_VERSION ||
+      trace->num_records != PRELOAD_TRACE_RECORDS || trace->strings_size != PRELOAD_TRACE_STRINGS) {
+    fprintf(stderr, "%s: unsupported file format (version %u), skipping\n", trace_path, trace->version);
+    munmap((void *) trace, sizeof(struct TraceFile));
+    return NULL;
+  }
+
+  return trace;
+}
+
+static const char *record_path(const struct TraceFile *trace, const struct TraceRecord *record) {
+  if (record->path_id == 0 || record->path_id > PRELOAD_TRACE_STRINGS) return "";
+  return trace->strings + record->path_id - 1;
+}
+
+int main(int argc, char **argv) {
+  const struct TraceFile **traces    = NULL;
+  int                    num_traces  = 0;
+  uint64_t               base_ns     = UINT64_MAX;
+  bool                   first_event = true;
+  struct dirent          *entry;
+  DIR                    *dir;
+
+  if (argc != 2) {
+    fprintf(stderr, "Usage: %s <trace directory (CREW_PRELOAD_TRACE)>\n", argv[0]);
+    return 1;
+  }
+
+  if ((dir = opendir(argv[1])) == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  while ((entry = readdir(dir))) {
+    const struct TraceFile *trace;
+    char                   trace_path[4096];
+    size_t                 len = strlen(entry->d_name);
+
+    if (len < 6 || strcmp(entry->d_name + len - 6, ".trace") != 0) continue;
+
+    snprintf(trace_path, sizeof(trace_path), "%s/%s", argv[1], entry->d_name);
+    if ((trace = map_trace_file(trace_path)) == NULL) continue;
+
+    traces               = realloc(traces, (num_traces + 1) * sizeof(*traces));
+    traces[num_traces++] = trace;
+
+    if (trace->start_ns < base_ns) base_ns = trace->start_ns;
+  }
+
+  closedir(dir);
+
+  if (num_traces == 0) {
+    fprintf(stderr, "%s: no trace files found\n", argv[1]);
+    return 1;
+  }
+
+  // one process image per file, named after the executable recorded by preload_init()
+  for (int t = 0; t < num_traces; t++) {
+    const struct TraceFile *trace   = traces[t];
+    const char             *exe     = "";
+    uint32_t               written  = (trace->head < PRELOAD_TRACE_RECORDS) ? trace->head : PRELOAD_TRACE_RECORDS;
+
+    for (uint32_t i = trace->head - written; i != trace->head; i++) {
+      const struct TraceRecord *record = &trace->records[i & (PRELOAD_TRACE_RECORDS - 1)];
+
+      if (record->event == TRACE_PROCESS && record->pid == trace->pid) {
+        exe = record_path(trace, record);
+        break;
+      }
+    }
+
+    add_process_image(trace->pid, trace->ppid, trace->start_ns, exe[0] ? exe : "?");
+  }
+
+  for (int i = 0; i < num_processes; i++) {
+    if (!processes[i].visited && find_process(processes[i].ppid) == NULL) assign_sort_index(&processes[i]);
+  }
+
+  // processes whose parent is in a cycle (pid reuse)
+  for (int i = 0; i < num_processes; i++) {
+    if (!processes[i].visited) assign_sort_index(&processes[i]);
+  }
+
+  printf("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+
+  for (int i = 0; i < num_processes; i++) {
+    printf("%s{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%u,\"args\":{\"name\":", first_event ? "" : ",\n", processes[i].pid);
+    print_json_string(processes[i].name);
+    printf("}},\n{\"ph\":\"M\",\"name\":\"process_labels\",\"pid\":%u,\"args\":{\"labels\":\"parent: %u\"}},\n",
+           processes[i].pid, processes[i].ppid);
+    printf("{\"ph\":\"M\",\"name\":\"process_sort_index\",\"pid\":%u,\"args\":{\"sort_index\":%u}}",
+           processes[i].pid, processes[i].sort_index);
+
+    first_event = false;
+  }
+
+  for (int t = 0; t < num_traces; t++) {
+    const struct TraceFile *trace  = traces[t];
+    uint32_t               written = (trace->head < PRELOAD_TRACE_RECORDS) ? trace->head : PRELOAD_TRACE_RECORDS;
+
+    for (uint32_t i = trace->head - written; i != trace->head; i++) {
+      const struct TraceRecord *record = &trace->records[i & (PRELOAD_TRACE_RECORDS - 1)];
+
+      // slot reserved by a process that was killed before writing it
+      if (record->event == TRACE_NONE || record->event >= TRACE_MAX) continue;
+
+      printf(",\n{\"ph\":\"X\",\"cat\":\"crew-preload\",\"name\":\"%s\",\"pid\":%u,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"path\":",
+             event_names[record->event], record->pid, record->pid,
+             (record->timestamp_ns - base_ns) / 1e3, record->duration_ns / 1e3);
+      print_json_string(record_path(trace, record));
+      printf(",\"ppid\":%u%s%s}}", record->ppid,
+             (record->flags & TRACE_FLAG_SPAWN) ? ",\"spawn\":true" : "",
+             (record->flags & TRACE_FLAG_FAILED) ? ",\"failed\":true" : "");
+    }
+  }
+
+  printf("\n]}\n");
+  return 0;
+}
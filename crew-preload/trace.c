@@ -0,0 +1,234 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  trace.c: Binary event tracing
+
+  If CREW_PRELOAD_TRACE is set to a directory, every process image using crew-preload.so creates its own trace file
+  in it (<pid>-<start time>.trace, see trace.h for the layout) and appends a fixed-size record to its ring buffer for:
+
+    - preload_init()           (once per process, with the path of the executable)
+    - exec_wrapper()           (time spent until the real exec*()/posix_spawn*() is called)
+    - get_elf_information()
+    - change_elf_interpreter() (for both exec cache and memfd copies)
+    - search_in_path()
+
+  Recording an event costs one clock_gettime() (vDSO), getpid()/getppid() plus a hash lookup of its path, nothing
+  is written to stderr, so tracing can stay enabled for a whole build. Paths are stored once per file and referenced
+  by ID.
+
+  Threads and forked children keep writing into the file of their process until they call exec*() (slots and path
+  IDs are reserved atomically, records carry the pid of the writer, which is looked up for every record as vfork()
+  children share the memory of their parent). Use tools/crew-preload-trace to convert all files of a
+  build into a Chrome trace (JSON) that can be loaded into Perfetto or chrome://tracing.
+*/
+
+#include "./main.h"
+
+#define TRACE_PATH_IDS 1024 // size of the per-process path ID table, must be a power of two
+
+struct TracePathId {
+  uint32_t hash,
+           id;
+};
+
+static struct TraceFile   *trace_file   = NULL;
+static bool               trace_mapped = false;
+static uint64_t           init_start   = 0;
+static struct TracePathId path_ids[TRACE_PATH_IDS];
+
+// state of the current exec_wrapper() call of this thread
+static THREAD_LOCAL bool     exec_recorded = false;
+static THREAD_LOCAL uint64_t exec_start    = 0;
+static THREAD_LOCAL uint32_t exec_path_id  = 0;
+static THREAD_LOCAL uint16_t exec_flags    = 0;
+
+static THREAD_LOCAL struct TraceRecord *exec_record = NULL;
+
+static uint64_t monotonic_ns(void) {
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static struct TraceFile *map_trace(void) {
+  const char *trace_dir = getenv("CREW_PRELOAD_TRACE");
+  char       trace_path[PATH_MAX];
+  uint32_t   trace_pid, trace_ppid;
+  uint64_t   start_ns;
+  void       *mem;
+  int        fd;
+
+  if (trace_mapped) return trace_file;
+  trace_mapped = true;
+
+  if (trace_dir == NULL || trace_dir[0] == '\0') return NULL;
+
+  trace_pid  = getpid();
+  trace_ppid = getppid();
+  start_ns   = monotonic_ns();
+
+  if (snprintf(trace_path, sizeof(trace_path), "%s/%u-%llu.trace", trace_dir, trace_pid, (unsigned long long) start_ns) >= PATH_MAX) return NULL;
+
+  mkdir(trace_dir, 0755);
+
+  if ((fd = open(trace_path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+    fprintf(stderr, "[PID %-7i] %s: Failed to create trace file %s (%s)\n", getpid(), PROMPT_NAME, trace_path, strerror(errno));
+    return NULL;
+  }
+
+  // the file is sparse, only pages that records/paths are written into take up space
+  if (ftruncate(fd, sizeof(struct TraceFile)) == -1) {
+    close(fd);
+    return NULL;
+  }
+
+  mem = mmap(NULL, sizeof(struct TraceFile), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (mem == MAP_FAILED) return NULL;
+
+  trace_file               = mem;
+  trace_file->version      = PRELOAD_TRACE_VERSION;
+  trace_file->num_records  = PRELOAD_TRACE_RECORDS;
+  trace_file->strings_size = PRELOAD_TRACE_STRINGS;
+  trace_file->pid          = trace_pid;
+  trace_file->ppid         = trace_ppid;
+  trace_file->start_ns     = start_ns;
+  __atomic_store_n(&trace_file->magic, PRELOAD_TRACE_MAGIC, __ATOMIC_RELEASE);
+
+  return trace_file;
+}
+
+static uint32_t add_string(const char *path, uint32_t len) {
+  // add_string(): append path to the string table of the trace file, returns its ID (0 if the table is full)
+  uint32_t offset = __atomic_fetch_add(&trace_file->strings_used, len + 1, __ATOMIC_RELAXED);
+
+  if (offset + len + 1 > PRELOAD_TRACE_STRINGS) return 0;
+
+  memcpy(trace_file->strings + offset, path, len + 1);
+  return offset + 1;
+}
+
+static uint32_t path_id(const char *path) {
+  // path_id(): ID of path in the string table of the trace file, path is added to it if needed
+  //            (returns 0 if the table is full)
+  //
+  //            slots are claimed by setting their hash, their ID follows once the string is written: a thread
+  //            that finds a claimed slot without ID adds the path again instead of waiting
+  uint32_t hash = 2166136261u, len, id;
+
+  if (path == NULL) return 0;
+
+  for (len = 0; path[len]; len++) hash = (hash ^ (uint8_t) path[len]) * 16777619u;
+  hash = hash ?: 1;
+
+  for (uint32_t i = hash & (TRACE_PATH_IDS - 1), probes = 0; probes < TRACE_PATH_IDS; i = (i + 1) & (TRACE_PATH_IDS - 1), probes++) {
+    struct TracePathId *entry      = &path_ids[i];
+    uint32_t           entry_hash = __atomic_load_n(&entry->hash, __ATOMIC_ACQUIRE);
+
+    if (entry_hash == 0 && __atomic_compare_exchange_n(&entry->hash, &entry_hash, hash, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+      id = add_string(path, len);
+      __atomic_store_n(&entry->id, id, __ATOMIC_RELEASE);
+      return id;
+    }
+
+    if (entry_hash == hash) {
+      id = __atomic_load_n(&entry->id, __ATOMIC_ACQUIRE);
+
+      if (id == 0) return add_string(path, len);
+      if (strcmp(trace_file->strings + id - 1, path) == 0) return id;
+    }
+  }
+
+  return 0;
+}
+
+static struct TraceRecord *append_record(enum PreloadTraceEvent event, uint32_t id, uint64_t start, uint16_t flags) {
+  uint32_t           slot   = __atomic_fetch_add(&trace_file->head, 1, __ATOMIC_RELAXED);
+  struct TraceRecord *record = &trace_file->records[slot & (PRELOAD_TRACE_RECORDS - 1)];
+
+  record->timestamp_ns = start;
+  record->duration_ns  = monotonic_ns() - start;
+  record->pid          = getpid();
+  record->ppid         = getppid();
+  record->path_id      = id;
+  record->flags        = flags;
+  __atomic_store_n(&record->event, event, __ATOMIC_RELEASE);
+
+  return record;
+}
+
+uint64_t trace_now(void) {
+  // trace_now(): start time of an event, 0 if tracing is disabled (trace_event() ignores such events)
+  return map_trace() ? monotonic_ns() : 0;
+}
+
+void trace_event(enum PreloadTraceEvent event, const char *path, uint64_t start, uint16_t flags) {
+  // trace_event(): record an event that started at start (returned by trace_now()) and ends now
+  if (start == 0 || trace_file == NULL) return;
+
+  append_record(event, path_id(path), start, flags);
+}
+
+void trace_init_begin(void) {
+  init_start = trace_now();
+}
+
+void trace_init_end(void) {
+  // trace_init_end(): record process start, with the path of the executable
+  char exe_path[PATH_MAX];
+  int  len;
+
+  if (init_start == 0) return;
+
+  if ((len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1)) == -1) len = 0;
+  exe_path[len] = '\0';
+
+  // executables with a rewritten interpreter run from a memfd ("/memfd:<original path> (deleted)")
+  if (len > 7 && memcmp(exe_path, "/memfd:", 7) == 0) {
+    if (len > 17 && strcmp(exe_path + len - 10, " (deleted)") == 0) exe_path[len - 10] = '\0';
+    trace_event(TRACE_PROCESS, exe_path + 7, init_start, 0);
+  } else {
+    trace_event(TRACE_PROCESS, exe_path, init_start, 0);
+  }
+}
+
+void trace_exec_begin(const char *path, bool is_spawn) {
+  // trace_exec_begin(): called when exec_wrapper() is entered
+  if (map_trace() == NULL) return;
+
+  exec_recorded = false;
+  exec_record   = NULL;
+  exec_flags    = is_spawn ? TRACE_FLAG_SPAWN : 0;
+  exec_path_id  = path_id(path);
+  exec_start    = monotonic_ns();
+}
+
+void trace_exec_ready(void) {
+  // trace_exec_ready(): called right before the real exec*()/posix_spawn*()
+  if (trace_file == NULL || exec_recorded) return;
+
+  exec_recorded = true;
+  exec_record   = append_record(TRACE_EXEC, exec_path_id, exec_start, exec_flags);
+}
+
+void trace_exec_end(bool failed) {
+  // trace_exec_end(): called when exec_wrapper() returns (exec*() failed or posix_spawn*() finished)
+  if (trace_file == NULL) return;
+
+  if (failed) exec_flags |= TRACE_FLAG_FAILED;
+
+  // returned before reaching the real exec*()/posix_spawn*()
+  trace_exec_ready();
+
+  // the real exec*()/posix_spawn*() failed after the record was written
+  if (failed && exec_record) __atomic_fetch_or(&exec_record->flags, TRACE_FLAG_FAILED, __ATOMIC_RELAXED);
+}
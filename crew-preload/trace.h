@@ -0,0 +1,69 @@
+/*
+  Copyright (C) 2013-2025 Chromebrew Authors
+
+  This program is free software: you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation, either version 3 of the License, or
+  (at your option) any later version.
+*/
+
+/*
+  trace.h: Layout of the trace files written by crew-preload.so (see trace.c), also used by
+           tools/crew-preload-trace.c to read them
+*/
+
+#ifndef TRACE_H_INCLUDED
+#define TRACE_H_INCLUDED
+
+#include <stdint.h>
+
+#define PRELOAD_TRACE_MAGIC   0x43525054 // "CRPT"
+#define PRELOAD_TRACE_VERSION 1
+#define PRELOAD_TRACE_RECORDS 8192       // ring capacity, must be a power of two
+#define PRELOAD_TRACE_STRINGS 262144     // bytes reserved for paths referenced by records
+
+// X(name, description), description is used as event name in the converted trace
+#define PRELOAD_TRACE_EVENT_LIST(X) \
+  X(PROCESS,        "preload_init") \
+  X(EXEC,           "exec_wrapper") \
+  X(ELF_INFO,       "get_elf_information") \
+  X(INTERP_REWRITE, "change_elf_interpreter") \
+  X(PATH_LOOKUP,    "search_in_path")
+
+enum PreloadTraceEvent {
+  TRACE_NONE, // unused slot
+#define X(name, description) TRACE_##name,
+  PRELOAD_TRACE_EVENT_LIST(X)
+#undef X
+  TRACE_MAX
+};
+
+#define TRACE_FLAG_SPAWN  0x1 // TRACE_EXEC: called through posix_spawn*()
+#define TRACE_FLAG_FAILED 0x2 // TRACE_EXEC/TRACE_PATH_LOOKUP/TRACE_INTERP_REWRITE: returned an error
+
+// all fields have fixed size and offset as files are written by 32-bit and 64-bit processes
+struct TraceRecord {
+  uint64_t timestamp_ns, // CLOCK_MONOTONIC, start of the event
+           duration_ns;
+  uint32_t pid,
+           ppid,
+           path_id;      // offset into strings + 1, 0 if no path is recorded
+  uint16_t event,
+           flags;
+};
+
+struct TraceFile {
+  uint32_t           magic,
+                     version,
+                     num_records,
+                     strings_size,
+                     pid,          // process that created this file (each exec*() creates a new one)
+                     ppid,
+                     head,         // total number of records written, records[head % num_records] is the next slot
+                     strings_used;
+  uint64_t           start_ns;
+  struct TraceRecord records[PRELOAD_TRACE_RECORDS];
+  char               strings[PRELOAD_TRACE_STRINGS];
+};
+
+#endif